@@ -0,0 +1,559 @@
+#ifndef AUGMENTED_AVL_H
+#define AUGMENTED_AVL_H
+
+#include <limits>
+#include <cstdint>
+#include <functional>
+#include "avlbst.h"
+
+/**
+* Monoids for AugmentedAVLTree. A monoid supplies the aggregate type, its
+* identity, an associative combine, and lift, which turns one entry into
+* an aggregate.
+*/
+template <typename T>
+struct SumMonoid
+{
+    typedef T value_type;
+    static T identity() { return T(); }
+    static T combine(const T& a, const T& b) { return a + b; }
+    template<typename Key, typename Value>
+    static T lift(const Key&, const Value& value) { return value; }
+};
+
+template <typename T>
+struct MinMonoid
+{
+    typedef T value_type;
+    static T identity() { return std::numeric_limits<T>::max(); }
+    static T combine(const T& a, const T& b) { return b < a ? b : a; }
+    template<typename Key, typename Value>
+    static T lift(const Key&, const Value& value) { return value; }
+};
+
+template <typename T>
+struct MaxMonoid
+{
+    typedef T value_type;
+    static T identity() { return std::numeric_limits<T>::lowest(); }
+    static T combine(const T& a, const T& b) { return a < b ? b : a; }
+    template<typename Key, typename Value>
+    static T lift(const Key&, const Value& value) { return value; }
+};
+
+struct CountMonoid
+{
+    typedef size_t value_type;
+    static size_t identity() { return 0; }
+    static size_t combine(size_t a, size_t b) { return a + b; }
+    template<typename Key, typename Value>
+    static size_t lift(const Key&, const Value&) { return 1; }
+};
+
+/**
+* A digest of the entries of a range in key order: a polynomial hash over
+* the per-entry hashes, kept with the matching power of its base. combine
+* is associative, so the digest of a range does not depend on the shape
+* of the tree, and two trees holding the same entries agree on it.
+*/
+template <typename KeyHash, typename ValueHash>
+struct DigestMonoid
+{
+    struct Digest
+    {
+        uint64_t hash;
+        uint64_t scale;    // BASE to the number of entries
+
+        bool operator==(const Digest& other) const { return hash == other.hash && scale == other.scale; }
+        bool operator!=(const Digest& other) const { return !(*this == other); }
+    };
+
+    static constexpr uint64_t BASE = 0x9e3779b97f4a7c15ULL;
+
+    typedef Digest value_type;
+    static Digest identity() { Digest d = { 0, 1 }; return d; }
+    static Digest combine(const Digest& a, const Digest& b)
+    {
+        Digest d = { a.hash * b.scale + b.hash, a.scale * b.scale };
+        return d;
+    }
+    template<typename Key, typename Value>
+    static Digest lift(const Key& key, const Value& value)
+    {
+        // splitmix64 finalizer, so identity hashes still spread
+        uint64_t h = uint64_t(KeyHash()(key)) * 0xbf58476d1ce4e5b9ULL ^ uint64_t(ValueHash()(value));
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        Digest d = { h ^ (h >> 31), BASE };
+        return d;
+    }
+};
+
+/**
+* An AVLNode that also caches the monoid aggregate of its whole subtree.
+*/
+template <typename Key, typename Value, typename Monoid>
+class AugmentedAVLNode : public AVLNode<Key, Value>
+{
+public:
+    typedef typename Monoid::value_type Aggregate;
+
+    AugmentedAVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
+
+    const Aggregate& getAggregate() const;
+    void setAggregate(const Aggregate& aggregate);
+
+protected:
+    Aggregate aggregate_;
+};
+
+template<class Key, class Value, class Monoid>
+AugmentedAVLNode<Key, Value, Monoid>::AugmentedAVLNode(const Key& key, const Value& value,
+                                                       AVLNode<Key, Value>* parent) :
+    AVLNode<Key, Value>(key, value, parent),
+    aggregate_(Monoid::lift(key, value))
+{
+
+}
+
+template<class Key, class Value, class Monoid>
+const typename Monoid::value_type& AugmentedAVLNode<Key, Value, Monoid>::getAggregate() const
+{
+    return aggregate_;
+}
+
+template<class Key, class Value, class Monoid>
+void AugmentedAVLNode<Key, Value, Monoid>::setAggregate(const Aggregate& aggregate)
+{
+    aggregate_ = aggregate;
+}
+
+/**
+* An AVL tree that keeps a monoid aggregate (sum, min, max, count, ...) in
+* every node. The aggregates are repaired through the AVLTree augmentation
+* hooks on every rotation, retrace, split and join, so aggregate(lo, hi)
+* answers range queries in O(log n).
+*
+* Values must be changed through insert() so the aggregates stay current.
+* Writing one in place would leave the aggregates above it stale, so the
+* AVLTree base is protected, not public, and only the parts of its
+* interface that cannot write values are exposed again: iterators are
+* const_iterators, operator[] is const and for_each passes values as
+* const. A node handle's mapped() may still be changed: reinserting the
+* handle recomputes the aggregates along its path.
+*/
+template <typename Key, typename Value, typename Monoid>
+class AugmentedAVLTree : protected AVLTree<Key, Value>
+{
+public:
+    typedef typename Monoid::value_type Aggregate;
+
+    AugmentedAVLTree();
+    AugmentedAVLTree(const AugmentedAVLTree<Key, Value, Monoid>& other);
+    AugmentedAVLTree(AugmentedAVLTree<Key, Value, Monoid>&& other);
+    AugmentedAVLTree<Key, Value, Monoid>& operator=(const AugmentedAVLTree<Key, Value, Monoid>& other);
+    AugmentedAVLTree<Key, Value, Monoid>& operator=(AugmentedAVLTree<Key, Value, Monoid>&& other);
+
+    typedef typename BinarySearchTree<Key, Value>::const_iterator iterator;
+    typedef typename BinarySearchTree<Key, Value>::const_iterator const_iterator;
+    typedef typename BinarySearchTree<Key, Value>::const_reverse_iterator reverse_iterator;
+    typedef typename BinarySearchTree<Key, Value>::const_reverse_iterator const_reverse_iterator;
+    typedef typename BinarySearchTree<Key, Value>::node_type node_type;
+
+    struct insert_return_type
+    {
+        iterator position;
+        bool inserted;
+        node_type node;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key) const;
+
+    template<typename Func>
+    void for_each(Func f) const;
+    template<typename Func>
+    void for_each_range(const Key& lo, const Key& hi, Func f) const;
+    template<typename Func>
+    void parallel_for_each(Func f, unsigned threads = 0) const;
+
+    using BinarySearchTree<Key, Value>::insert;
+    virtual void insert(const std::pair<const Key, Value>& keyValuePair) override;
+    insert_return_type insert(node_type&& nh);
+    iterator erase(iterator pos);
+    iterator erase(iterator first, iterator last);
+    using BinarySearchTree<Key, Value>::extract;
+    node_type extract(iterator pos);
+    Value const & operator[](const Key& key) const;
+
+    // The rest of the base interface, none of which writes values in place
+    using AVLTree<Key, Value>::remove;
+    using AVLTree<Key, Value>::insertBatch;
+    using AVLTree<Key, Value>::rebalance;
+    using AVLTree<Key, Value>::begin_batch;
+    using AVLTree<Key, Value>::commit;
+    using AVLTree<Key, Value>::rollback;
+    using AVLTree<Key, Value>::in_batch;
+    using AVLTree<Key, Value>::save;
+    using AVLTree<Key, Value>::load;
+    using BinarySearchTree<Key, Value>::clear;
+    using BinarySearchTree<Key, Value>::erase_range;
+    using BinarySearchTree<Key, Value>::empty;
+    using BinarySearchTree<Key, Value>::count;
+    using BinarySearchTree<Key, Value>::cbegin;
+    using BinarySearchTree<Key, Value>::cend;
+    using BinarySearchTree<Key, Value>::crbegin;
+    using BinarySearchTree<Key, Value>::crend;
+    using BinarySearchTree<Key, Value>::isBalanced;
+    using BinarySearchTree<Key, Value>::print;
+    using BinarySearchTree<Key, Value>::enableLookupCache;
+    using BinarySearchTree<Key, Value>::disableLookupCache;
+    using BinarySearchTree<Key, Value>::lookupCacheHits;
+    using BinarySearchTree<Key, Value>::lookupCacheMisses;
+    using BinarySearchTree<Key, Value>::enableMembershipFilter;
+    using BinarySearchTree<Key, Value>::disableMembershipFilter;
+    using BinarySearchTree<Key, Value>::membershipFilterMemory;
+    using BinarySearchTree<Key, Value>::setMutationListener;
+    using BinarySearchTree<Key, Value>::mutationListener;
+
+    Aggregate aggregate() const;
+    Aggregate aggregate(const Key& lo, const Key& hi) const;
+
+protected:
+    typedef AugmentedAVLNode<Key, Value, Monoid> AugNode;
+
+    static Aggregate aggregateOf(Node<Key, Value>* node);
+    typename BinarySearchTree<Key, Value>::iterator unconst(iterator pos) const;
+    Aggregate rangeAggregate(const Key* lo, const Key* hi) const;
+
+    virtual Node<Key, Value>* createNode(const Key& key, const Value& value, Node<Key, Value>* parent) const override;
+    virtual Node<Key, Value>* cloneNode(const Node<Key, Value>* node, Node<Key, Value>* parent) const override;
+    virtual void updateAugment(AVLNode<Key, Value>* node) override;
+    virtual void updateAugmentPath(AVLNode<Key, Value>* node) override;
+};
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the AugmentedAVLTree class.
+  -----------------------------------------------------
+*/
+
+template<class Key, class Value, class Monoid>
+AugmentedAVLTree<Key, Value, Monoid>::AugmentedAVLTree() : AVLTree<Key, Value>()
+{
+
+}
+
+template<class Key, class Value, class Monoid>
+AugmentedAVLTree<Key, Value, Monoid>::AugmentedAVLTree(const AugmentedAVLTree<Key, Value, Monoid>& other) :
+    AVLTree<Key, Value>()
+{
+    this->root_ = this->copy_Helper(other.root_, nullptr);
+    this->nodeCount_ = other.nodeCount_;
+    this->updateExtremes();
+}
+
+template<class Key, class Value, class Monoid>
+AugmentedAVLTree<Key, Value, Monoid>::AugmentedAVLTree(AugmentedAVLTree<Key, Value, Monoid>&& other) :
+    AVLTree<Key, Value>(std::move(other))
+{
+
+}
+
+template<class Key, class Value, class Monoid>
+AugmentedAVLTree<Key, Value, Monoid>&
+AugmentedAVLTree<Key, Value, Monoid>::operator=(const AugmentedAVLTree<Key, Value, Monoid>& other)
+{
+    AVLTree<Key, Value>::operator=(other);
+    return *this;
+}
+
+template<class Key, class Value, class Monoid>
+AugmentedAVLTree<Key, Value, Monoid>&
+AugmentedAVLTree<Key, Value, Monoid>::operator=(AugmentedAVLTree<Key, Value, Monoid>&& other)
+{
+    AVLTree<Key, Value>::operator=(std::move(other));
+    return *this;
+}
+
+/**
+* Overwriting an existing key changes its lifted aggregate, so the path to
+* the root is refreshed; new keys are handled by the attach hook.
+*/
+template<class Key, class Value, class Monoid>
+void AugmentedAVLTree<Key, Value, Monoid>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    if (this->stage(keyValuePair.first, &keyValuePair.second)) {
+        return;
+    }
+
+    Node<Key, Value>* node = this->internalFind(keyValuePair.first);
+
+    if (node) {
+        if (this->listener_) {
+            this->listener_->onInsert(keyValuePair.first, keyValuePair.second);
+        }
+        node->setValue(keyValuePair.second);
+        this->updateAugmentPath(static_cast<AVLNode<Key, Value>*>(node));
+    }
+    else {
+        BinarySearchTree<Key, Value>::insert(keyValuePair);
+    }
+}
+
+template<class Key, class Value, class Monoid>
+typename AugmentedAVLTree<Key, Value, Monoid>::insert_return_type
+AugmentedAVLTree<Key, Value, Monoid>::insert(node_type&& nh)
+{
+    typename BinarySearchTree<Key, Value>::insert_return_type inserted =
+        BinarySearchTree<Key, Value>::insert(std::move(nh));
+    insert_return_type result;
+    result.position = inserted.position;
+    result.inserted = inserted.inserted;
+    result.node = std::move(inserted.node);
+    return result;
+}
+
+template<class Key, class Value, class Monoid>
+Value const & AugmentedAVLTree<Key, Value, Monoid>::operator[](const Key& key) const
+{
+    return BinarySearchTree<Key, Value>::operator[](key);
+}
+
+template<class Key, class Value, class Monoid>
+typename AugmentedAVLTree<Key, Value, Monoid>::iterator AugmentedAVLTree<Key, Value, Monoid>::begin() const
+{
+    return BinarySearchTree<Key, Value>::begin();
+}
+
+template<class Key, class Value, class Monoid>
+typename AugmentedAVLTree<Key, Value, Monoid>::iterator AugmentedAVLTree<Key, Value, Monoid>::end() const
+{
+    return BinarySearchTree<Key, Value>::end();
+}
+
+template<class Key, class Value, class Monoid>
+typename AugmentedAVLTree<Key, Value, Monoid>::reverse_iterator AugmentedAVLTree<Key, Value, Monoid>::rbegin() const
+{
+    return reverse_iterator(end());
+}
+
+template<class Key, class Value, class Monoid>
+typename AugmentedAVLTree<Key, Value, Monoid>::reverse_iterator AugmentedAVLTree<Key, Value, Monoid>::rend() const
+{
+    return reverse_iterator(begin());
+}
+
+template<class Key, class Value, class Monoid>
+typename AugmentedAVLTree<Key, Value, Monoid>::iterator
+AugmentedAVLTree<Key, Value, Monoid>::find(const Key& key) const
+{
+    return BinarySearchTree<Key, Value>::find(key);
+}
+
+template<class Key, class Value, class Monoid>
+typename AugmentedAVLTree<Key, Value, Monoid>::iterator
+AugmentedAVLTree<Key, Value, Monoid>::lower_bound(const Key& key) const
+{
+    return BinarySearchTree<Key, Value>::lower_bound(key);
+}
+
+template<class Key, class Value, class Monoid>
+typename AugmentedAVLTree<Key, Value, Monoid>::iterator
+AugmentedAVLTree<Key, Value, Monoid>::upper_bound(const Key& key) const
+{
+    return BinarySearchTree<Key, Value>::upper_bound(key);
+}
+
+template<class Key, class Value, class Monoid>
+std::pair<typename AugmentedAVLTree<Key, Value, Monoid>::iterator, typename AugmentedAVLTree<Key, Value, Monoid>::iterator>
+AugmentedAVLTree<Key, Value, Monoid>::equal_range(const Key& key) const
+{
+    return std::make_pair(lower_bound(key), upper_bound(key));
+}
+
+template<class Key, class Value, class Monoid>
+template<typename Func>
+void AugmentedAVLTree<Key, Value, Monoid>::for_each(Func f) const
+{
+    BinarySearchTree<Key, Value>::for_each([&f](const Key& key, const Value& value) { f(key, value); });
+}
+
+template<class Key, class Value, class Monoid>
+template<typename Func>
+void AugmentedAVLTree<Key, Value, Monoid>::for_each_range(const Key& lo, const Key& hi, Func f) const
+{
+    BinarySearchTree<Key, Value>::for_each_range(lo, hi, [&f](const Key& key, const Value& value) { f(key, value); });
+}
+
+template<class Key, class Value, class Monoid>
+template<typename Func>
+void AugmentedAVLTree<Key, Value, Monoid>::parallel_for_each(Func f, unsigned threads) const
+{
+    BinarySearchTree<Key, Value>::parallel_for_each([&f](const Key& key, const Value& value) { f(key, value); },
+                                                    threads);
+}
+
+template<class Key, class Value, class Monoid>
+typename AugmentedAVLTree<Key, Value, Monoid>::iterator AugmentedAVLTree<Key, Value, Monoid>::erase(iterator pos)
+{
+    return BinarySearchTree<Key, Value>::erase(unconst(pos));
+}
+
+template<class Key, class Value, class Monoid>
+typename AugmentedAVLTree<Key, Value, Monoid>::iterator
+AugmentedAVLTree<Key, Value, Monoid>::erase(iterator first, iterator last)
+{
+    return BinarySearchTree<Key, Value>::erase(unconst(first), unconst(last));
+}
+
+template<class Key, class Value, class Monoid>
+typename AugmentedAVLTree<Key, Value, Monoid>::node_type AugmentedAVLTree<Key, Value, Monoid>::extract(iterator pos)
+{
+    return BinarySearchTree<Key, Value>::extract(unconst(pos));
+}
+
+/**
+* Returns the aggregate of the whole tree in O(1).
+*/
+template<class Key, class Value, class Monoid>
+typename Monoid::value_type AugmentedAVLTree<Key, Value, Monoid>::aggregate() const
+{
+    return aggregateOf(this->root_);
+}
+
+/**
+* Returns the aggregate of every entry with lo <= key < hi, combined in key
+* order. Descends to the node where the paths to lo and hi split, then
+* walks each path once, using cached subtree aggregates for every subtree
+* lying entirely inside the range. O(log n).
+*/
+template<class Key, class Value, class Monoid>
+typename Monoid::value_type AugmentedAVLTree<Key, Value, Monoid>::aggregate(const Key& lo, const Key& hi) const
+{
+    return rangeAggregate(&lo, &hi);
+}
+
+/**
+* aggregate(lo, hi) with either bound optional: a NULL bound leaves that
+* end of the range open.
+*/
+template<class Key, class Value, class Monoid>
+typename Monoid::value_type AugmentedAVLTree<Key, Value, Monoid>::rangeAggregate(const Key* lo, const Key* hi) const
+{
+    Node<Key, Value>* split = this->root_;
+    while (split) {
+        if (lo && split->getKey() < *lo) {
+            split = split->getRight();
+        }
+        else if (hi && !(split->getKey() < *hi)) {
+            split = split->getLeft();
+        }
+        else {
+            break;
+        }
+    }
+
+    if (split == nullptr) {
+        return Monoid::identity();
+    }
+
+    // Keys >= lo in the left subtree, built right to left
+    Aggregate leftPart = Monoid::identity();
+    for (Node<Key, Value>* node = split->getLeft(); node; ) {
+        if (lo && node->getKey() < *lo) {
+            node = node->getRight();
+        }
+        else {
+            Aggregate part = Monoid::combine(Monoid::lift(node->getKey(), node->getValue()),
+                                             aggregateOf(node->getRight()));
+            leftPart = Monoid::combine(part, leftPart);
+            node = node->getLeft();
+        }
+    }
+
+    // Keys < hi in the right subtree, built left to right
+    Aggregate rightPart = Monoid::identity();
+    for (Node<Key, Value>* node = split->getRight(); node; ) {
+        if (!hi || node->getKey() < *hi) {
+            Aggregate part = Monoid::combine(aggregateOf(node->getLeft()),
+                                             Monoid::lift(node->getKey(), node->getValue()));
+            rightPart = Monoid::combine(rightPart, part);
+            node = node->getRight();
+        }
+        else {
+            node = node->getLeft();
+        }
+    }
+
+    return Monoid::combine(Monoid::combine(leftPart, Monoid::lift(split->getKey(), split->getValue())), rightPart);
+}
+
+template<class Key, class Value, class Monoid>
+typename Monoid::value_type AugmentedAVLTree<Key, Value, Monoid>::aggregateOf(Node<Key, Value>* node)
+{
+    return node ? static_cast<AugNode*>(node)->getAggregate() : Monoid::identity();
+}
+
+/**
+* Converts pos to the base iterator for erasing through the base class,
+* reusing its node rather than searching for the key again.
+*/
+template<class Key, class Value, class Monoid>
+typename BinarySearchTree<Key, Value>::iterator AugmentedAVLTree<Key, Value, Monoid>::unconst(iterator pos) const
+{
+    return this->makeIterator(this->nodeOf(pos));
+}
+
+template<class Key, class Value, class Monoid>
+Node<Key, Value>* AugmentedAVLTree<Key, Value, Monoid>::createNode(const Key& key, const Value& value,
+                                                                   Node<Key, Value>* parent) const
+{
+    return new AugNode(key, value, static_cast<AVLNode<Key, Value>*>(parent));
+}
+
+template<class Key, class Value, class Monoid>
+Node<Key, Value>* AugmentedAVLTree<Key, Value, Monoid>::cloneNode(const Node<Key, Value>* node,
+                                                                  Node<Key, Value>* parent) const
+{
+    const AugNode* augNode = static_cast<const AugNode*>(node);
+    AugNode* copy = new AugNode(node->getKey(), node->getValue(), static_cast<AVLNode<Key, Value>*>(parent));
+    copy->setBalance(augNode->getBalance());
+    copy->setAggregate(augNode->getAggregate());
+    return copy;
+}
+
+/**
+* Recomputes node's aggregate from its (up to date) children.
+*/
+template<class Key, class Value, class Monoid>
+void AugmentedAVLTree<Key, Value, Monoid>::updateAugment(AVLNode<Key, Value>* node)
+{
+    AugNode* augNode = static_cast<AugNode*>(node);
+    augNode->setAggregate(Monoid::combine(Monoid::combine(aggregateOf(node->getLeft()),
+                                                          Monoid::lift(node->getKey(), node->getValue())),
+                                          aggregateOf(node->getRight())));
+}
+
+template<class Key, class Value, class Monoid>
+void AugmentedAVLTree<Key, Value, Monoid>::updateAugmentPath(AVLNode<Key, Value>* node)
+{
+    while (node) {
+        this->updateAugment(node);
+        node = node->getParent();
+    }
+}
+
+/*
+  ---------------------------------------------------
+  End implementations for the AugmentedAVLTree class.
+  ---------------------------------------------------
+*/
+
+#endif
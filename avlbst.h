@@ -3,10 +3,15 @@
 
 #include <iostream>
 #include <exception>
+#include <stdexcept>
 #include <cstdlib>
 #include <cstdint>
 #include <algorithm>
+#include <vector>
+#include <optional>
+#include <string>
 #include "bst.h"
+#include "snapshot.h"
 
 struct KeyError { };
 
@@ -132,9 +137,51 @@ template <class Key, class Value>
 class AVLTree : public BinarySearchTree<Key, Value>
 {
 public:
-    virtual void insert (const std::pair<const Key, Value> &new_item); // TODO
-    virtual void remove(const Key& key);  // TODO
+    AVLTree();
+    AVLTree(const AVLTree<Key, Value>& other);
+    AVLTree(AVLTree<Key, Value>&& other);
+    AVLTree<Key, Value>& operator=(const AVLTree<Key, Value>& other);
+    AVLTree<Key, Value>& operator=(AVLTree<Key, Value>&& other);
+
+    using BinarySearchTree<Key, Value>::insert;
+    virtual void insert(const std::pair<const Key, Value>& keyValuePair) override;
+    virtual void remove(const Key& key) override;
+    // Inserts a run of pairs sorted by key, as insert() would one at a time
+    template<typename InputIt>
+    void insertBatch(InputIt first, InputIt last);
+    virtual void rebalance() override;
+
+    // All-or-nothing multi-key updates. After begin_batch(), insert,
+    // insertBatch and remove are staged instead of applied, so lookups keep
+    // seeing the tree as it was; erasing through iterators, extracting,
+    // clearing and loading throw std::logic_error until the batch ends.
+    // commit() applies every staged change or, if any step throws, none of
+    // them; rollback() drops them. Not available in multimap mode.
+    void begin_batch();
+    virtual void commit();
+    void rollback();
+    bool in_batch() const;
+
+    // Binary snapshots (see snapshot.h). save writes the entries in key
+    // order; load replaces the contents with a snapshot's, building the
+    // balanced tree directly in O(n). Key and Value must be default
+    // constructible to be loaded.
+    template<typename KeySerializer = Serializer<Key>, typename ValueSerializer = Serializer<Value> >
+    void save(std::ostream& out) const;
+    template<typename KeySerializer = Serializer<Key>, typename ValueSerializer = Serializer<Value> >
+    void load(std::istream& in);
 protected:
+    explicit AVLTree(bool multi);
+
+    struct StagedOp
+    {
+        Key key;
+        std::optional<Value> value;    // empty for a removal
+    };
+
+    virtual Node<Key, Value>* createNode(const Key& key, const Value& value, Node<Key, Value>* parent) const override;
+    virtual void attachNode(Node<Key, Value>* node, Node<Key, Value>* parent) override;
+    virtual void unlinkNode(Node<Key, Value>* node) override;
     virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
 
     // Add helper functions here
@@ -142,88 +189,192 @@ protected:
     void rotateRight(AVLNode<Key, Value>*& node);
     void insert_Helper(AVLNode<Key, Value>* parent, AVLNode<Key, Value>* node);
     void remove_Helper(AVLNode<Key, Value>* node, int height);
+    virtual Node<Key, Value>* cloneNode(const Node<Key, Value>* node, Node<Key, Value>* parent) const override;
+    virtual void eraseNodes(Node<Key, Value>* first, Node<Key, Value>* last) override;
+    virtual void checkDirectChange() const override;
+
+    // Augmentation hooks. updateAugment recomputes one node from its
+    // children; updateAugmentPath does so from node up to the root. Both
+    // are no-ops unless a derived tree keeps per-node aggregates.
+    virtual void updateAugment(AVLNode<Key, Value>* node);
+    virtual void updateAugmentPath(AVLNode<Key, Value>* node);
+
+    // Split/join on detached subtrees. Heights are passed alongside each
+    // subtree root since nodes only store their balance.
+    int link(AVLNode<Key, Value>* node, AVLNode<Key, Value>* left, int hl, AVLNode<Key, Value>* right, int hr);
+    static int leftHeight(AVLNode<Key, Value>* node, int h);
+    static int rightHeight(AVLNode<Key, Value>* node, int h);
+    static int subtreeHeight(AVLNode<Key, Value>* node);
+    AVLNode<Key, Value>* join(AVLNode<Key, Value>* left, int hl, AVLNode<Key, Value>* pivot,
+                                     AVLNode<Key, Value>* right, int hr, int& h);
+    AVLNode<Key, Value>* joinRight(AVLNode<Key, Value>* left, int hl, AVLNode<Key, Value>* pivot,
+                                          AVLNode<Key, Value>* right, int hr, int& h);
+    AVLNode<Key, Value>* joinLeft(AVLNode<Key, Value>* left, int hl, AVLNode<Key, Value>* pivot,
+                                         AVLNode<Key, Value>* right, int hr, int& h);
+    AVLNode<Key, Value>* join2(AVLNode<Key, Value>* left, int hl, AVLNode<Key, Value>* right, int hr, int& h);
+    AVLNode<Key, Value>* splitLast(AVLNode<Key, Value>* node, int h, AVLNode<Key, Value>*& last, int& hOut);
+    void split(AVLNode<Key, Value>* node, int h, const Key& key,
+                      AVLNode<Key, Value>*& left, int& hl, AVLNode<Key, Value>*& right, int& hr);
+    AVLNode<Key, Value>* build(AVLNode<Key, Value>** nodes, size_t count, int& h);
+    int rebalance_Helper(AVLNode<Key, Value>* node);
+    template<typename KeySerializer, typename ValueSerializer, typename Skip>
+    void save_Helper(std::ostream& out, Skip skip) const;
+    template<typename KeySerializer, typename ValueSerializer>
+    AVLNode<Key, Value>* load_Helper(SnapshotReader& in, size_t count, int& h, Node<Key, Value>*& last);
+
+    // Batch support. mergeCheaper picks between merging count changes into
+    // a rebuilt tree and applying them one by one; findLive returns the
+    // node a lookup of key would report.
+    virtual bool mergeCheaper(size_t count) const;
+    virtual Node<Key, Value>* findLive(const Key& key) const;
+    static bool stagedLess(const StagedOp& a, const StagedOp& b);
+    bool stage(const Key& key, const Value* value);
+    void commitEach(const std::vector<StagedOp>& ops);
+    void commitMerge(const std::vector<StagedOp>& ops);
+    void undoEach(const std::vector<StagedOp>& undo);
+
+    bool batching_;
+    std::vector<StagedOp> staged_;    // in arrival order until commit
 };
 
+template<class Key, class Value>
+AVLTree<Key, Value>::AVLTree() : BinarySearchTree<Key, Value>(), batching_(false)
+{
+
+}
+
+template<class Key, class Value>
+AVLTree<Key, Value>::AVLTree(bool multi) : BinarySearchTree<Key, Value>(multi), batching_(false)
+{
+
+}
+
+/**
+* Copy constructor. The base class copy constructor cannot be used since
+* cloneNode does not dispatch to AVLTree until the base is constructed.
+*/
+template<class Key, class Value>
+AVLTree<Key, Value>::AVLTree(const AVLTree<Key, Value>& other) :
+    BinarySearchTree<Key, Value>(other.multi_), batching_(false)
+{
+    this->root_ = this->copy_Helper(other.root_, nullptr);
+    this->nodeCount_ = other.nodeCount_;
+    this->updateExtremes();
+}
+
+template<class Key, class Value>
+AVLTree<Key, Value>::AVLTree(AVLTree<Key, Value>&& other) :
+    BinarySearchTree<Key, Value>(std::move(other)), batching_(other.batching_), staged_(std::move(other.staged_))
+{
+    other.batching_ = false;
+    other.staged_.clear();
+}
+
+template<class Key, class Value>
+AVLTree<Key, Value>& AVLTree<Key, Value>::operator=(const AVLTree<Key, Value>& other)
+{
+    BinarySearchTree<Key, Value>::operator=(other);
+    return *this;
+}
+
+template<class Key, class Value>
+AVLTree<Key, Value>& AVLTree<Key, Value>::operator=(AVLTree<Key, Value>&& other)
+{
+    if (this != &other) {
+        BinarySearchTree<Key, Value>::operator=(std::move(other));
+        batching_ = other.batching_;
+        staged_.swap(other.staged_);
+        other.batching_ = false;
+        other.staged_.clear();
+    }
+    return *this;
+}
+
+/**
+* Stages the pair while a batch is open; otherwise inserts it as usual.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    if (!stage(keyValuePair.first, &keyValuePair.second)) {
+        BinarySearchTree<Key, Value>::insert(keyValuePair);
+    }
+}
+
+template<class Key, class Value>
+void AVLTree<Key, Value>::remove(const Key& key)
+{
+    if (!stage(key, nullptr)) {
+        BinarySearchTree<Key, Value>::remove(key);
+    }
+}
+
+/**
+* Allocates an AVLNode so that the generic insert builds AVL trees.
+*/
+template<class Key, class Value>
+Node<Key, Value>* AVLTree<Key, Value>::createNode(const Key& key, const Value& value, Node<Key, Value>* parent) const
+{
+    return new AVLNode<Key, Value>(key, value, static_cast<AVLNode<Key, Value>*>(parent));
+}
+
 /*
+ * Links a new leaf under parent and retraces the balance factors.
  * Recall: If key is already in the tree, you should 
- * overwrite the current value with the updated value.
+ * overwrite the current value with the updated value (this is
+ * handled by BinarySearchTree::insert before a node is attached).
  */
 template<class Key, class Value>
-void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
-{
-    if (this->root_) { //If AVL Tree is not empty
-        Node<Key, Value>* node = this->internalFind(new_item.first);
-
-        if (node) { //Node already exists in the tree
-            node->setValue(new_item.second);
-        }
-        else { //Node needs to be inserted
-            AVLNode<Key, Value>* buff = (AVLNode<Key, Value>*) this->root_;
-
-            bool cycle = true;
-            while (cycle) {
-                if (buff->getKey() > new_item.first) {
-                    if (buff->getLeft() == nullptr) {
-                        cycle = false;
-
-                        AVLNode<Key, Value>* avlNode = new AVLNode<Key, Value>(new_item.first, new_item.second, buff);
-                        buff->setLeft(avlNode);
-                        avlNode->setBalance(0);
-                        
-                        if (buff->getBalance() != 0) {
-                            buff->setBalance(0);
-                        }
-                        else {
-                            buff->updateBalance(-1);
-                            this->insert_Helper(buff, avlNode);
-                        }
-                    }
-                    else {
-                        buff = buff->getLeft();
-                    }
-                }
-                else {
-                    if (buff->getRight() == nullptr) {
-                        cycle = false;
-
-                        AVLNode<Key, Value>* avlNode = new AVLNode<Key, Value>(new_item.first, new_item.second, buff);
-                        buff->setRight(avlNode);
-                        avlNode->setBalance(0);
-                        
-                        if (buff->getBalance() != 0) {
-                            buff->setBalance(0);
-                        }
-                        else {
-                            buff->updateBalance(1);
-                            this->insert_Helper(buff, avlNode);
-                        }
-                    }
-                    else {
-                        buff = buff->getRight();
-                    }
-                }
-            }
+void AVLTree<Key, Value>::attachNode(Node<Key, Value>* node, Node<Key, Value>* parent)
+{
+    AVLNode<Key, Value>* avlNode = static_cast<AVLNode<Key, Value>*>(node);
+    AVLNode<Key, Value>* buff = static_cast<AVLNode<Key, Value>*>(parent);
+
+    avlNode->setParent(buff);
+    avlNode->setLeft(nullptr);
+    avlNode->setRight(nullptr);
+    avlNode->setBalance(0);
+
+    if (buff == nullptr) { //AVL Tree is empty
+        this->root_ = avlNode;
+        this->updateAugmentPath(avlNode);
+        return;
+    }
+
+    if (buff->getKey() > avlNode->getKey()) {
+        buff->setLeft(avlNode);
+
+        if (buff->getBalance() != 0) {
+            buff->setBalance(0);
+        }
+        else {
+            buff->updateBalance(-1);
+            this->insert_Helper(buff, avlNode);
         }
     }
-    else { //AVL Tree is empty
-        AVLNode<Key, Value>* buff = new AVLNode<Key, Value>(new_item.first, new_item.second, nullptr);
-        
-        this->root_ = buff;
+    else {
+        buff->setRight(avlNode);
 
-        buff->setBalance(0);
-        buff->setLeft(nullptr);
-        buff->setRight(nullptr);
+        if (buff->getBalance() != 0) {
+            buff->setBalance(0);
+        }
+        else {
+            buff->updateBalance(1);
+            this->insert_Helper(buff, avlNode);
+        }
     }
+
+    this->updateAugmentPath(avlNode);
 }
 
 /*
+ * Detaches node and retraces the balance factors up from its parent.
  * Recall: The writeup specifies that if a node has 2 children you
  * should swap with the predecessor and then remove.
  */
 template<class Key, class Value>
-void AVLTree<Key, Value>:: remove(const Key& key)
+void AVLTree<Key, Value>::unlinkNode(Node<Key, Value>* node)
 {
-    Node<Key, Value>* node = this->internalFind(key);
     int height = 0;
 
     if (node) {
@@ -249,8 +400,8 @@ void AVLTree<Key, Value>:: remove(const Key& key)
                 node->getParent()->setRight(nullptr);
             }
 
-            delete node;
             remove_Helper(parent, height);
+            this->updateAugmentPath(parent);
         }
         else if(node->getLeft() && node->getRight() == nullptr) { //Only left child node
             AVLNode<Key, Value>* parent = (AVLNode<Key, Value>*)(node->getParent());
@@ -277,8 +428,8 @@ void AVLTree<Key, Value>:: remove(const Key& key)
                 node->getLeft()->setParent(node->getParent());
             }
 
-            delete node;
             remove_Helper(parent, height);
+            this->updateAugmentPath(parent);
         }
         else if(node->getLeft() == nullptr && node->getRight()) { //Only right child node
             AVLNode<Key, Value>* parent = (AVLNode<Key, Value>*)(node->getParent());
@@ -305,8 +456,8 @@ void AVLTree<Key, Value>:: remove(const Key& key)
                 node->getRight()->setParent(node->getParent());
             }
 
-            delete node;
             remove_Helper(parent, height);
+            this->updateAugmentPath(parent);
         }
         else if (node->getLeft() && node->getRight()) { //Has two child nodes
             AVLNode<Key, Value>* prev = (AVLNode<Key, Value>*)(this->predecessor(node));
@@ -347,10 +498,15 @@ void AVLTree<Key, Value>:: remove(const Key& key)
                 }
             }
             
-            delete node;
             remove_Helper(parent, height);
+            this->updateAugmentPath(parent);
         }
     }
+
+    node->setParent(nullptr);
+    node->setLeft(nullptr);
+    node->setRight(nullptr);
+    static_cast<AVLNode<Key, Value>*>(node)->setBalance(0);
 }
 
 template<class Key, class Value>
@@ -362,6 +518,19 @@ void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>*
     n2->setBalance(tempB);
 }
 
+/**
+* Clones an AVLNode, carrying its balance over so copies need no retracing.
+*/
+template<class Key, class Value>
+Node<Key, Value>* AVLTree<Key, Value>::cloneNode(const Node<Key, Value>* node, Node<Key, Value>* parent) const
+{
+    const AVLNode<Key, Value>* avlNode = static_cast<const AVLNode<Key, Value>*>(node);
+    AVLNode<Key, Value>* copy = new AVLNode<Key, Value>(node->getKey(), node->getValue(),
+                                                        static_cast<AVLNode<Key, Value>*>(parent));
+    copy->setBalance(avlNode->getBalance());
+    return copy;
+}
+
 template<class Key, class Value>
 void AVLTree<Key, Value>::rotateLeft(AVLNode<Key, Value>*& node) {
     AVLNode<Key, Value>* child = node->getRight();
@@ -403,6 +572,9 @@ void AVLTree<Key, Value>::rotateLeft(AVLNode<Key, Value>*& node) {
         }
         node->getParent()->setLeft(node);
     }
+
+    this->updateAugment(node);
+    this->updateAugment(child);
 }
 
 template<class Key, class Value>
@@ -451,6 +623,9 @@ void AVLTree<Key, Value>::rotateRight(AVLNode<Key, Value>*& node) {
         }
         node->getParent()->setRight(node);
     }
+
+    this->updateAugment(node);
+    this->updateAugment(child);
 }
 
 template<class Key, class Value>
@@ -651,4 +826,813 @@ void AVLTree<Key, Value>::remove_Helper(AVLNode<Key, Value>* node, int height) {
     }
 }
 
+/**
+* Inserts the pairs in [first, last), which must be sorted by key; later
+* pairs win over earlier ones with the same key, as with repeated insert().
+*
+* A batch that is small next to the tree is inserted pair by pair. A large
+* one is merged instead: the existing nodes and the new ones are collected
+* in key order in a single pass and relinked into a perfectly balanced
+* tree, which costs O(n + k) with no rotations at all.
+*
+* Inside an open batch every pair is staged, whatever the batch size.
+*/
+template<class Key, class Value>
+template<typename InputIt>
+void AVLTree<Key, Value>::insertBatch(InputIt first, InputIt last)
+{
+    std::vector<std::pair<Key, Value> > batch(first, last);
+    if (batching_) {
+        for (size_t i = 0; i < batch.size(); i++) {
+            stage(batch[i].first, &batch[i].second);
+        }
+        return;
+    }
+
+    int h;
+    if (!mergeCheaper(batch.size())) {
+        for (size_t i = 0; i < batch.size(); i++) {
+            this->insert(batch[i]);
+        }
+        return;
+    }
+
+    if (this->listener_) {
+        for (size_t i = 0; i < batch.size(); i++) {
+            this->listener_->onInsert(batch[i].first, batch[i].second);
+        }
+    }
+
+    std::vector<AVLNode<Key, Value>*> nodes;
+    std::vector<AVLNode<Key, Value>*> created;
+    Node<Key, Value>* curr = this->leftmost_;
+    try {
+        for (size_t i = 0; i < batch.size(); i++) {
+            const Key& key = batch[i].first;
+            while (curr && (this->multi_ ? !(key < curr->getKey()) : curr->getKey() < key)) {
+                nodes.push_back(static_cast<AVLNode<Key, Value>*>(curr));
+                curr = BinarySearchTree<Key, Value>::successor(curr);
+            }
+            if (!this->multi_) {
+                if (curr && !(key < curr->getKey())) { //Key already in tree
+                    curr->setValue(batch[i].second);
+                    continue;
+                }
+                if (!nodes.empty() && !(nodes.back()->getKey() < key)) { //Repeated in the batch
+                    nodes.back()->setValue(batch[i].second);
+                    continue;
+                }
+            }
+            created.push_back(static_cast<AVLNode<Key, Value>*>(this->createNode(key, batch[i].second, nullptr)));
+            nodes.push_back(created.back());
+        }
+    }
+    catch (...) {
+        for (size_t i = 0; i < created.size(); i++) {
+            delete created[i];
+        }
+        throw;
+    }
+    for (; curr; curr = BinarySearchTree<Key, Value>::successor(curr)) {
+        nodes.push_back(static_cast<AVLNode<Key, Value>*>(curr));
+    }
+
+    this->root_ = build(nodes.data(), nodes.size(), h);
+    if (this->root_) {
+        this->root_->setParent(nullptr);
+    }
+    this->nodeCount_ = nodes.size();
+    this->updateExtremes();
+
+    if (this->filter_) {
+        for (size_t i = 0; i < created.size(); i++) {
+            this->filter_->add(created[i]->getKey());
+        }
+        if (this->filter_->overloaded()) {
+            this->refillMembershipFilter();
+        }
+    }
+    this->nodesReplaced();
+}
+
+template<class Key, class Value>
+void AVLTree<Key, Value>::begin_batch()
+{
+    if (this->multi_) {
+        throw std::logic_error("Batches are not supported in multimap mode");
+    }
+    if (batching_) {
+        throw std::logic_error("Batch already open");
+    }
+    batching_ = true;
+}
+
+/**
+* The staged changes are sorted by key and reduced to the last one per
+* key. A large batch is then merged in a single pass over the tree, as in
+* insertBatch; a small one is applied change by change. Either way the
+* prior state of each key is kept as an undo log until the commit is
+* through, and restored if a step throws.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::commit()
+{
+    if (!batching_) {
+        return;
+    }
+    std::vector<StagedOp> ops;
+    ops.swap(staged_);
+    batching_ = false;
+
+    bool merge = mergeCheaper(ops.size());
+    std::stable_sort(ops.begin(), ops.end(), stagedLess);
+    size_t count = 0;
+    for (size_t i = 0; i < ops.size(); i++) {
+        if (i + 1 < ops.size() && !(ops[i].key < ops[i + 1].key)) {
+            continue; //A later change to the same key wins
+        }
+        if (count != i) {
+            ops[count] = std::move(ops[i]);
+        }
+        count++;
+    }
+    ops.erase(ops.begin() + count, ops.end());
+
+    if (merge) {
+        commitMerge(ops);
+    }
+    else {
+        commitEach(ops);
+    }
+}
+
+/**
+* Drops the staged changes; the tree was never touched.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::rollback()
+{
+    staged_.clear();
+    batching_ = false;
+}
+
+template<class Key, class Value>
+bool AVLTree<Key, Value>::in_batch() const
+{
+    return batching_;
+}
+
+/**
+* A merge touches all n nodes however few changes there are, while each
+* separate change costs a descent and its rotations. Measured on trees of
+* 10^5 to 10^6 nodes, the merge only pulls ahead once k reaches about n/4.
+*/
+template<class Key, class Value>
+bool AVLTree<Key, Value>::mergeCheaper(size_t count) const
+{
+    return count >= this->nodeCount_ / 4;
+}
+
+template<class Key, class Value>
+Node<Key, Value>* AVLTree<Key, Value>::findLive(const Key& key) const
+{
+    return this->internalFind(key);
+}
+
+template<class Key, class Value>
+bool AVLTree<Key, Value>::stagedLess(const StagedOp& a, const StagedOp& b)
+{
+    return a.key < b.key;
+}
+
+/**
+* Records the change if a batch is open: an insert of *value, or a removal
+* if value is NULL. Returns false if there is no batch, so the caller
+* applies the change itself.
+*/
+template<class Key, class Value>
+bool AVLTree<Key, Value>::stage(const Key& key, const Value* value)
+{
+    if (!batching_) {
+        return false;
+    }
+    StagedOp op = { key, value ? std::optional<Value>(*value) : std::nullopt };
+    staged_.push_back(std::move(op));
+    return true;
+}
+
+template<class Key, class Value>
+void AVLTree<Key, Value>::checkDirectChange() const
+{
+    if (batching_) {
+        throw std::logic_error("Only insert and remove can change a tree while a batch is open");
+    }
+}
+
+/**
+* Applies the changes through the virtual insert and remove, so derived
+* trees keep their own state. undo holds each key's prior state, with an
+* empty value marking a key that was absent.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::commitEach(const std::vector<StagedOp>& ops)
+{
+    std::vector<StagedOp> undo;
+    undo.reserve(ops.size());
+    try {
+        for (size_t i = 0; i < ops.size(); i++) {
+            Node<Key, Value>* node = findLive(ops[i].key);
+            if (!ops[i].value && node == nullptr) {
+                continue;
+            }
+            StagedOp prior = { ops[i].key, node ? std::optional<Value>(node->getValue()) : std::nullopt };
+            undo.push_back(std::move(prior));
+            if (!ops[i].value) {
+                this->remove(ops[i].key);
+            }
+            else {
+                this->insert(std::make_pair(ops[i].key, *ops[i].value));
+            }
+        }
+    }
+    catch (...) {
+        undoEach(undo);
+        throw;
+    }
+}
+
+/**
+* Walks the tree and the sorted changes together, overwriting values in
+* place, creating nodes for new keys and leaving removed nodes out of the
+* run, which is then relinked into a balanced tree. Nothing is relinked or
+* freed until every step that may throw is done, so undoing a failure only
+* means restoring the overwritten values.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::commitMerge(const std::vector<StagedOp>& ops)
+{
+    std::vector<AVLNode<Key, Value>*> nodes;
+    std::vector<AVLNode<Key, Value>*> created;
+    std::vector<AVLNode<Key, Value>*> removed;
+    std::vector<std::pair<AVLNode<Key, Value>*, Value> > overwritten;
+    Node<Key, Value>* curr = this->leftmost_;
+    try {
+        for (size_t i = 0; i < ops.size(); i++) {
+            const Key& key = ops[i].key;
+            while (curr && curr->getKey() < key) {
+                nodes.push_back(static_cast<AVLNode<Key, Value>*>(curr));
+                curr = BinarySearchTree<Key, Value>::successor(curr);
+            }
+            AVLNode<Key, Value>* node = static_cast<AVLNode<Key, Value>*>(curr);
+            if (node && !(key < node->getKey())) { //Key already in tree
+                curr = BinarySearchTree<Key, Value>::successor(curr);
+                if (!ops[i].value) {
+                    removed.push_back(node);
+                    continue;
+                }
+                overwritten.push_back(std::make_pair(node, node->getValue()));
+                node->setValue(*ops[i].value);
+                nodes.push_back(node);
+            }
+            else if (ops[i].value) {
+                created.push_back(static_cast<AVLNode<Key, Value>*>(this->createNode(key, *ops[i].value, nullptr)));
+                nodes.push_back(created.back());
+            }
+        }
+        for (; curr; curr = BinarySearchTree<Key, Value>::successor(curr)) {
+            nodes.push_back(static_cast<AVLNode<Key, Value>*>(curr));
+        }
+
+        if (this->listener_) {
+            for (size_t i = 0; i < ops.size(); i++) {
+                if (!ops[i].value) {
+                    this->listener_->onRemove(ops[i].key);
+                }
+                else {
+                    this->listener_->onInsert(ops[i].key, *ops[i].value);
+                }
+            }
+        }
+    }
+    catch (...) {
+        for (size_t i = overwritten.size(); i-- > 0; ) {
+            overwritten[i].first->setValue(overwritten[i].second);
+        }
+        for (size_t i = 0; i < created.size(); i++) {
+            delete created[i];
+        }
+        throw;
+    }
+
+    int h;
+    this->root_ = build(nodes.data(), nodes.size(), h);
+    if (this->root_) {
+        this->root_->setParent(nullptr);
+    }
+    this->nodeCount_ = nodes.size();
+    this->updateExtremes();
+    this->invalidateLookupCache();
+
+    if (this->filter_) {
+        for (size_t i = 0; i < removed.size(); i++) {
+            this->filter_->erase(removed[i]->getKey());
+        }
+        for (size_t i = 0; i < created.size(); i++) {
+            this->filter_->add(created[i]->getKey());
+        }
+        if (this->filter_->overloaded()) {
+            this->refillMembershipFilter();
+        }
+    }
+    for (size_t i = 0; i < removed.size(); i++) {
+        delete removed[i];
+    }
+    this->nodesReplaced();
+}
+
+/**
+* Restores the prior states recorded by commitEach, newest first.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::undoEach(const std::vector<StagedOp>& undo)
+{
+    for (size_t i = undo.size(); i-- > 0; ) {
+        if (!undo[i].value) {
+            this->remove(undo[i].key);
+        }
+        else {
+            this->insert(std::make_pair(undo[i].key, *undo[i].value));
+        }
+    }
+}
+
+/**
+* DSW rebalance as in BinarySearchTree, followed by one post-order pass
+* that recomputes every balance factor and aggregate for the new shape.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::rebalance()
+{
+    BinarySearchTree<Key, Value>::rebalance();
+    rebalance_Helper(static_cast<AVLNode<Key, Value>*>(this->root_));
+}
+
+template<class Key, class Value>
+int AVLTree<Key, Value>::rebalance_Helper(AVLNode<Key, Value>* node)
+{
+    if (node == nullptr) {
+        return 0;
+    }
+
+    int hl = rebalance_Helper(node->getLeft());
+    int hr = rebalance_Helper(node->getRight());
+    node->setBalance(hr - hl);
+    this->updateAugment(node);
+    return 1 + std::max(hl, hr);
+}
+
+/**
+* Removes the in-order run [first, last) structurally: the tree is split
+* just before first and just before last, the middle piece is freed, and
+* the outer pieces are joined again. This costs O(k + log n) instead of k
+* separate removals.
+*
+* Splitting is by key, so in multimap mode a boundary falling between two
+* equal keys cannot be expressed as a split; such ranges are removed one
+* node at a time instead.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::eraseNodes(Node<Key, Value>* first, Node<Key, Value>* last)
+{
+    if (this->multi_) {
+        Node<Key, Value>* before = BinarySearchTree<Key, Value>::predecessor(first);
+        bool splitsFirst = before && !(before->getKey() < first->getKey());
+        bool splitsLast = false;
+        if (last) {
+            before = BinarySearchTree<Key, Value>::predecessor(last);
+            splitsLast = !(before->getKey() < last->getKey());
+        }
+        if (splitsFirst || splitsLast) {
+            BinarySearchTree<Key, Value>::eraseNodes(first, last);
+            return;
+        }
+    }
+
+    AVLNode<Key, Value>* root = static_cast<AVLNode<Key, Value>*>(this->root_);
+    AVLNode<Key, Value>* left;
+    AVLNode<Key, Value>* middle;
+    AVLNode<Key, Value>* right = nullptr;
+    int hl, hm, hr = 0;
+
+    const Key lo = first->getKey();
+    split(root, subtreeHeight(root), lo, left, hl, middle, hm);
+
+    if (last) {
+        const Key hi = last->getKey();
+        AVLNode<Key, Value>* rest = middle;
+        split(rest, hm, hi, middle, hm, right, hr);
+    }
+
+    this->invalidateLookupCache();
+    this->unfilterSubtree(middle);
+    this->nodeCount_ -= this->clear_Helper(middle);
+
+    int h;
+    this->root_ = join2(left, hl, right, hr, h);
+    if (this->root_) {
+        this->root_->setParent(nullptr);
+    }
+    this->updateExtremes();
+}
+
+template<class Key, class Value>
+void AVLTree<Key, Value>::updateAugment(AVLNode<Key, Value>* node)
+{
+
+}
+
+template<class Key, class Value>
+void AVLTree<Key, Value>::updateAugmentPath(AVLNode<Key, Value>* node)
+{
+
+}
+
+/**
+* Links count nodes, given in key order, into a perfectly balanced subtree
+* and returns its root. The root's parent is left for the caller to set.
+*/
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::build(AVLNode<Key, Value>** nodes, size_t count, int& h)
+{
+    if (count == 0) {
+        h = 0;
+        return nullptr;
+    }
+
+    size_t mid = count / 2;
+    int hl, hr;
+    AVLNode<Key, Value>* left = build(nodes, mid, hl);
+    AVLNode<Key, Value>* right = build(nodes + mid + 1, count - mid - 1, hr);
+    h = link(nodes[mid], left, hl, right, hr);
+    return nodes[mid];
+}
+
+template<class Key, class Value>
+template<typename KeySerializer, typename ValueSerializer>
+void AVLTree<Key, Value>::save(std::ostream& out) const
+{
+    save_Helper<KeySerializer, ValueSerializer>(out, [](const Node<Key, Value>*) { return false; });
+}
+
+/**
+* Writes every node for which skip returns false, in key order.
+*/
+template<class Key, class Value>
+template<typename KeySerializer, typename ValueSerializer, typename Skip>
+void AVLTree<Key, Value>::save_Helper(std::ostream& out, Skip skip) const
+{
+    uint64_t count = 0;
+    for (Node<Key, Value>* node = this->leftmost_; node; node = BinarySearchTree<Key, Value>::successor(node)) {
+        if (!skip(node)) {
+            count++;
+        }
+    }
+
+    SnapshotWriter writer(out, KeySerializer::signature() + "/" + ValueSerializer::signature(), count);
+    for (Node<Key, Value>* node = this->leftmost_; node; node = BinarySearchTree<Key, Value>::successor(node)) {
+        if (!skip(node)) {
+            KeySerializer::write(writer.buffer(), node->getKey());
+            ValueSerializer::write(writer.buffer(), node->getValue());
+            writer.endEntry();
+        }
+    }
+    writer.finish();
+}
+
+/**
+* The snapshot is read into a separate tree first, so the current contents
+* survive a corrupt or mismatched snapshot.
+*/
+template<class Key, class Value>
+template<typename KeySerializer, typename ValueSerializer>
+void AVLTree<Key, Value>::load(std::istream& in)
+{
+    checkDirectChange();
+    SnapshotReader reader(in, KeySerializer::signature() + "/" + ValueSerializer::signature());
+    int h;
+    Node<Key, Value>* last = nullptr;
+    AVLNode<Key, Value>* root = load_Helper<KeySerializer, ValueSerializer>(reader, reader.count(), h, last);
+    try {
+        reader.finish();
+    }
+    catch (...) {
+        this->clear_Helper(root);
+        throw;
+    }
+
+    this->releaseNodes();
+    this->root_ = root;
+    if (root) {
+        root->setParent(nullptr);
+    }
+    this->nodeCount_ = reader.count();
+    this->updateExtremes();
+    this->fillMembershipFilter();
+    this->nodesReplaced();
+}
+
+/**
+* Builds a perfectly balanced subtree from the next count entries of the
+* snapshot: the left half first, then the middle entry, then the right
+* half, so entries are consumed in order straight off the stream. last
+* tracks the previous node to check that keys arrive sorted.
+*/
+template<class Key, class Value>
+template<typename KeySerializer, typename ValueSerializer>
+AVLNode<Key, Value>* AVLTree<Key, Value>::load_Helper(SnapshotReader& in, size_t count, int& h,
+                                                      Node<Key, Value>*& last)
+{
+    if (count == 0) {
+        h = 0;
+        return nullptr;
+    }
+
+    size_t mid = count / 2;
+    int hl, hr;
+    AVLNode<Key, Value>* left = load_Helper<KeySerializer, ValueSerializer>(in, mid, hl, last);
+    AVLNode<Key, Value>* node = nullptr;
+    try {
+        Key key;
+        Value value;
+        in.read<KeySerializer>(key);
+        in.read<ValueSerializer>(value);
+        if (last && (this->multi_ ? key < last->getKey() : !(last->getKey() < key))) {
+            throw std::runtime_error("Corrupt snapshot: keys out of order");
+        }
+        node = static_cast<AVLNode<Key, Value>*>(this->createNode(key, value, nullptr));
+        last = node;
+
+        AVLNode<Key, Value>* right = load_Helper<KeySerializer, ValueSerializer>(in, count - mid - 1, hr, last);
+        h = link(node, left, hl, right, hr);
+        return node;
+    }
+    catch (...) {
+        this->clear_Helper(left);
+        delete node;
+        throw;
+    }
+}
+
+/**
+* Makes left and right the children of node and sets its balance.
+* Returns the height of the resulting subtree.
+*/
+template<class Key, class Value>
+int AVLTree<Key, Value>::link(AVLNode<Key, Value>* node, AVLNode<Key, Value>* left, int hl,
+                              AVLNode<Key, Value>* right, int hr)
+{
+    node->setLeft(left);
+    node->setRight(right);
+    if (left) left->setParent(node);
+    if (right) right->setParent(node);
+    node->setBalance(hr - hl);
+    this->updateAugment(node);
+
+    return 1 + std::max(hl, hr);
+}
+
+/**
+* Height of node's left subtree, given that node's own height is h.
+*/
+template<class Key, class Value>
+int AVLTree<Key, Value>::leftHeight(AVLNode<Key, Value>* node, int h)
+{
+    return node->getBalance() > 0 ? h - 2 : h - 1;
+}
+
+template<class Key, class Value>
+int AVLTree<Key, Value>::rightHeight(AVLNode<Key, Value>* node, int h)
+{
+    return node->getBalance() < 0 ? h - 2 : h - 1;
+}
+
+/**
+* Computes a subtree's height in O(log n) by following the taller side.
+*/
+template<class Key, class Value>
+int AVLTree<Key, Value>::subtreeHeight(AVLNode<Key, Value>* node)
+{
+    int h = 0;
+    while (node) {
+        h++;
+        node = node->getBalance() > 0 ? node->getRight() : node->getLeft();
+    }
+    return h;
+}
+
+/**
+* Joins two detached AVL trees around pivot, where every key in left is
+* smaller than pivot's and every key in right is larger. Runs in
+* O(|hl - hr|). The returned root's parent is left for the caller to set.
+*/
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::join(AVLNode<Key, Value>* left, int hl, AVLNode<Key, Value>* pivot,
+                                               AVLNode<Key, Value>* right, int hr, int& h)
+{
+    if (hl > hr + 1) {
+        return joinRight(left, hl, pivot, right, hr, h);
+    }
+    if (hr > hl + 1) {
+        return joinLeft(left, hl, pivot, right, hr, h);
+    }
+
+    h = link(pivot, left, hl, right, hr);
+    return pivot;
+}
+
+/**
+* left is the taller tree: walk down its right spine to a subtree about as
+* tall as right, hang pivot there, and rotate on the way back up.
+*/
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::joinRight(AVLNode<Key, Value>* left, int hl, AVLNode<Key, Value>* pivot,
+                                                    AVLNode<Key, Value>* right, int hr, int& h)
+{
+    AVLNode<Key, Value>* l = left->getLeft();
+    AVLNode<Key, Value>* c = left->getRight();
+    int hll = leftHeight(left, hl);
+    int hc = rightHeight(left, hl);
+
+    if (hc <= hr + 1) {
+        int hp = link(pivot, c, hc, right, hr);
+        if (hp <= hll + 1) {
+            h = link(left, l, hll, pivot, hp);
+            return left;
+        }
+
+        // Double rotation: c rises above both left and pivot
+        AVLNode<Key, Value>* c1 = c->getLeft();
+        AVLNode<Key, Value>* c2 = c->getRight();
+        int hc1 = leftHeight(c, hc);
+        int hc2 = rightHeight(c, hc);
+        int ha = link(left, l, hll, c1, hc1);
+        int hb = link(pivot, c2, hc2, right, hr);
+        h = link(c, left, ha, pivot, hb);
+        return c;
+    }
+
+    int ht;
+    AVLNode<Key, Value>* t = joinRight(c, hc, pivot, right, hr, ht);
+    if (ht <= hll + 1) {
+        h = link(left, l, hll, t, ht);
+        return left;
+    }
+
+    // Single left rotation at left
+    AVLNode<Key, Value>* a = t->getLeft();
+    AVLNode<Key, Value>* b = t->getRight();
+    int ha = leftHeight(t, ht);
+    int hb = rightHeight(t, ht);
+    int hn = link(left, l, hll, a, ha);
+    h = link(t, left, hn, b, hb);
+    return t;
+}
+
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::joinLeft(AVLNode<Key, Value>* left, int hl, AVLNode<Key, Value>* pivot,
+                                                   AVLNode<Key, Value>* right, int hr, int& h)
+{
+    AVLNode<Key, Value>* c = right->getLeft();
+    AVLNode<Key, Value>* r = right->getRight();
+    int hc = leftHeight(right, hr);
+    int hrr = rightHeight(right, hr);
+
+    if (hc <= hl + 1) {
+        int hp = link(pivot, left, hl, c, hc);
+        if (hp <= hrr + 1) {
+            h = link(right, pivot, hp, r, hrr);
+            return right;
+        }
+
+        AVLNode<Key, Value>* c1 = c->getLeft();
+        AVLNode<Key, Value>* c2 = c->getRight();
+        int hc1 = leftHeight(c, hc);
+        int hc2 = rightHeight(c, hc);
+        int ha = link(pivot, left, hl, c1, hc1);
+        int hb = link(right, c2, hc2, r, hrr);
+        h = link(c, pivot, ha, right, hb);
+        return c;
+    }
+
+    int ht;
+    AVLNode<Key, Value>* t = joinLeft(left, hl, pivot, c, hc, ht);
+    if (ht <= hrr + 1) {
+        h = link(right, t, ht, r, hrr);
+        return right;
+    }
+
+    AVLNode<Key, Value>* a = t->getLeft();
+    AVLNode<Key, Value>* b = t->getRight();
+    int ha = leftHeight(t, ht);
+    int hb = rightHeight(t, ht);
+    int hn = link(right, b, hb, r, hrr);
+    h = link(t, a, ha, right, hn);
+    return t;
+}
+
+/**
+* Joins two detached trees without a pivot by borrowing left's largest node.
+*/
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::join2(AVLNode<Key, Value>* left, int hl,
+                                                AVLNode<Key, Value>* right, int hr, int& h)
+{
+    if (left == nullptr) {
+        h = hr;
+        return right;
+    }
+
+    AVLNode<Key, Value>* last;
+    int hrest;
+    AVLNode<Key, Value>* rest = splitLast(left, hl, last, hrest);
+    return join(rest, hrest, last, right, hr, h);
+}
+
+/**
+* Detaches the largest node of a subtree into last and returns the rest.
+*/
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::splitLast(AVLNode<Key, Value>* node, int h,
+                                                    AVLNode<Key, Value>*& last, int& hOut)
+{
+    AVLNode<Key, Value>* l = node->getLeft();
+    AVLNode<Key, Value>* r = node->getRight();
+    int hl = leftHeight(node, h);
+
+    if (r == nullptr) {
+        last = node;
+        if (l) l->setParent(nullptr);
+        hOut = hl;
+        return l;
+    }
+
+    int hrest;
+    AVLNode<Key, Value>* rest = splitLast(r, rightHeight(node, h), last, hrest);
+    return join(l, hl, node, rest, hrest, hOut);
+}
+
+/**
+* Splits a detached subtree into the keys less than key (left) and the keys
+* greater than or equal to key (right), reusing every node. O(log n).
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::split(AVLNode<Key, Value>* node, int h, const Key& key,
+                                AVLNode<Key, Value>*& left, int& hl, AVLNode<Key, Value>*& right, int& hr)
+{
+    if (node == nullptr) {
+        left = right = nullptr;
+        hl = hr = 0;
+        return;
+    }
+
+    AVLNode<Key, Value>* l = node->getLeft();
+    AVLNode<Key, Value>* r = node->getRight();
+    int hnl = leftHeight(node, h);
+    int hnr = rightHeight(node, h);
+    if (l) l->setParent(nullptr);
+    if (r) r->setParent(nullptr);
+
+    if (node->getKey() < key) {
+        AVLNode<Key, Value>* rl;
+        int hrl;
+        split(r, hnr, key, rl, hrl, right, hr);
+        left = join(l, hnl, node, rl, hrl, hl);
+        left->setParent(nullptr);
+    }
+    else {
+        AVLNode<Key, Value>* lr;
+        int hlr;
+        split(l, hnl, key, left, hl, lr, hlr);
+        right = join(lr, hlr, node, r, hnr, hr);
+        right->setParent(nullptr);
+    }
+}
+
+/**
+* An AVLTree in multimap mode: equal keys are kept as separate nodes in
+* insertion order (see BinarySearchMultimap).
+*/
+template <typename Key, typename Value>
+class AVLMultimap : public AVLTree<Key, Value>
+{
+public:
+    AVLMultimap();
+};
+
+template<class Key, class Value>
+AVLMultimap<Key, Value>::AVLMultimap() : AVLTree<Key, Value>(true)
+{
+
+}
+
 #endif
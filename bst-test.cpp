@@ -1,7 +1,23 @@
 #include <iostream>
 #include <map>
+#include <sstream>
+#include <cstdio>
+#include <iterator>
+#include <type_traits>
 #include "bst.h"
 #include "avlbst.h"
+#include "persistent_avl.h"
+#include "augmented_avl.h"
+#include "interval_tree.h"
+#include "buffered_avl.h"
+#include "lazy_avl.h"
+#include "scapegoat_bst.h"
+#include "hashed_avl.h"
+#include "prefix_string.h"
+#include "frozen_string_map.h"
+#include "mapped_avl.h"
+#include "wal.h"
+#include "tree_diff.h"
 
 using namespace std;
 
@@ -27,6 +43,15 @@ int main(int argc, char *argv[])
     cout << "Erasing b" << endl;
     bt.remove('b');
 
+    // Rebalancing a tree built from a sorted feed
+    BinarySearchTree<int,int> skewed;
+    for (int i = 0; i < 100; i++) {
+        skewed.insert(std::make_pair(i, i));
+    }
+    cout << "Skewed tree is " << (skewed.isBalanced() ? "balanced" : "not balanced");
+    skewed.rebalance();
+    cout << ", after rebalance() it is " << (skewed.isBalanced() ? "balanced" : "not balanced") << endl;
+
     // AVL Tree Tests
     AVLTree<char,int> at;
     at.insert(std::make_pair('a',1));
@@ -42,8 +67,370 @@ int main(int argc, char *argv[])
     else {
         cout << "Did not find b" << endl;
     }
+    AVLTree<char,int> atCopy(at);
     cout << "Erasing b" << endl;
     at.remove('b');
 
+    cout << "\nAVLTree copy contents:" << endl;
+    for(AVLTree<char,int>::iterator it = atCopy.begin(); it != atCopy.end(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+    AVLTree<char,int> atMoved(std::move(atCopy));
+    cout << "After move, copy is " << (atCopy.empty() ? "empty" : "not empty") << endl;
+
+    // Move a node between trees without reallocating it
+    AVLTree<char,int> archive;
+    AVLTree<char,int>::node_type handle = atMoved.extract('b');
+    cout << "Extracted " << handle.key() << " " << handle.mapped() << endl;
+    AVLTree<char,int>::insert_return_type res = archive.insert(std::move(handle));
+    cout << (res.inserted ? "Archived " : "Did not archive ") << res.position->first << endl;
+    cout << (atMoved.find('b') == atMoved.end() ? "b left the original tree" : "b is still in the original tree") << endl;
+
+    // Range erase
+    AVLTree<int,int> events;
+    for (int i = 0; i < 10; i++) {
+        events.insert(std::make_pair(i, i * i));
+    }
+    events.erase_range(2, 8);
+    for (AVLTree<int,int>::iterator it = events.begin(); it != events.end(); ) {
+        if (it->first == 1) it = events.erase(it);
+        else ++it;
+    }
+    cout << "\nAVLTree after erasing [2, 8) and 1:" << endl;
+    for(AVLTree<int,int>::iterator it = events.begin(); it != events.end(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+    int total = 0;
+    events.for_each_range(8, 10, [&total](const int& key, const int& value) { total += value; });
+    cout << "Sum over [8, 10): " << total << endl;
+    std::atomic<int> parallelTotal(0);
+    events.parallel_for_each([&parallelTotal](const int& key, const int& value) { parallelTotal += value; }, 2);
+    cout << "Sum over all, visited in parallel: " << parallelTotal << endl;
+
+    // Latest entries, read backwards from the end
+    cout << "Latest 2 events:" << endl;
+    int shown = 0;
+    for (AVLTree<int,int>::reverse_iterator it = events.rbegin(); it != events.rend() && shown < 2; ++it, ++shown) {
+        cout << it->first << " " << it->second << endl;
+    }
+
+    // Range aggregates
+    static_assert(!std::is_convertible<AugmentedAVLTree<int,int,SumMonoid<int> >*, AVLTree<int,int>*>::value,
+                  "Augmented trees must not expose the writable AVLTree interface");
+    AugmentedAVLTree<int,int,SumMonoid<int> > sums;
+    for (int i = 1; i <= 10; i++) {
+        sums.insert(std::make_pair(i, i));
+    }
+    sums.remove(5);
+    cout << "\nSum of values with keys in [3, 8): " << sums.aggregate(3, 8) << endl;
+    cout << "Sum of all values: " << sums.aggregate() << endl;
+    AugmentedAVLTree<int,int,SumMonoid<int> >::node_type raised = sums.extract(sums.find(10));
+    raised.mapped() = 100;
+    sums.insert(std::move(raised));
+    cout << "Sum after raising 10 to 100 through a node handle: " << sums.aggregate() << endl;
+
+    // Interval queries
+    IntervalTree<int,char> intervals;
+    intervals.insert(1, 5, 'x');
+    intervals.insert(3, 9, 'y');
+    intervals.insert(10, 12, 'z');
+    cout << "\nIntervals containing 4:" << endl;
+    intervals.stab(4, [](const int& lo, const int& hi, const char& v) {
+        cout << "[" << lo << ", " << hi << "] " << v << endl;
+    });
+    cout << "Intervals overlapping [8, 10]:" << endl;
+    intervals.overlap(8, 10, [](const int& lo, const int& hi, const char& v) {
+        cout << "[" << lo << ", " << hi << "] " << v << endl;
+    });
+
+    // Multimap mode
+    AVLMultimap<char,int> multi;
+    multi.insert(std::make_pair('a', 1));
+    multi.insert(std::make_pair('b', 2));
+    multi.insert(std::make_pair('a', 3));
+    multi.insert(std::make_pair('c', 4));
+    multi.insert(std::make_pair('a', 5));
+    cout << "\nAVLMultimap has " << multi.count('a') << " entries for a:" << endl;
+    std::pair<AVLMultimap<char,int>::iterator, AVLMultimap<char,int>::iterator> as = multi.equal_range('a');
+    for (AVLMultimap<char,int>::iterator it = as.first; it != as.second; ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+    multi.remove('a');
+    cout << "After removing a, " << multi.count('a') << " entries for a remain" << endl;
+
+    // Buffered writes
+    BufferedAVLTree<int,char> buffered(4, 2);
+    for (int i = 0; i < 6; i++) {
+        buffered.insert(std::make_pair(i, char('a' + i)));
+    }
+    buffered.remove(2);
+    cout << "\nBufferedAVLTree has " << buffered.pending() << " unmerged writes, "
+         << (buffered.contains(2) ? "contains 2" : "does not contain 2") << endl;
+    buffered.for_each([](const int& key, const char& value) { cout << key << " " << value << endl; });
+
+    // Lazy deletion
+    LazyAVLTree<int,char> lazy(0.5);
+    for (int i = 0; i < 6; i++) {
+        lazy.insert(std::make_pair(i, char('a' + i)));
+    }
+    lazy.remove(1);
+    lazy.remove(4);
+    cout << "\nLazyAVLTree holds " << lazy.size() << " entries and " << lazy.tombstones() << " tombstones:" << endl;
+    for (LazyAVLTree<int,char>::iterator it = lazy.begin(); it != lazy.end(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+    lazy.compact();
+    cout << "After compaction, " << lazy.tombstones() << " tombstones remain" << endl;
+    lazy.remove(2);
+    BinarySearchTree<int,char>& lazyBase = lazy;
+    lazyBase.clear();
+    cout << "Cleared through a base reference: " << lazy.size() << " entries, " << lazy.tombstones()
+         << " tombstones, " << (lazy.empty() ? "empty" : "not empty") << endl;
+
+    // Scapegoat rebuilding on sorted input
+    ScapegoatTree<int,int> scapegoat;
+    for (int i = 0; i < 1000; i++) {
+        scapegoat.insert(std::make_pair(i, i));
+    }
+    scapegoat.remove(500);
+    cout << "\nScapegoatTree holds " << scapegoat.size() << " keys, "
+         << (scapegoat.find(500) == scapegoat.end() ? "500 removed" : "500 still present") << endl;
+    BinarySearchTree<int,int>& scapegoatBase = scapegoat;
+    scapegoatBase.clear();
+    for (int i = 0; i < 10; i++) {
+        scapegoat.insert(std::make_pair(i, i));
+    }
+    cout << "After a clear through a base reference and 10 inserts it holds " << scapegoat.size() << " keys" << endl;
+
+    // Hot-key lookup cache
+    AVLTree<int,int> cached;
+    cached.enableLookupCache(64);
+    for (int i = 0; i < 100; i++) {
+        cached.insert(std::make_pair(i, i * i));
+    }
+    for (int i = 0; i < 10; i++) {
+        cached.find(7);
+    }
+    cached.remove(7);
+    cout << "\nLookup cache: " << cached.lookupCacheHits() << " hits, " << cached.lookupCacheMisses()
+         << " misses, " << (cached.find(7) == cached.end() ? "7 removed" : "7 still present") << endl;
+
+    // Membership filter for absent keys
+    AVLTree<int,int> filtered;
+    filtered.enableMembershipFilter(1000, 0.01);
+    for (int i = 0; i < 1000; i++) {
+        filtered.insert(std::make_pair(2 * i, i));
+    }
+    filtered.remove(10);
+    cout << "\nMembership filter uses " << filtered.membershipFilterMemory() << " bytes, "
+         << (filtered.find(10) == filtered.end() ? "10 removed" : "10 still present") << ", "
+         << (filtered.find(11) == filtered.end() ? "11 absent" : "11 present") << endl;
+
+    // A small filter grown while the minimum keeps changing, then assigned over
+    AVLTree<int,int> growing;
+    growing.enableMembershipFilter(4, 0.01);
+    for (int i = 999; i >= 0; i--) {
+        growing.insert(std::make_pair(i, i));
+    }
+    AVLTree<int,int> assigned;
+    assigned.enableMembershipFilter(4, 0.01);
+    assigned = filtered;
+    int grownFound = 0, assignedFound = 0;
+    for (int i = 0; i < 1000; i++) {
+        grownFound += growing.find(i) != growing.end();
+        assignedFound += assigned.find(2 * i) != assigned.end();
+    }
+    cout << "Grown filter finds " << grownFound << " of 1000 keys, assigned filter finds "
+         << assignedFound << " of 999" << endl;
+
+    // Hash index over the tree's nodes
+    HashedAVLTree<int,char> hashed;
+    for (int i = 0; i < 26; i++) {
+        hashed.insert(std::make_pair(i, char('a' + i)));
+    }
+    hashed.remove(3);
+    cout << "\nHashedAVLTree holds " << hashed.size() << " keys, 7 maps to " << hashed[7]
+         << ", keys from 20:";
+    for (HashedAVLTree<int,char>::iterator it = hashed.lower_bound(20); it != hashed.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+    AVLTree<int,char>& hashedBase = hashed;
+    std::vector<std::pair<int,char> > letters;
+    for (int i = 26; i < 52; i++) {
+        letters.push_back(std::make_pair(i, char('A' + i - 26)));
+    }
+    hashedBase.insertBatch(letters.begin(), letters.end());
+    cout << "Through an AVLTree reference: batch leaves " << hashed.size() << " keys indexed, 40 maps to "
+         << hashed.find(40)->second;
+    hashedBase.clear();
+    cout << ", clear leaves " << hashed.size() << " and " << hashed.count(7) << " for 7" << endl;
+
+    // String keys compared by their inline prefix
+    AVLTree<PrefixString,int> words;
+    const char* names[] = { "configuration", "config", "concurrency", "apple", "configure" };
+    for (int i = 0; i < 5; i++) {
+        words.insert(std::make_pair(PrefixString(names[i]), i));
+    }
+    cout << "\nPrefixString keys in order:";
+    for (AVLTree<PrefixString,int>::iterator it = words.begin(); it != words.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+    FrozenStringMap<int> frozen(words.begin(), words.end(), 4);
+    int frozenValue = -1;
+    frozen.find("configure", frozenValue);
+    cout << "FrozenStringMap holds " << frozen.size() << " keys, configure maps to " << frozenValue
+         << (frozen.contains("conf") ? ", conf present" : ", conf absent") << endl;
+
+    // Binary snapshot round trip
+    AVLTree<int,std::string> saved;
+    for (int i = 0; i < 10; i++) {
+        saved.insert(std::make_pair(i, std::string(i, '*')));
+    }
+    std::stringstream snapshot;
+    saved.save(snapshot);
+    AVLTree<int,std::string> loaded;
+    loaded.load(snapshot);
+    cout << "\nLoaded snapshot of " << snapshot.str().size() << " bytes, 4 maps to " << loaded[4]
+         << (loaded.isBalanced() ? ", balanced" : ", not balanced") << endl;
+
+    // Tree in a memory-mapped file, reopened after a checkpoint
+    const char* mappedPath = "bst-test-mapped.tmp";
+    std::remove(mappedPath);
+    {
+        MappedAVLTree<int,double> mapped(mappedPath);
+        for (int i = 0; i < 100; i++) {
+            mapped.insert(std::make_pair(i, i / 4.0));
+        }
+        mapped.remove(50);
+        mapped.checkpoint();
+    }
+    MappedAVLTree<int,double> reopened(mappedPath);
+    cout << "\nMappedAVLTree reopened with " << reopened.size() << " keys, 42 maps to " << *reopened.find(42)
+         << (reopened.find(50) ? ", 50 present" : ", 50 removed") << endl;
+    reopened.close();
+    std::remove(mappedPath);
+
+    // Write-ahead log replayed into a fresh tree
+    const char* walPath = "bst-test-wal.tmp";
+    std::remove(walPath);
+    {
+        WriteAheadLog<int,std::string> wal(walPath);
+        AVLTree<int,std::string> logged;
+        logged.setMutationListener(&wal);
+        for (int i = 0; i < 10; i++) {
+            logged.insert(std::make_pair(i, std::string(1, char('a' + i))));
+        }
+        logged.remove(3);
+        logged.setMutationListener(nullptr);
+    }
+    WriteAheadLog<int,std::string> walReplay(walPath);
+    AVLTree<int,std::string> recovered;
+    size_t replayed = walReplay.replay(recovered);
+    cout << "\nReplayed " << replayed << " log records, 7 maps to " << recovered[7]
+         << (recovered.find(3) == recovered.end() ? ", 3 removed" : ", 3 present") << endl;
+    std::remove(walPath);
+    {
+        WriteAheadLog<int,std::string> wal(walPath);
+        AVLMultimap<int,std::string> logged;
+        logged.setMutationListener(&wal);
+        logged.insert(std::make_pair(1, std::string("x")));
+        logged.insert(std::make_pair(1, std::string("y")));
+        logged.insert(std::make_pair(1, std::string("z")));
+        logged.setMutationListener(nullptr);
+    }
+    FILE* torn = std::fopen(walPath, "ab");
+    const unsigned char garbage[12] = { 0xf0, 0xff, 0xff, 0xff };
+    std::fwrite(garbage, 1, sizeof(garbage), torn);
+    std::fclose(torn);
+    WriteAheadLog<int,std::string> multiReplay(walPath);
+    AVLMultimap<int,std::string> multiRecovered;
+    multiReplay.replay(multiRecovered);
+    cout << "Multimap replay past a torn length keeps " << multiRecovered.count(1) << " entries for 1" << endl;
+    std::remove(walPath);
+
+    // Staged batch committed in one pass, then a rolled back one
+    AVLTree<int,int> accounts;
+    for (int i = 0; i < 8; i++) {
+        accounts.insert(std::make_pair(i, 100));
+    }
+    accounts.begin_batch();
+    accounts.insert(std::make_pair(1, 50));
+    accounts.insert(std::make_pair(2, 150));
+    accounts.remove(7);
+    cout << "\nDuring the batch 1 maps to " << accounts[1];
+    accounts.commit();
+    cout << ", after commit " << accounts[1] << (accounts.find(7) == accounts.end() ? ", 7 removed" : ", 7 present");
+    accounts.begin_batch();
+    accounts.insert(std::make_pair(1, 0));
+    accounts.remove(2);
+    accounts.rollback();
+    cout << ", after rollback 1 maps to " << accounts[1] << " and 2 to " << accounts[2] << endl;
+    accounts.begin_batch();
+    std::vector<std::pair<int,int> > deposits;
+    for (int i = 0; i < 8; i++) {
+        deposits.push_back(std::make_pair(i, 500));
+    }
+    accounts.insertBatch(deposits.begin(), deposits.end());
+    cout << "Batch insert staged: 0 maps to " << accounts[0];
+    try {
+        accounts.erase(accounts.begin());
+        cout << ", erase during the batch was allowed";
+    }
+    catch (std::logic_error&) {
+        cout << ", erase during the batch refused";
+    }
+    accounts.commit();
+    cout << ", after commit " << accounts[0] << " with " << std::distance(accounts.begin(), accounts.end()) << " keys" << endl;
+
+    // Diff between two digest trees, applied to a replica
+    DigestAVLTree<int,int> primary;
+    DigestAVLTree<int,int> changed;
+    AVLTree<int,int> replica;
+    for (int i = 0; i < 100; i++) {
+        primary.insert(std::make_pair(i, i));
+        changed.insert(std::make_pair(i, i));
+        replica.insert(std::make_pair(i, i));
+    }
+    changed.insert(std::make_pair(5, 50));
+    changed.insert(std::make_pair(200, 2));
+    changed.remove(70);
+    std::vector<TreeDelta<int,int> > deltas;
+    diff(primary, changed, [&](DeltaKind kind, const int& key, const int& value) {
+        TreeDelta<int,int> delta = { kind, key, value };
+        deltas.push_back(delta);
+    });
+    applyDiff(replica, deltas.begin(), deltas.end());
+    cout << "\nDiff holds " << deltas.size() << " deltas; replica maps 5 to " << replica[5]
+         << (replica.find(70) == replica.end() ? ", 70 removed" : ", 70 present") << endl;
+
+    // Iterators cannot write values; a value edited through a node handle shows up in the digest diff
+    static_assert(std::is_const<std::remove_reference<decltype((changed.begin()->second))>::type>::value,
+                  "Digest tree iterators must not write values in place");
+    DigestAVLTree<int,int>::node_type edited = changed.extract(changed.find(42));
+    edited.mapped() = 4200;
+    changed.insert(std::move(edited));
+    size_t updates = 0;
+    diff(primary, changed, [&](DeltaKind kind, const int& key, const int&) {
+        if (kind == DeltaKind::Update && key == 42) {
+            updates++;
+        }
+    });
+    cout << "After editing 42 through a node handle, digest diff reports " << updates << " update for it" << endl;
+
+    // Persistent AVL Tree tests
+    PersistentAVLTree<char,int> pt;
+    pt.insert(std::make_pair('a',1));
+    pt.insert(std::make_pair('b',2));
+    PersistentAVLTree<char,int>::Snapshot snap = pt.snapshot();
+    pt.remove('b');
+    pt.insert(std::make_pair('a',3));
+
+    cout << "\nPersistentAVLTree snapshot contents:" << endl;
+    snap.for_each([](const char& key, const int& value) { cout << key << " " << value << endl; });
+    cout << "PersistentAVLTree current contents:" << endl;
+    pt.for_each([](const char& key, const int& value) { cout << key << " " << value << endl; });
+
     return 0;
 }
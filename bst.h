@@ -5,7 +5,14 @@
 #include <exception>
 #include <cstdlib>
 #include <utility>
+#include <iterator>
+#include <functional>
 #include <cmath>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
 
 /**
  * A templated class for a Node in a search tree.
@@ -187,6 +194,361 @@ void Node<Key, Value>::setValue(const Value& value)
   ---------------------------------------
 */
 
+/**
+* Interface of the optional hot-key cache consulted by
+* BinarySearchTree::internalFind. The tree only needs to hash keys once a
+* cache is enabled, so the hashing lives behind this interface.
+*/
+template <typename Key, typename Value>
+class LookupCacheBase
+{
+public:
+    LookupCacheBase() : hits_(0), misses_(0) { }
+    virtual ~LookupCacheBase() { }
+
+    virtual Node<Key, Value>* lookup(const Key& key) = 0;
+    virtual void store(Node<Key, Value>* node) = 0;
+    virtual void invalidate(const Node<Key, Value>* node) = 0;
+    virtual void clear() = 0;
+
+    size_t hits() const { return hits_; }
+    size_t misses() const { return misses_; }
+
+protected:
+    size_t hits_;
+    size_t misses_;
+};
+
+/**
+* A direct-mapped key to node cache. Each slot holds a node and the full
+* hash of its key; a lookup is one hash, one slot load, a hash compare and
+* a key compare against the cached node.
+*/
+template <typename Key, typename Value, typename Hash>
+class LookupCache : public LookupCacheBase<Key, Value>
+{
+public:
+    explicit LookupCache(size_t slots);
+
+    virtual Node<Key, Value>* lookup(const Key& key) override;
+    virtual void store(Node<Key, Value>* node) override;
+    virtual void invalidate(const Node<Key, Value>* node) override;
+    virtual void clear() override;
+
+private:
+    struct Slot
+    {
+        Node<Key, Value>* node;
+        size_t hash;
+    };
+
+    std::vector<Slot> slots_;
+    size_t mask_;
+    Hash hasher_;
+};
+
+/**
+* Rounds slots up to a power of two so a slot is picked with a mask.
+*/
+template<typename Key, typename Value, typename Hash>
+LookupCache<Key, Value, Hash>::LookupCache(size_t slots)
+{
+    size_t size = 1;
+    while (size < slots) {
+        size *= 2;
+    }
+    Slot empty = { nullptr, 0 };
+    slots_.assign(size, empty);
+    mask_ = size - 1;
+}
+
+template<typename Key, typename Value, typename Hash>
+Node<Key, Value>* LookupCache<Key, Value, Hash>::lookup(const Key& key)
+{
+    size_t hash = hasher_(key);
+    const Slot& slot = slots_[hash & mask_];
+
+    if (slot.node && slot.hash == hash
+        && !(slot.node->getKey() < key) && !(key < slot.node->getKey())) {
+        this->hits_++;
+        return slot.node;
+    }
+    this->misses_++;
+    return nullptr;
+}
+
+template<typename Key, typename Value, typename Hash>
+void LookupCache<Key, Value, Hash>::store(Node<Key, Value>* node)
+{
+    size_t hash = hasher_(node->getKey());
+    Slot& slot = slots_[hash & mask_];
+    slot.node = node;
+    slot.hash = hash;
+}
+
+/**
+* Drops node from the cache if it is cached. A node can only sit in the
+* slot its key hashes to, so this is O(1).
+*/
+template<typename Key, typename Value, typename Hash>
+void LookupCache<Key, Value, Hash>::invalidate(const Node<Key, Value>* node)
+{
+    Slot& slot = slots_[hasher_(node->getKey()) & mask_];
+    if (slot.node == node) {
+        slot.node = nullptr;
+    }
+}
+
+template<typename Key, typename Value, typename Hash>
+void LookupCache<Key, Value, Hash>::clear()
+{
+    for (size_t i = 0; i < slots_.size(); i++) {
+        slots_[i].node = nullptr;
+    }
+}
+
+/**
+* Interface of the optional approximate membership filter kept next to a
+* BinarySearchTree. mayContain never returns false for a key that was
+* added and not erased since, so a negative answer lets a lookup skip the
+* descent entirely.
+*/
+template <typename Key>
+class MembershipFilterBase
+{
+public:
+    virtual ~MembershipFilterBase() { }
+
+    virtual void add(const Key& key) = 0;
+    virtual void erase(const Key& key) = 0;
+    virtual bool mayContain(const Key& key) const = 0;
+    virtual void clear() = 0;
+
+    // True once the filter holds so many more keys than it was sized for
+    // that its false-positive rate has degraded; grown() then returns an
+    // empty filter sized for the current load, to be refilled by the tree.
+    virtual bool overloaded() const = 0;
+    virtual MembershipFilterBase<Key>* grown() const = 0;
+    virtual size_t memory() const = 0;
+};
+
+/**
+* A blocked counting Bloom filter. Every key maps to one 64-byte block,
+* a cache line of 128 four-bit counters, and sets hashes counters within
+* it, so a query touches at most two cache lines. Confining a key to one
+* block costs some accuracy, so the filter is sized with a quarter more
+* counters than an unblocked one would need. Counters make erase
+* possible; a counter that saturates at 15 is never decremented again,
+* which can only cost false positives, never false negatives.
+*
+* The filter is sized for capacity keys at the given false-positive rate,
+* using the usual -ln(p) / ln(2)^2 counters per key, and never takes more
+* than maxBytes (0 for no limit).
+*/
+template <typename Key, typename Hash>
+class CountingBloomFilter : public MembershipFilterBase<Key>
+{
+public:
+    CountingBloomFilter(size_t capacity, double falsePositiveRate, size_t maxBytes);
+
+    virtual void add(const Key& key) override;
+    virtual void erase(const Key& key) override;
+    virtual bool mayContain(const Key& key) const override;
+    virtual void clear() override;
+    virtual bool overloaded() const override;
+    virtual MembershipFilterBase<Key>* grown() const override;
+    virtual size_t memory() const override;
+
+private:
+    static const size_t BLOCK_BYTES = 64;
+    static const size_t BLOCK_COUNTERS = 2 * BLOCK_BYTES;
+    static const unsigned SATURATED = 15;
+
+    static unsigned long long mix(unsigned long long x);
+    size_t block(const Key& key, unsigned long long& bits) const;
+    static size_t nextPosition(unsigned long long& bits, unsigned i);
+    unsigned counter(size_t block, size_t pos) const;
+    void adjust(size_t block, size_t pos, int delta);
+
+    std::vector<unsigned char> counters_;
+    size_t blockMask_;
+    unsigned hashes_;
+    size_t capacity_;
+    size_t size_;
+    double falsePositiveRate_;
+    size_t maxBytes_;
+    Hash hasher_;
+};
+
+template<typename Key, typename Hash>
+CountingBloomFilter<Key, Hash>::CountingBloomFilter(size_t capacity, double falsePositiveRate, size_t maxBytes) :
+    capacity_(capacity ? capacity : 1),
+    size_(0),
+    falsePositiveRate_(falsePositiveRate),
+    maxBytes_(maxBytes)
+{
+    if (!(falsePositiveRate_ > 0.0 && falsePositiveRate_ < 1.0)) {
+        falsePositiveRate_ = 0.01;
+    }
+    double ln2 = std::log(2.0);
+    double perKey = -std::log(falsePositiveRate_) / (ln2 * ln2);
+    hashes_ = unsigned(perKey * ln2 + 0.5);
+    hashes_ = std::max(1u, std::min(hashes_, 16u));
+
+    size_t wanted = size_t(1.25 * perKey * double(capacity_)) / BLOCK_COUNTERS + 1;
+    size_t blocks = 1;
+    while (blocks < wanted && (maxBytes_ == 0 || 2 * blocks * BLOCK_BYTES <= maxBytes_)) {
+        blocks *= 2;
+    }
+    counters_.assign(blocks * BLOCK_BYTES, 0);
+    blockMask_ = blocks - 1;
+}
+
+/**
+* The splitmix64 finalizer. Keys are hashed with Hash and then mixed,
+* since std::hash is the identity for integers.
+*/
+template<typename Key, typename Hash>
+unsigned long long CountingBloomFilter<Key, Hash>::mix(unsigned long long x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+/**
+* Returns the block for key and seeds bits for nextPosition.
+*/
+template<typename Key, typename Hash>
+size_t CountingBloomFilter<Key, Hash>::block(const Key& key, unsigned long long& bits) const
+{
+    unsigned long long x = mix(hasher_(key));
+    bits = mix(x + 0x9e3779b97f4a7c15ULL);
+    return size_t(x) & blockMask_;
+}
+
+/**
+* Returns the i-th counter position in the block, seven fresh hash bits at
+* a time. Independent positions matter here: positions derived by double
+* hashing within a block this small collide far more often.
+*/
+template<typename Key, typename Hash>
+size_t CountingBloomFilter<Key, Hash>::nextPosition(unsigned long long& bits, unsigned i)
+{
+    if (i > 0 && i % 9 == 0) {
+        bits = mix(bits + i);
+    }
+    size_t pos = size_t(bits) & (BLOCK_COUNTERS - 1);
+    bits >>= 7;
+    return pos;
+}
+
+template<typename Key, typename Hash>
+unsigned CountingBloomFilter<Key, Hash>::counter(size_t block, size_t pos) const
+{
+    return (counters_[block * BLOCK_BYTES + pos / 2] >> (pos % 2 * 4)) & 0xf;
+}
+
+/**
+* Moves one counter by delta, leaving saturated counters alone.
+*/
+template<typename Key, typename Hash>
+void CountingBloomFilter<Key, Hash>::adjust(size_t block, size_t pos, int delta)
+{
+    unsigned value = counter(block, pos);
+    if (value == SATURATED || (value == 0 && delta < 0)) {
+        return;
+    }
+    unsigned shift = pos % 2 * 4;
+    unsigned char& byte = counters_[block * BLOCK_BYTES + pos / 2];
+    byte = (unsigned char)((byte & ~(0xf << shift)) | ((value + delta) << shift));
+}
+
+template<typename Key, typename Hash>
+void CountingBloomFilter<Key, Hash>::add(const Key& key)
+{
+    unsigned long long bits;
+    size_t b = block(key, bits);
+    for (unsigned i = 0; i < hashes_; i++) {
+        adjust(b, nextPosition(bits, i), 1);
+    }
+    size_++;
+}
+
+template<typename Key, typename Hash>
+void CountingBloomFilter<Key, Hash>::erase(const Key& key)
+{
+    unsigned long long bits;
+    size_t b = block(key, bits);
+    for (unsigned i = 0; i < hashes_; i++) {
+        adjust(b, nextPosition(bits, i), -1);
+    }
+    if (size_) {
+        size_--;
+    }
+}
+
+template<typename Key, typename Hash>
+bool CountingBloomFilter<Key, Hash>::mayContain(const Key& key) const
+{
+    unsigned long long bits;
+    size_t b = block(key, bits);
+    for (unsigned i = 0; i < hashes_; i++) {
+        if (counter(b, nextPosition(bits, i)) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template<typename Key, typename Hash>
+void CountingBloomFilter<Key, Hash>::clear()
+{
+    std::fill(counters_.begin(), counters_.end(), 0);
+    size_ = 0;
+}
+
+/**
+* Overloaded at twice the planned load, unless the memory budget rules out
+* a larger filter anyway.
+*/
+template<typename Key, typename Hash>
+bool CountingBloomFilter<Key, Hash>::overloaded() const
+{
+    return size_ > 2 * capacity_ && (maxBytes_ == 0 || 2 * counters_.size() <= maxBytes_);
+}
+
+template<typename Key, typename Hash>
+MembershipFilterBase<Key>* CountingBloomFilter<Key, Hash>::grown() const
+{
+    return new CountingBloomFilter<Key, Hash>(2 * size_, falsePositiveRate_, maxBytes_);
+}
+
+template<typename Key, typename Hash>
+size_t CountingBloomFilter<Key, Hash>::memory() const
+{
+    return counters_.size();
+}
+
+/**
+* Receives each change made through a tree's key-level operations, in
+* order and before the tree applies it. A write-ahead log (see wal.h)
+* attaches one to make changes durable between full snapshots.
+*/
+template <typename Key, typename Value>
+class MutationListener
+{
+public:
+    virtual ~MutationListener() { }
+
+    virtual void onInsert(const Key& key, const Value& value) = 0;
+    virtual void onRemove(const Key& key) = 0;
+    virtual void onClear() = 0;
+};
+
 /**
 * A templated unbalanced binary search tree.
 */
@@ -195,26 +557,68 @@ class BinarySearchTree
 {
 public:
     BinarySearchTree(); //TODO
+    BinarySearchTree(const BinarySearchTree<Key, Value>& other);
+    BinarySearchTree(BinarySearchTree<Key, Value>&& other);
     virtual ~BinarySearchTree(); //TODO
+    BinarySearchTree<Key, Value>& operator=(const BinarySearchTree<Key, Value>& other);
+    BinarySearchTree<Key, Value>& operator=(BinarySearchTree<Key, Value>&& other);
     virtual void insert(const std::pair<const Key, Value>& keyValuePair); //TODO
     virtual void remove(const Key& key); //TODO
-    void clear(); //TODO
-    void clear_Helper(Node<Key, Value>* node);
+    virtual void clear(); //TODO
+    size_t clear_Helper(Node<Key, Value>* node);
     bool isBalanced(); //TODO
     bool isBalanced_Helper(Node<Key, Value>* node);
     int isBalanced_Height(Node<Key, Value>* node);
+    virtual void rebalance();
     void print() const;
+
+    // Optional hot-key cache in front of every key lookup. Cached entries
+    // are dropped as their nodes leave the tree. Lookups then update the
+    // cache, so a tree with the cache enabled must not be read from
+    // several threads at once.
+    template<typename Hash = std::hash<Key> >
+    void enableLookupCache(size_t slots = 4096);
+    void disableLookupCache();
+    size_t lookupCacheHits() const;
+    size_t lookupCacheMisses() const;
+
+    // Optional membership filter that answers most lookups of absent keys
+    // without descending the tree. Sized for expectedKeys at the given
+    // false-positive rate, capped at maxBytes (0 for no cap), and rebuilt
+    // larger as the tree outgrows it.
+    template<typename Hash = std::hash<Key> >
+    void enableMembershipFilter(size_t expectedKeys = 1024, double falsePositiveRate = 0.01,
+                                size_t maxBytes = 0);
+    void disableMembershipFilter();
+    size_t membershipFilterMemory() const;
+
+    // Optional observer told of every insert, remove, erase, extract and
+    // clear (NULL to detach). The tree does not own it. Wholesale
+    // replacements such as assignment and load are not reported.
+    void setMutationListener(MutationListener<Key, Value>* listener);
+    MutationListener<Key, Value>* mutationListener() const;
     bool empty() const;
+    bool isMultimap() const;
 
     template<typename PPKey, typename PPValue>
     friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue> & tree);
 public:
+    class const_iterator;
+
     /**
     * An internal iterator class for traversing the contents of the BST.
+    * It is bidirectional: the end iterator remembers its tree, so --end()
+    * steps to the cached largest node in O(1).
     */
     class iterator  // TODO
     {
     public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key, Value>* pointer;
+        typedef std::pair<const Key, Value>& reference;
+
         iterator();
 
         std::pair<const Key,Value>& operator*() const;
@@ -224,21 +628,129 @@ public:
         bool operator!=(const iterator& rhs) const;
 
         iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
 
     protected:
         friend class BinarySearchTree<Key, Value>;
-        iterator(Node<Key,Value>* ptr);
+        friend class const_iterator;
+        iterator(Node<Key,Value>* ptr, const BinarySearchTree<Key, Value>* tree);
         Node<Key, Value> *current_;
+        const BinarySearchTree<Key, Value>* tree_;
+    };
+
+    /**
+    * A read-only counterpart of iterator. Any iterator converts to it.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::pair<const Key, Value>* pointer;
+        typedef const std::pair<const Key, Value>& reference;
+
+        const_iterator();
+        const_iterator(const iterator& it);
+
+        const std::pair<const Key,Value>& operator*() const;
+        const std::pair<const Key,Value>* operator->() const;
+
+        friend bool operator==(const const_iterator& lhs, const const_iterator& rhs)
+        {
+            return lhs.current_ == rhs.current_;
+        }
+        friend bool operator!=(const const_iterator& lhs, const const_iterator& rhs)
+        {
+            return lhs.current_ != rhs.current_;
+        }
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
+
+    protected:
+        friend class BinarySearchTree<Key, Value>;
+        const Node<Key, Value> *current_;
+        const BinarySearchTree<Key, Value>* tree_;
+    };
+
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    /**
+    * An owning handle to a node detached from a tree with extract(). The
+    * node can be relinked into another tree of the same type with
+    * insert(node_type&&), avoiding the allocator and any key/value copies.
+    */
+    class node_type
+    {
+    public:
+        node_type();
+        node_type(node_type&& other);
+        node_type& operator=(node_type&& other);
+        ~node_type();
+
+        bool empty() const;
+        explicit operator bool() const;
+        const Key& key() const;
+        Value& mapped() const;
+
+    protected:
+        friend class BinarySearchTree<Key, Value>;
+        explicit node_type(Node<Key, Value>* node);
+        node_type(const node_type&);
+        node_type& operator=(const node_type&);
+        Node<Key, Value>* node_;
+    };
+
+    struct insert_return_type
+    {
+        iterator position;
+        bool inserted;
+        node_type node;
     };
 
 public:
     iterator begin() const;
     iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+    const_reverse_iterator crbegin() const;
+    const_reverse_iterator crend() const;
     iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key) const;
+    size_t count(const Key& key) const;
+
+    // Internal traversals, calling f(key, value) for each item. The
+    // ranged form visits lo <= key < hi. parallel_for_each visits items
+    // in no particular order from several threads, so f must be safe to
+    // call concurrently.
+    template<typename Func>
+    void for_each(Func f) const;
+    template<typename Func>
+    void for_each_range(const Key& lo, const Key& hi, Func f) const;
+    template<typename Func>
+    void parallel_for_each(Func f, unsigned threads = 0) const;
+    insert_return_type insert(node_type&& nh);
+    iterator erase(iterator pos);
+    iterator erase(iterator first, iterator last);
+    void erase_range(const Key& lo, const Key& hi);
+    node_type extract(const Key& key);
+    node_type extract(iterator pos);
     Value& operator[](const Key& key);
     Value const & operator[](const Key& key) const;
 
 protected:
+    explicit BinarySearchTree(bool multi);
+
     // Mandatory helper functions
     Node<Key, Value>* internalFind(const Key& k) const; // TODO
     Node<Key, Value> *getSmallestNode() const;  // TODO
@@ -252,11 +764,45 @@ protected:
     virtual void nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2) ;
 
     // Add helper functions here
+    virtual Node<Key, Value>* createNode(const Key& key, const Value& value, Node<Key, Value>* parent) const;
+    Node<Key, Value>* findInsertParent(const Key& key, Node<Key, Value>*& parent) const;
+    iterator makeIterator(Node<Key, Value>* node) const;
+    Node<Key, Value>* nodeOf(const_iterator pos) const;
+    virtual void attachNode(Node<Key, Value>* node, Node<Key, Value>* parent);
+    virtual void unlinkNode(Node<Key, Value>* node);
+    void linkNode(Node<Key, Value>* node, Node<Key, Value>* parent);
+    void detachNode(Node<Key, Value>* node);
+    void updateExtremes();
+    void releaseNodes();
+    void invalidateLookupCache();
+    void refillMembershipFilter();
+    void fillMembershipFilter();
+    void unfilterSubtree(const Node<Key, Value>* node);
+    virtual void eraseNodes(Node<Key, Value>* first, Node<Key, Value>* last);
+    virtual void checkDirectChange() const;
+    virtual void nodesReplaced();
+    virtual Node<Key, Value>* cloneNode(const Node<Key, Value>* node, Node<Key, Value>* parent) const;
+    Node<Key, Value>* copy_Helper(const Node<Key, Value>* node, Node<Key, Value>* parent);
+    size_t treeToVine();
+    template<typename Visit>
+    static void for_each_Helper(Node<Key, Value>* node, Visit& visit);
+    template<typename Visit>
+    void for_each_range_Helper(const Key& lo, const Key& hi, Visit& visit) const;
+    template<typename Visit>
+    void parallel_for_each_Helper(Visit& visit, unsigned threads) const;
+    void compressVine(size_t count);
 
 
 protected:
     Node<Key, Value>* root_;
     // You should not need other data members
+    bool multi_;    // multimap mode: equal keys are kept as separate nodes
+    Node<Key, Value>* leftmost_;    // cached smallest and largest nodes
+    Node<Key, Value>* rightmost_;
+    LookupCacheBase<Key, Value>* cache_;    // NULL unless enabled
+    MembershipFilterBase<Key>* filter_;     // NULL unless enabled
+    MutationListener<Key, Value>* listener_;    // NULL unless attached, not owned
+    size_t nodeCount_;    // nodes linked into the tree, whether or not their keys are live
 };
 
 /*
@@ -266,12 +812,14 @@ Begin implementations for the BinarySearchTree::iterator class.
 */
 
 /**
-* Explicit constructor that initializes an iterator with a given node pointer.
+* Explicit constructor that initializes an iterator with a given node
+* pointer (NULL for end) in the given tree.
 */
 template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr)
+BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr, const BinarySearchTree<Key, Value>* tree)
 {
     this->current_ = ptr;
+    this->tree_ = tree;
 }
 
 /**
@@ -281,7 +829,7 @@ template<class Key, class Value>
 BinarySearchTree<Key, Value>::iterator::iterator() 
 {
     this->current_ = nullptr;
-
+    this->tree_ = nullptr;
 }
 
 /**
@@ -305,258 +853,1295 @@ BinarySearchTree<Key, Value>::iterator::operator->() const
 }
 
 /**
-* Checks if 'this' iterator's internals have the same value
-* as 'rhs'
+* Checks if 'this' iterator's internals have the same value
+* as 'rhs'
+*/
+template<class Key, class Value>
+bool
+BinarySearchTree<Key, Value>::iterator::operator==(
+    const BinarySearchTree<Key, Value>::iterator& rhs) const
+{
+    if (this->current_ == rhs.current_) {
+        return true;
+    }
+    else return false;
+}
+
+/**
+* Checks if 'this' iterator's internals have a different value
+* as 'rhs'
+*/
+template<class Key, class Value>
+bool
+BinarySearchTree<Key, Value>::iterator::operator!=(
+    const BinarySearchTree<Key, Value>::iterator& rhs) const
+{
+    if (this->current_ == rhs.current_) {
+        return false;
+    }
+    else return true;
+}
+
+
+/**
+* Advances the iterator's location using an in-order sequencing
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator&
+BinarySearchTree<Key, Value>::iterator::operator++()
+{
+    this->current_ = BinarySearchTree<Key, Value>::successor(current_);
+    
+    return *this;
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::iterator::operator++(int)
+{
+    iterator old = *this;
+    ++(*this);
+    return old;
+}
+
+/**
+* Moves the iterator back using an in-order sequencing. Decrementing the
+* end iterator lands on the largest item.
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator&
+BinarySearchTree<Key, Value>::iterator::operator--()
+{
+    if (this->current_ == nullptr) {
+        this->current_ = this->tree_->rightmost_;
+    }
+    else {
+        this->current_ = BinarySearchTree<Key, Value>::predecessor(current_);
+    }
+
+    return *this;
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::iterator::operator--(int)
+{
+    iterator old = *this;
+    --(*this);
+    return old;
+}
+
+
+/*
+-------------------------------------------------------------
+End implementations for the BinarySearchTree::iterator class.
+-------------------------------------------------------------
+*/
+
+template<class Key, class Value>
+BinarySearchTree<Key, Value>::const_iterator::const_iterator() :
+    current_(nullptr), tree_(nullptr)
+{
+
+}
+
+template<class Key, class Value>
+BinarySearchTree<Key, Value>::const_iterator::const_iterator(const iterator& it) :
+    current_(it.current_), tree_(it.tree_)
+{
+
+}
+
+template<class Key, class Value>
+const std::pair<const Key,Value> &
+BinarySearchTree<Key, Value>::const_iterator::operator*() const
+{
+    return current_->getItem();
+}
+
+template<class Key, class Value>
+const std::pair<const Key,Value> *
+BinarySearchTree<Key, Value>::const_iterator::operator->() const
+{
+    return &(current_->getItem());
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::const_iterator&
+BinarySearchTree<Key, Value>::const_iterator::operator++()
+{
+    this->current_ = BinarySearchTree<Key, Value>::successor(const_cast<Node<Key, Value>*>(current_));
+    return *this;
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::const_iterator
+BinarySearchTree<Key, Value>::const_iterator::operator++(int)
+{
+    const_iterator old = *this;
+    ++(*this);
+    return old;
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::const_iterator&
+BinarySearchTree<Key, Value>::const_iterator::operator--()
+{
+    if (this->current_ == nullptr) {
+        this->current_ = this->tree_->rightmost_;
+    }
+    else {
+        this->current_ = BinarySearchTree<Key, Value>::predecessor(const_cast<Node<Key, Value>*>(current_));
+    }
+    return *this;
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::const_iterator
+BinarySearchTree<Key, Value>::const_iterator::operator--(int)
+{
+    const_iterator old = *this;
+    --(*this);
+    return old;
+}
+
+/*
+----------------------------------------------------------------
+Begin implementations for the BinarySearchTree::node_type class.
+----------------------------------------------------------------
+*/
+
+/**
+* A default constructor that creates an empty handle.
+*/
+template<class Key, class Value>
+BinarySearchTree<Key, Value>::node_type::node_type() : node_(nullptr)
+{
+
+}
+
+/**
+* Takes ownership of an already detached node.
+*/
+template<class Key, class Value>
+BinarySearchTree<Key, Value>::node_type::node_type(Node<Key, Value>* node) : node_(node)
+{
+
+}
+
+template<class Key, class Value>
+BinarySearchTree<Key, Value>::node_type::node_type(node_type&& other) : node_(other.node_)
+{
+    other.node_ = nullptr;
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::node_type&
+BinarySearchTree<Key, Value>::node_type::operator=(node_type&& other)
+{
+    if (this != &other) {
+        delete node_;
+        node_ = other.node_;
+        other.node_ = nullptr;
+    }
+    return *this;
+}
+
+/**
+* A handle that was never reinserted frees its node.
+*/
+template<class Key, class Value>
+BinarySearchTree<Key, Value>::node_type::~node_type()
+{
+    delete node_;
+}
+
+template<class Key, class Value>
+bool BinarySearchTree<Key, Value>::node_type::empty() const
+{
+    return node_ == nullptr;
+}
+
+template<class Key, class Value>
+BinarySearchTree<Key, Value>::node_type::operator bool() const
+{
+    return node_ != nullptr;
+}
+
+/**
+* @precondition The handle is not empty
+*/
+template<class Key, class Value>
+const Key& BinarySearchTree<Key, Value>::node_type::key() const
+{
+    return node_->getKey();
+}
+
+/**
+* @precondition The handle is not empty
+*/
+template<class Key, class Value>
+Value& BinarySearchTree<Key, Value>::node_type::mapped() const
+{
+    return node_->getValue();
+}
+
+/*
+--------------------------------------------------------------
+End implementations for the BinarySearchTree::node_type class.
+--------------------------------------------------------------
+*/
+
+/*
+-----------------------------------------------------
+Begin implementations for the BinarySearchTree class.
+-----------------------------------------------------
+*/
+
+/**
+* Default constructor for a BinarySearchTree, which sets the root to NULL.
+*/
+template<class Key, class Value>
+BinarySearchTree<Key, Value>::BinarySearchTree() :
+    root_(nullptr), multi_(false), leftmost_(nullptr), rightmost_(nullptr), cache_(nullptr),
+    filter_(nullptr), listener_(nullptr), nodeCount_(0)
+{
+
+}
+
+/**
+* Constructor used by the multimap variants. In multimap mode insert never
+* overwrites: an equal key is linked in after the existing ones, so equal
+* keys keep their insertion order.
+*/
+template<class Key, class Value>
+BinarySearchTree<Key, Value>::BinarySearchTree(bool multi) :
+    root_(nullptr), multi_(multi), leftmost_(nullptr), rightmost_(nullptr), cache_(nullptr),
+    filter_(nullptr), listener_(nullptr), nodeCount_(0)
+{
+
+}
+
+/**
+* Copy constructor. Clones the structure of other node for node, so no
+* comparisons or rebalancing are done.
+*/
+template<class Key, class Value>
+BinarySearchTree<Key, Value>::BinarySearchTree(const BinarySearchTree<Key, Value>& other) :
+    root_(nullptr), multi_(other.multi_), leftmost_(nullptr), rightmost_(nullptr), cache_(nullptr),
+    filter_(nullptr), listener_(nullptr), nodeCount_(0)
+{
+    this->root_ = this->copy_Helper(other.root_, nullptr);
+    this->nodeCount_ = other.nodeCount_;
+    this->updateExtremes();
+}
+
+/**
+* Move constructor. Steals other's nodes and leaves it empty.
+*/
+template<class Key, class Value>
+BinarySearchTree<Key, Value>::BinarySearchTree(BinarySearchTree<Key, Value>&& other) :
+    root_(other.root_), multi_(other.multi_), leftmost_(other.leftmost_), rightmost_(other.rightmost_),
+    cache_(other.cache_), filter_(other.filter_), listener_(other.listener_), nodeCount_(other.nodeCount_)
+{
+    other.root_ = nullptr;
+    other.leftmost_ = nullptr;
+    other.rightmost_ = nullptr;
+    other.nodeCount_ = 0;
+    other.cache_ = nullptr;
+    other.filter_ = nullptr;
+    other.listener_ = nullptr;
+}
+
+template<typename Key, typename Value>
+BinarySearchTree<Key, Value>::~BinarySearchTree()
+{
+    this->releaseNodes();
+    delete cache_;
+    delete filter_;
+}
+
+/**
+* Copy assignment. The copy is built before the current contents are
+* released, so a failed allocation leaves this tree untouched.
+*
+* Assignment replaces the contents only: this tree keeps its own lookup
+* cache, membership filter (refilled with the new keys) and mutation
+* listener. Like load(), the replacement is not reported to the listener.
+*/
+template<class Key, class Value>
+BinarySearchTree<Key, Value>&
+BinarySearchTree<Key, Value>::operator=(const BinarySearchTree<Key, Value>& other)
+{
+    if (this != &other) {
+        Node<Key, Value>* copy = this->copy_Helper(other.root_, nullptr);
+        this->releaseNodes();
+        this->root_ = copy;
+        this->nodeCount_ = other.nodeCount_;
+        this->updateExtremes();
+        this->fillMembershipFilter();
+        this->nodesReplaced();
+    }
+    return *this;
+}
+
+/**
+* Move assignment. Releases the current contents and steals other's nodes.
+* As with copy assignment, each tree keeps its own cache, filter and
+* listener; other's are emptied along with it.
+*/
+template<class Key, class Value>
+BinarySearchTree<Key, Value>&
+BinarySearchTree<Key, Value>::operator=(BinarySearchTree<Key, Value>&& other)
+{
+    if (this != &other) {
+        this->releaseNodes();
+        this->root_ = other.root_;
+        this->leftmost_ = other.leftmost_;
+        this->rightmost_ = other.rightmost_;
+        this->nodeCount_ = other.nodeCount_;
+        this->fillMembershipFilter();
+        this->nodesReplaced();
+        other.root_ = nullptr;
+        other.releaseNodes();
+    }
+    return *this;
+}
+
+/**
+ * Returns true if tree is empty
+*/
+template<class Key, class Value>
+bool BinarySearchTree<Key, Value>::empty() const
+{
+    return this->root_ == nullptr;
+}
+
+/**
+ * Returns true if equal keys are kept as separate entries (multimap mode)
+*/
+template<class Key, class Value>
+bool BinarySearchTree<Key, Value>::isMultimap() const
+{
+    return multi_;
+}
+
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::print() const
+{
+    printRoot(root_);
+    std::cout << "\n";
+}
+
+/**
+* Returns an iterator to the "smallest" item in the tree in O(1)
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::begin() const
+{
+    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode(), this);
+    return begin;
+}
+
+/**
+* Returns an iterator whose value means INVALID
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::end() const
+{
+    BinarySearchTree<Key, Value>::iterator end(NULL, this);
+    return end;
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::const_iterator
+BinarySearchTree<Key, Value>::cbegin() const
+{
+    return const_iterator(this->begin());
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::const_iterator
+BinarySearchTree<Key, Value>::cend() const
+{
+    return const_iterator(this->end());
+}
+
+/**
+* Returns a reverse iterator to the "largest" item in the tree in O(1)
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::reverse_iterator
+BinarySearchTree<Key, Value>::rbegin() const
+{
+    return reverse_iterator(this->end());
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::reverse_iterator
+BinarySearchTree<Key, Value>::rend() const
+{
+    return reverse_iterator(this->begin());
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::const_reverse_iterator
+BinarySearchTree<Key, Value>::crbegin() const
+{
+    return const_reverse_iterator(this->cend());
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::const_reverse_iterator
+BinarySearchTree<Key, Value>::crend() const
+{
+    return const_reverse_iterator(this->cbegin());
+}
+
+/**
+* Returns an iterator to the item with the given key, k
+* or the end iterator if k does not exist in the tree
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::find(const Key & k) const
+{
+    Node<Key, Value> *curr = internalFind(k);
+    BinarySearchTree<Key, Value>::iterator it(curr, this);
+    return it;
+}
+
+/**
+* Wraps a node of this tree in an iterator, for derived trees that locate
+* nodes by other means than the search helpers.
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::makeIterator(Node<Key, Value>* node) const
+{
+    return iterator(node, this);
+}
+
+/**
+* Returns the node pos refers to (NULL for end()), so derived trees that
+* hand out const_iterators can act on the node without another lookup.
+*/
+template<class Key, class Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::nodeOf(const_iterator pos) const
+{
+    return const_cast<Node<Key, Value>*>(pos.current_);
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than k,
+* or the end iterator if every key in the tree is smaller
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::lower_bound(const Key & k) const
+{
+    Node<Key, Value> *curr = this->root_;
+    Node<Key, Value> *bound = nullptr;
+
+    while (curr != nullptr) {
+        if (curr->getKey() < k) {
+            curr = curr->getRight();
+        }
+        else {
+            bound = curr;
+            curr = curr->getLeft();
+        }
+    }
+
+    BinarySearchTree<Key, Value>::iterator it(bound, this);
+    return it;
+}
+
+/**
+* Returns an iterator to the first item whose key is greater than k,
+* or the end iterator if there is none
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::upper_bound(const Key & k) const
+{
+    Node<Key, Value> *curr = this->root_;
+    Node<Key, Value> *bound = nullptr;
+
+    while (curr != nullptr) {
+        if (k < curr->getKey()) {
+            bound = curr;
+            curr = curr->getLeft();
+        }
+        else {
+            curr = curr->getRight();
+        }
+    }
+
+    BinarySearchTree<Key, Value>::iterator it(bound, this);
+    return it;
+}
+
+/**
+* Returns the range of items whose key equals k
+*/
+template<class Key, class Value>
+std::pair<typename BinarySearchTree<Key, Value>::iterator, typename BinarySearchTree<Key, Value>::iterator>
+BinarySearchTree<Key, Value>::equal_range(const Key & k) const
+{
+    return std::make_pair(this->lower_bound(k), this->upper_bound(k));
+}
+
+/**
+* Returns the number of items whose key equals k (at most 1 unless the
+* tree is in multimap mode)
+*/
+template<class Key, class Value>
+size_t BinarySearchTree<Key, Value>::count(const Key & k) const
+{
+    if (!multi_) {
+        return internalFind(k) ? 1 : 0;
+    }
+
+    size_t n = 0;
+    for (iterator it = this->lower_bound(k); it != this->end() && !(k < it->first); ++it) {
+        n++;
+    }
+    return n;
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value>
+Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+{
+    Node<Key, Value> *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+template<class Key, class Value>
+Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+{
+    Node<Key, Value> *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+
+/**
+* An insert method to insert into a Binary Search Tree.
+* The tree will not remain balanced when inserting.
+* Recall: If key is already in the tree, you should 
+* overwrite the current value with the updated value.
+*/
+template<class Key, class Value>
+void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair) {
+    if (listener_) {
+        listener_->onInsert(keyValuePair.first, keyValuePair.second);
+    }
+
+    Node<Key, Value>* parent = nullptr;
+    Node<Key, Value>* node = this->findInsertParent(keyValuePair.first, parent);
+
+    if (node) { //Key already in tree, overwrite its value
+        node->setValue(keyValuePair.second);
+        return;
+    }
+
+    this->linkNode(this->createNode(keyValuePair.first, keyValuePair.second, parent), parent);
+}
+
+/**
+* Relinks a node previously detached with extract() into this tree without
+* allocating or copying. If the key is already present nothing is inserted
+* and the handle is passed back in the result. The handle must come from a
+* tree of the same type.
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::insert_return_type
+BinarySearchTree<Key, Value>::insert(node_type&& nh)
+{
+    this->checkDirectChange();
+    insert_return_type result;
+    result.inserted = false;
+
+    if (nh.empty()) {
+        return result;
+    }
+
+    Node<Key, Value>* parent = nullptr;
+    Node<Key, Value>* existing = this->findInsertParent(nh.key(), parent);
+
+    if (existing) {
+        result.position = iterator(existing, this);
+        result.node = std::move(nh);
+        return result;
+    }
+
+    if (listener_) {
+        listener_->onInsert(nh.key(), nh.mapped());
+    }
+
+    Node<Key, Value>* node = nh.node_;
+    nh.node_ = nullptr;
+    this->linkNode(node, parent);
+
+    result.position = iterator(node, this);
+    result.inserted = true;
+    return result;
+}
+
+/**
+* A remove method to remove a specific key from a Binary Search Tree.
+* Recall: The writeup specifies that if a node has 2 children you
+* should swap with the predecessor and then remove.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::remove(const Key & key) {
+    if (multi_) { //Remove every node with this key
+        this->erase(this->lower_bound(key), this->upper_bound(key));
+        return;
+    }
+
+    Node<Key, Value>* node = internalFind(key);
+
+    if (!node) { //If node is not in BST
+        return;
+    }
+
+    if (listener_) {
+        listener_->onRemove(key);
+    }
+    this->detachNode(node);
+    delete node;
+}
+
+/**
+* Removes the item at pos using the node directly, without searching for
+* its key again. Returns an iterator to the item that followed it.
+*/
+template<typename Key, typename Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::erase(iterator pos)
+{
+    this->checkDirectChange();
+    Node<Key, Value>* node = pos.current_;
+    Node<Key, Value>* next = successor(node);
+
+    if (listener_) {
+        listener_->onRemove(node->getKey());
+    }
+    this->detachNode(node);
+    delete node;
+
+    return iterator(next, this);
+}
+
+/**
+* Removes every item in [first, last) and returns last.
+*/
+template<typename Key, typename Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::erase(iterator first, iterator last)
+{
+    this->checkDirectChange();
+    if (first != last) {
+        if (listener_) {
+            for (Node<Key, Value>* node = first.current_; node != last.current_; node = successor(node)) {
+                listener_->onRemove(node->getKey());
+            }
+        }
+        this->eraseNodes(first.current_, last.current_);
+    }
+    return last;
+}
+
+/**
+* Removes every item whose key k satisfies lo <= k < hi.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::erase_range(const Key& lo, const Key& hi)
+{
+    if (!(lo < hi)) {
+        return;
+    }
+    this->erase(this->lower_bound(lo), this->lower_bound(hi));
+}
+
+/**
+* Visits every item in key order. Unlike the iterator, which climbs
+* parent links in successor(), this keeps the path on an explicit stack,
+* so each node is reached exactly once from above and f can be inlined.
+*/
+template<typename Key, typename Value>
+template<typename Func>
+void BinarySearchTree<Key, Value>::for_each(Func f) const
+{
+    auto visit = [&f](Node<Key, Value>* node) { f(node->getKey(), node->getValue()); };
+    for_each_Helper(this->root_, visit);
+}
+
+/**
+* Visits every item with lo <= key < hi in key order. Subtrees lying
+* entirely below lo are skipped on the way down.
+*/
+template<typename Key, typename Value>
+template<typename Func>
+void BinarySearchTree<Key, Value>::for_each_range(const Key& lo, const Key& hi, Func f) const
+{
+    auto visit = [&f](Node<Key, Value>* node) { f(node->getKey(), node->getValue()); };
+    this->for_each_range_Helper(lo, hi, visit);
+}
+
+/**
+* Visits every item using up to threads threads (the hardware concurrency
+* by default). See parallel_for_each_Helper.
+*/
+template<typename Key, typename Value>
+template<typename Func>
+void BinarySearchTree<Key, Value>::parallel_for_each(Func f, unsigned threads) const
+{
+    auto visit = [&f](Node<Key, Value>* node) { f(node->getKey(), node->getValue()); };
+    this->parallel_for_each_Helper(visit, threads);
+}
+
+/**
+* Calls visit on every node of the subtree rooted at node, in key order.
+*/
+template<typename Key, typename Value>
+template<typename Visit>
+void BinarySearchTree<Key, Value>::for_each_Helper(Node<Key, Value>* node, Visit& visit)
+{
+    std::vector<Node<Key, Value>*> stack;
+
+    while (node || !stack.empty()) {
+        while (node) {
+            stack.push_back(node);
+            node = node->getLeft();
+        }
+
+        node = stack.back();
+        stack.pop_back();
+        visit(node);
+        node = node->getRight();
+    }
+}
+
+template<typename Key, typename Value>
+template<typename Visit>
+void BinarySearchTree<Key, Value>::for_each_range_Helper(const Key& lo, const Key& hi, Visit& visit) const
+{
+    std::vector<Node<Key, Value>*> stack;
+    Node<Key, Value>* node = this->root_;
+
+    while (node || !stack.empty()) {
+        while (node) {
+            if (node->getKey() < lo) {
+                node = node->getRight();
+            }
+            else {
+                stack.push_back(node);
+                node = node->getLeft();
+            }
+        }
+        if (stack.empty()) {
+            return;
+        }
+
+        node = stack.back();
+        stack.pop_back();
+        if (!(node->getKey() < hi)) {
+            return;
+        }
+        visit(node);
+        node = node->getRight();
+    }
+}
+
+/**
+* The top levels of the tree are cut into a few subtrees per thread plus
+* the nodes above them. Threads repeatedly claim the next unclaimed piece,
+* so a thread that finishes a small subtree early moves on to another
+* instead of idling. The first exception thrown by visit is rethrown once
+* every thread has stopped.
+*/
+template<typename Key, typename Value>
+template<typename Visit>
+void BinarySearchTree<Key, Value>::parallel_for_each_Helper(Visit& visit, unsigned threads) const
+{
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (threads == 1 || this->root_ == nullptr) {
+        for_each_Helper(this->root_, visit);
+        return;
+    }
+
+    // Split breadth first until there are enough pieces to balance the load
+    std::vector<Node<Key, Value>*> subtrees(1, this->root_);
+    std::vector<Node<Key, Value>*> singles;
+    while (subtrees.size() < 4 * size_t(threads)) {
+        std::vector<Node<Key, Value>*> next;
+        for (size_t i = 0; i < subtrees.size(); i++) {
+            Node<Key, Value>* node = subtrees[i];
+            if (node->getLeft() == nullptr && node->getRight() == nullptr) {
+                next.push_back(node);
+                continue;
+            }
+            singles.push_back(node);
+            if (node->getLeft()) next.push_back(node->getLeft());
+            if (node->getRight()) next.push_back(node->getRight());
+        }
+        if (next.size() == subtrees.size()) {
+            subtrees.swap(next);
+            break;
+        }
+        subtrees.swap(next);
+    }
+
+    std::atomic<size_t> nextTask(0);
+    std::exception_ptr error;
+    std::mutex errorLock;
+    size_t taskCount = subtrees.size() + singles.size();
+
+    auto worker = [&]() {
+        for (size_t i = nextTask++; i < taskCount; i = nextTask++) {
+            try {
+                if (i < subtrees.size()) {
+                    for_each_Helper(subtrees[i], visit);
+                }
+                else {
+                    visit(singles[i - subtrees.size()]);
+                }
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> guard(errorLock);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                nextTask = taskCount;
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; t++) {
+        pool.push_back(std::thread(worker));
+    }
+    worker();
+    for (size_t t = 0; t < pool.size(); t++) {
+        pool[t].join();
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+/**
+* Removes the in-order run of nodes from first up to (not including) last,
+* where last may be NULL for "through the largest". The plain tree has no
+* balance to maintain, so it simply unlinks them one at a time.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::eraseNodes(Node<Key, Value>* first, Node<Key, Value>* last)
+{
+    while (first != last) {
+        Node<Key, Value>* next = successor(first);
+        this->detachNode(first);
+        delete first;
+        first = next;
+    }
+}
+
+/**
+* Called before a change that bypasses insert and remove: erasing through
+* iterators, extracting, inserting a node handle or clearing. Trees that
+* defer insert and remove override it to refuse such changes meanwhile.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::checkDirectChange() const
+{
+
+}
+
+/**
+* Called after the nodes were released, or relinked in bulk, without going
+* through attachNode and unlinkNode: by releaseNodes, assignment and the
+* merging and loading paths of derived trees. Trees that keep per-node
+* state outside the links rebuild it here from the nodes now in the tree.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::nodesReplaced()
+{
+
+}
+
+/**
+* Detaches the node holding key and returns an owning handle to it, or an
+* empty handle if the key is not present.
+*/
+template<typename Key, typename Value>
+typename BinarySearchTree<Key, Value>::node_type
+BinarySearchTree<Key, Value>::extract(const Key& key)
+{
+    this->checkDirectChange();
+    Node<Key, Value>* node = internalFind(key);
+
+    if (node) {
+        if (listener_) {
+            listener_->onRemove(key);
+        }
+        this->detachNode(node);
+    }
+    return node_type(node);
+}
+
+/**
+* Detaches the node at pos and returns an owning handle to it.
+*/
+template<typename Key, typename Value>
+typename BinarySearchTree<Key, Value>::node_type
+BinarySearchTree<Key, Value>::extract(iterator pos)
+{
+    this->checkDirectChange();
+    if (pos.current_) {
+        if (listener_) {
+            listener_->onRemove(pos.current_->getKey());
+        }
+        this->detachNode(pos.current_);
+    }
+    return node_type(pos.current_);
+}
+
+/**
+* Allocates a new node for this tree. Trees with richer node types
+* override this.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>*
+BinarySearchTree<Key, Value>::createNode(const Key& key, const Value& value, Node<Key, Value>* parent) const
+{
+    return new Node<Key, Value>(key, value, parent);
+}
+
+/**
+* Descends towards key. Returns the node holding key if there is one;
+* otherwise returns NULL and sets parent to the node a new node with that
+* key should hang from (NULL for an empty tree). In multimap mode an equal
+* key never stops the descent, so the new node lands after its duplicates.
+*
+* A key beyond either end of the tree hangs straight off the cached
+* leftmost or rightmost node, so appending increasing keys (timestamps,
+* sequence numbers) skips the descent entirely.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>*
+BinarySearchTree<Key, Value>::findInsertParent(const Key& key, Node<Key, Value>*& parent) const
+{
+    if (rightmost_ && (multi_ ? !(key < rightmost_->getKey()) : rightmost_->getKey() < key)) {
+        parent = rightmost_;
+        return nullptr;
+    }
+    if (leftmost_ && key < leftmost_->getKey()) {
+        parent = leftmost_;
+        return nullptr;
+    }
+
+    Node<Key, Value>* node = this->root_;
+    parent = nullptr;
+
+    while (node) { //Find place to insert new node or replace value via binary search
+        parent = node;
+        if (node->getKey() > key) {
+            node = node->getLeft();
+        }
+        else if (node->getKey() < key || multi_) {
+            node = node->getRight();
+        }
+        else {
+            return node;
+        }
+    }
+
+    return nullptr;
+}
+
+/**
+* Links an unattached node as the left or right child of parent (as
+* returned by findInsertParent), or as the root if parent is NULL.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::attachNode(Node<Key, Value>* node, Node<Key, Value>* parent)
+{
+    node->setParent(parent);
+    node->setLeft(nullptr);
+    node->setRight(nullptr);
+
+    if (parent == nullptr) { //Tree is empty
+        this->root_ = node;
+    }
+    else if (parent->getKey() > node->getKey()) { //Left child
+        parent->setLeft(node);
+    }
+    else { //Right child
+        parent->setRight(node);
+    }
+}
+
+/**
+* Attaches node through the attachNode hook and updates the cached
+* extremes. A new node can only become the leftmost by being smaller than
+* every key, or the rightmost by being no smaller than every key (equal
+* keys land after their duplicates).
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::linkNode(Node<Key, Value>* node, Node<Key, Value>* parent)
+{
+    this->attachNode(node, parent);
+    nodeCount_++;
+
+    // The extremes go first: a refill walks the tree from leftmost_
+    if (leftmost_ == nullptr) {
+        leftmost_ = node;
+        rightmost_ = node;
+    }
+    else {
+        if (node->getKey() < leftmost_->getKey()) {
+            leftmost_ = node;
+        }
+        if (!(node->getKey() < rightmost_->getKey())) {
+            rightmost_ = node;
+        }
+    }
+
+    if (filter_) {
+        filter_->add(node->getKey());
+        if (filter_->overloaded()) {
+            this->refillMembershipFilter();
+        }
+    }
+}
+
+/**
+* Detaches node through the unlinkNode hook, first moving the cached
+* extremes off it if necessary.
 */
-template<class Key, class Value>
-bool
-BinarySearchTree<Key, Value>::iterator::operator==(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::detachNode(Node<Key, Value>* node)
 {
-    if (this->current_ == rhs.current_) {
-        return true;
+    if (node == leftmost_) {
+        leftmost_ = successor(node);
     }
-    else return false;
+    if (node == rightmost_) {
+        rightmost_ = predecessor(node);
+    }
+    if (cache_) {
+        cache_->invalidate(node);
+    }
+    if (filter_) {
+        filter_->erase(node->getKey());
+    }
+    this->unlinkNode(node);
+    nodeCount_--;
 }
 
 /**
-* Checks if 'this' iterator's internals have a different value
-* as 'rhs'
+* Empties the lookup cache, for operations that free nodes without going
+* through detachNode.
 */
-template<class Key, class Value>
-bool
-BinarySearchTree<Key, Value>::iterator::operator!=(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::invalidateLookupCache()
 {
-    if (this->current_ == rhs.current_) {
-        return false;
+    if (cache_) {
+        cache_->clear();
     }
-    else return true;
 }
 
-
 /**
-* Advances the iterator's location using an in-order sequencing
+* Puts a direct-mapped cache of slots entries (rounded up to a power of
+* two) in front of key lookups, replacing any existing cache. Hash must
+* be a hash functor for Key.
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator&
-BinarySearchTree<Key, Value>::iterator::operator++()
+template<typename Key, typename Value>
+template<typename Hash>
+void BinarySearchTree<Key, Value>::enableLookupCache(size_t slots)
 {
-    this->current_ = BinarySearchTree<Key, Value>::successor(current_);
-    
-    return *this;
+    LookupCacheBase<Key, Value>* cache = new LookupCache<Key, Value, Hash>(slots);
+    delete cache_;
+    cache_ = cache;
 }
 
-
-/*
--------------------------------------------------------------
-End implementations for the BinarySearchTree::iterator class.
--------------------------------------------------------------
-*/
-
-/*
------------------------------------------------------
-Begin implementations for the BinarySearchTree class.
------------------------------------------------------
-*/
-
-/**
-* Default constructor for a BinarySearchTree, which sets the root to NULL.
-*/
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::BinarySearchTree() : root_(nullptr)
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::disableLookupCache()
 {
+    delete cache_;
+    cache_ = nullptr;
+}
 
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::lookupCacheHits() const
+{
+    return cache_ ? cache_->hits() : 0;
 }
 
 template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::~BinarySearchTree()
+size_t BinarySearchTree<Key, Value>::lookupCacheMisses() const
 {
-    this->clear();
+    return cache_ ? cache_->misses() : 0;
 }
 
 /**
- * Returns true if tree is empty
+* Replaces any existing filter with a CountingBloomFilter over Hash and
+* fills it with the keys already in the tree.
 */
-template<class Key, class Value>
-bool BinarySearchTree<Key, Value>::empty() const
+template<typename Key, typename Value>
+template<typename Hash>
+void BinarySearchTree<Key, Value>::enableMembershipFilter(size_t expectedKeys, double falsePositiveRate,
+                                                          size_t maxBytes)
 {
-    return this->root_ == nullptr;
+    MembershipFilterBase<Key>* filter = new CountingBloomFilter<Key, Hash>(expectedKeys, falsePositiveRate, maxBytes);
+    delete filter_;
+    filter_ = filter;
+    for (Node<Key, Value>* node = leftmost_; node; node = successor(node)) {
+        filter_->add(node->getKey());
+    }
 }
 
 template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::print() const
+void BinarySearchTree<Key, Value>::disableMembershipFilter()
 {
-    printRoot(root_);
-    std::cout << "\n";
+    delete filter_;
+    filter_ = nullptr;
 }
 
 /**
-* Returns an iterator to the "smallest" item in the tree
+* Returns the bytes taken by the membership filter, 0 if there is none.
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::begin() const
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::membershipFilterMemory() const
 {
-    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode());
-    return begin;
+    return filter_ ? filter_->memory() : 0;
 }
 
-/**
-* Returns an iterator whose value means INVALID
-*/
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::end() const
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::setMutationListener(MutationListener<Key, Value>* listener)
 {
-    BinarySearchTree<Key, Value>::iterator end(NULL);
-    return end;
+    listener_ = listener;
 }
 
-/**
-* Returns an iterator to the item with the given key, k
-* or the end iterator if k does not exist in the tree
-*/
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::find(const Key & k) const
+template<typename Key, typename Value>
+MutationListener<Key, Value>* BinarySearchTree<Key, Value>::mutationListener() const
 {
-    Node<Key, Value> *curr = internalFind(k);
-    BinarySearchTree<Key, Value>::iterator it(curr);
-    return it;
+    return listener_;
 }
 
 /**
- * @precondition The key exists in the map
- * Returns the value associated with the key
- */
-template<class Key, class Value>
-Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+* Swaps the membership filter for a larger one and refills it from the
+* tree. Amortized O(1) per insert, since the filter doubles each time.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::refillMembershipFilter()
 {
-    Node<Key, Value> *curr = internalFind(key);
-    if(curr == NULL) throw std::out_of_range("Invalid key");
-    return curr->getValue();
+    MembershipFilterBase<Key>* filter = filter_->grown();
+    delete filter_;
+    filter_ = filter;
+    for (Node<Key, Value>* node = leftmost_; node; node = successor(node)) {
+        filter_->add(node->getKey());
+    }
 }
-template<class Key, class Value>
-Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+
+/**
+* Adds every key in the tree to the membership filter, if there is one,
+* growing it if that overloads it. For operations that install a whole
+* tree of nodes at once into an empty filter.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::fillMembershipFilter()
 {
-    Node<Key, Value> *curr = internalFind(key);
-    if(curr == NULL) throw std::out_of_range("Invalid key");
-    return curr->getValue();
+    if (filter_ == nullptr) {
+        return;
+    }
+    for (Node<Key, Value>* node = leftmost_; node; node = successor(node)) {
+        filter_->add(node->getKey());
+    }
+    if (filter_->overloaded()) {
+        this->refillMembershipFilter();
+    }
 }
 
 /**
-* An insert method to insert into a Binary Search Tree.
-* The tree will not remain balanced when inserting.
-* Recall: If key is already in the tree, you should 
-* overwrite the current value with the updated value.
+* Erases the keys of the subtree rooted at node from the membership
+* filter, for operations that free a whole subtree at once.
 */
-template<class Key, class Value>
-void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair) {
-    if (this->empty()) { //Set new root node if tree is empty
-        this->root_ = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, nullptr);
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::unfilterSubtree(const Node<Key, Value>* node)
+{
+    if (filter_ == nullptr) {
+        return;
     }
-    else {
-        Node<Key, Value>* node = this->root_;
-        Node<Key, Value>* parent;
-
-        while (node) { //Find place to insert new node or replace value via binary search
-            parent = node;
-            if (node->getKey() > keyValuePair.first) {
-                node = node->getLeft();
-            }
-            else if (node->getKey() < keyValuePair.first) {
-                node = node->getRight();
-            }
-            else {
-                node->setValue(keyValuePair.second);
-                return;
-            }
-        }
-        if (parent->getKey() > keyValuePair.first) { //Right child
-            parent->setLeft(new Node<Key, Value>(keyValuePair.first, keyValuePair.second, parent));
-            parent->getLeft()->setParent(parent);
-            parent->getLeft()->setLeft(nullptr);
-            parent->getLeft()->setRight(nullptr);
-        }
-        else { //Left child
-            parent->setRight(new Node<Key, Value>(keyValuePair.first, keyValuePair.second, parent));
-            parent->getRight()->setParent(parent);
-            parent->getRight()->setLeft(nullptr);
-            parent->getRight()->setRight(nullptr);
-        }
+    while (node) {
+        unfilterSubtree(node->getLeft());
+        filter_->erase(node->getKey());
+        node = node->getRight();
     }
 }
 
 /**
-* A remove method to remove a specific key from a Binary Search Tree.
-* Recall: The writeup specifies that if a node has 2 children you
-* should swap with the predecessor and then remove.
+* Recomputes the cached extremes by walking down both spines. Used after
+* operations that replace the structure wholesale (copying, splitting).
 */
 template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::remove(const Key & key) {
-    Node<Key, Value>* node = internalFind(key);
+void BinarySearchTree<Key, Value>::updateExtremes()
+{
+    leftmost_ = this->root_;
+    rightmost_ = this->root_;
 
-    if (!node) { //If node is not in BST
+    if (this->root_ == nullptr) {
         return;
     }
+    while (leftmost_->getLeft() != nullptr) {
+        leftmost_ = leftmost_->getLeft();
+    }
+    while (rightmost_->getRight() != nullptr) {
+        rightmost_ = rightmost_->getRight();
+    }
+}
 
+/**
+* Detaches node from the tree without freeing it. On return node has no
+* parent or children.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::unlinkNode(Node<Key, Value>* node)
+{
     if (node->getLeft() != nullptr && node->getRight() != nullptr ) { //If node has two children
         nodeSwap(node, predecessor(node));
     }
 
-    if (node->getLeft() != nullptr && node->getRight() == nullptr ) { //Only Left child
-        if (node->getParent()) {
-            Node<Key, Value>* parent = node->getParent();
-            if (node->getParent()->getLeft() != node) {
-                node->getParent()->setRight(node->getLeft());
-                parent->getRight()->setParent(parent);
-            } else {
-                node->getParent()->setLeft(node->getLeft());
-                parent->getLeft()->setParent(parent);
-            }
-        } else { //Must be the root node
-            root_ = node->getLeft();
-            node->getLeft()->setParent(NULL);
-        }
+    Node<Key, Value>* child = node->getLeft() ? node->getLeft() : node->getRight();
+    Node<Key, Value>* parent = node->getParent();
 
-        delete node;
-        return;
+    if (child) {
+        child->setParent(parent);
     }
 
-    if ( node->getLeft() == nullptr && node->getRight()) { //Only right child
-        if (node->getParent()) {
-            Node<Key, Value>* parent = node->getParent();
-            if (node->getParent()->getLeft() == node) {
-                node->getParent()->setLeft(node->getRight());
-                parent->getLeft()->setParent(parent);
-            } else {
-                node->getParent()->setRight(node->getRight());
-                parent->getRight()->setParent(parent);
-            }
-        } else { //Must be the root node
-            root_ = node->getRight();
-            node->getRight()->setParent(nullptr);
-        }
-
-        delete node;
-        return;
+    if (parent == nullptr) { //Must be the root node
+        root_ = child;
     }
-
-    if (node->getLeft() == nullptr && node->getRight() == nullptr) { //Node has no children
-        if (node->getParent()) {
-            if (node->getParent()->getLeft() == node) {
-                node->getParent()->setLeft(nullptr);
-            } else {
-                node->getParent()->setRight(nullptr);
-            }
-        } else { //Must be the root node
-            root_ = nullptr;
-        }
-
-        delete node;
-        return;
+    else if (parent->getLeft() == node) {
+        parent->setLeft(child);
+    }
+    else {
+        parent->setRight(child);
     }
+
+    node->setParent(nullptr);
+    node->setLeft(nullptr);
+    node->setRight(nullptr);
 }
 
 template<class Key, class Value>
@@ -620,43 +2205,102 @@ BinarySearchTree<Key, Value>::successor(Node<Key, Value>* current)
 */
 template<typename Key, typename Value>
 void BinarySearchTree<Key, Value>::clear()
+{
+    this->checkDirectChange();
+    if (listener_) {
+        listener_->onClear();
+    }
+    this->releaseNodes();
+}
+
+/**
+* Frees every node without reporting a change, for destruction and for
+* wholesale replacement of the contents.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::releaseNodes()
 {
     this->clear_Helper(this->root_);
     this->root_ = nullptr;
+    this->nodeCount_ = 0;
+    this->leftmost_ = nullptr;
+    this->rightmost_ = nullptr;
+    this->invalidateLookupCache();
+    if (filter_) {
+        filter_->clear();
+    }
+    this->nodesReplaced();
 }
 
+/**
+* Frees the subtree rooted at node, returning how many nodes it held.
+*/
 template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear_Helper(Node<Key, Value>* node) {
+size_t BinarySearchTree<Key, Value>::clear_Helper(Node<Key, Value>* node) {
+    size_t count = 0;
     if (node){
-        clear_Helper(node->getRight());
-        clear_Helper(node->getLeft());
+        count += clear_Helper(node->getRight());
+        count += clear_Helper(node->getLeft());
         delete node;
         node = nullptr;
+        count++;
     }
+    return count;
 }
 
+/**
+* Allocates a copy of node (without its links) whose parent is parent.
+* Trees with richer node types override this to copy their extra fields.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>*
+BinarySearchTree<Key, Value>::cloneNode(const Node<Key, Value>* node, Node<Key, Value>* parent) const
+{
+    return new Node<Key, Value>(node->getKey(), node->getValue(), parent);
+}
 
 /**
-* A helper function to find the smallest node in the tree.
+* Recursively clones the subtree rooted at node, returning the new subtree
+* root. If an allocation throws, the partial copy is freed before rethrowing.
 */
 template<typename Key, typename Value>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::getSmallestNode() const
+BinarySearchTree<Key, Value>::copy_Helper(const Node<Key, Value>* node, Node<Key, Value>* parent)
 {
-    if (this->empty()) return nullptr;
+    if (node == nullptr) {
+        return nullptr;
+    }
 
-    Node<Key, Value>* temp = this->root_;
-    while (temp->getLeft() != nullptr) {
-        temp = temp->getLeft();
+    Node<Key, Value>* copy = this->cloneNode(node, parent);
+    try {
+        copy->setLeft(this->copy_Helper(node->getLeft(), copy));
+        copy->setRight(this->copy_Helper(node->getRight(), copy));
     }
+    catch (...) {
+        this->clear_Helper(copy);
+        throw;
+    }
+
+    return copy;
+}
 
-    return temp;
+/**
+* A helper function to find the smallest node in the tree. The node is
+* cached, so this is O(1).
+*/
+template<typename Key, typename Value>
+Node<Key, Value>*
+BinarySearchTree<Key, Value>::getSmallestNode() const
+{
+    return this->leftmost_;
 }
 
 /**
 * Helper function to find a node with given key, k and
 * return a pointer to it or NULL if no item with that key
-* exists
+* exists. In multimap mode the first (leftmost) match is returned.
+* The lookup cache, if enabled, is consulted first and filled on a hit
+* in the tree.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) const
@@ -665,7 +2309,18 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) con
         return nullptr;
     }
 
+    if (cache_) {
+        Node<Key, Value>* cached = cache_->lookup(key);
+        if (cached) {
+            return cached;
+        }
+    }
+    if (filter_ && !filter_->mayContain(key)) {
+        return nullptr;
+    }
+
     Node<Key, Value>* node = this->root_;
+    Node<Key, Value>* found = nullptr;
 
     while (node != nullptr) {
         if (node->getKey() > key) {
@@ -674,12 +2329,20 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) con
         else if (node->getKey() < key) {
             node = node->getRight();
         }
+        else if (multi_) { //Keep going left for the first of the duplicates
+            found = node;
+            node = node->getLeft();
+        }
         else {
-            return node;
+            found = node;
+            break;
         }
     }
 
-    return nullptr;
+    if (found && cache_) {
+        cache_->store(found);
+    }
+    return found;
 }
 
 /**
@@ -699,10 +2362,10 @@ bool BinarySearchTree<Key, Value>::isBalanced_Helper(Node<Key, Value>* node) {
         return true;
     }
 
-    int leftHeight = isBalanced_Height(node->left_);
-    int rightHeight = isBalanced_Height(node->right_);
+    int leftHeight = isBalanced_Height(node->getLeft());
+    int rightHeight = isBalanced_Height(node->getRight());
 
-    if (std::abs(leftHeight - rightHeight) <= 1 && isBalanced_Helper(node->left_) && isBalanced_Helper(node->right_)) {
+    if (std::abs(leftHeight - rightHeight) <= 1 && isBalanced_Helper(node->getLeft()) && isBalanced_Helper(node->getRight())) {
         return true;
     }
 
@@ -716,6 +2379,102 @@ int BinarySearchTree<Key, Value>::isBalanced_Height(Node<Key, Value>* node) {
     return 1 + std::max(isBalanced_Height(node->getLeft()), isBalanced_Height(node->getRight()));
 }
 
+/**
+* Rebalances the tree in place with the Day-Stout-Warren algorithm: the
+* tree is first straightened into a right-leaning vine, then folded back
+* up with runs of left rotations into a complete tree, so every level but
+* the last is full. O(n) time and O(1) extra space; no node is allocated,
+* freed or copied, so iterators and node pointers stay valid.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::rebalance()
+{
+    size_t n = this->treeToVine();
+
+    // Fold away the nodes that will form the partial bottom level first
+    size_t full = 1;
+    while (full <= (n + 1) / 2) {
+        full *= 2;
+    }
+    size_t size = full - 1;
+    this->compressVine(n - size);
+
+    while (size > 1) {
+        size /= 2;
+        this->compressVine(size);
+    }
+}
+
+/**
+* Turns the tree into a vine (every node only has a right child) by
+* rotating right at each spine node until it has no left child. Returns
+* the number of nodes.
+*/
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::treeToVine()
+{
+    size_t n = 0;
+    Node<Key, Value>* tail = nullptr;
+    Node<Key, Value>* node = this->root_;
+
+    while (node) {
+        Node<Key, Value>* left = node->getLeft();
+        if (left) { //Rotate right at node, lifting left onto the vine
+            node->setLeft(left->getRight());
+            if (left->getRight()) {
+                left->getRight()->setParent(node);
+            }
+            left->setRight(node);
+            left->setParent(tail);
+            node->setParent(left);
+            if (tail) {
+                tail->setRight(left);
+            }
+            else {
+                this->root_ = left;
+            }
+            node = left;
+        }
+        else {
+            n++;
+            tail = node;
+            node = node->getRight();
+        }
+    }
+
+    return n;
+}
+
+/**
+* Performs count left rotations down the right spine, at every other spine
+* node starting from the root.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::compressVine(size_t count)
+{
+    Node<Key, Value>* tail = nullptr;
+    Node<Key, Value>* node = this->root_;
+
+    for (size_t i = 0; i < count; i++) {
+        Node<Key, Value>* child = node->getRight();
+        node->setRight(child->getLeft());
+        if (child->getLeft()) {
+            child->getLeft()->setParent(node);
+        }
+        child->setLeft(node);
+        child->setParent(tail);
+        node->setParent(child);
+        if (tail) {
+            tail->setRight(child);
+        }
+        else {
+            this->root_ = child;
+        }
+        tail = child;
+        node = child->getRight();
+    }
+}
+
 
 
 template<typename Key, typename Value>
@@ -822,4 +2581,23 @@ End implementations for the BinarySearchTree class.
 ---------------------------------------------------
 */
 
+/**
+* A BinarySearchTree that keeps every inserted pair, so a key may appear
+* more than once. Equal keys are stored as separate nodes in insertion
+* order; find() returns the first of them, equal_range() spans all of
+* them, and remove(key) erases all of them.
+*/
+template <typename Key, typename Value>
+class BinarySearchMultimap : public BinarySearchTree<Key, Value>
+{
+public:
+    BinarySearchMultimap();
+};
+
+template<class Key, class Value>
+BinarySearchMultimap<Key, Value>::BinarySearchMultimap() : BinarySearchTree<Key, Value>(true)
+{
+
+}
+
 #endif
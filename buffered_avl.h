@@ -0,0 +1,271 @@
+#ifndef BUFFERED_AVL_H
+#define BUFFERED_AVL_H
+
+#include <vector>
+#include <algorithm>
+#include "avlbst.h"
+
+/**
+* An ordered map that puts an unsorted write buffer in front of an AVLTree,
+* in the style of an LSM memtable. Writes are appended to the buffer in
+* O(1) and reads consult the buffer before the tree.
+*
+* Once the buffer holds mergeThreshold writes it is sealed: sorted, reduced
+* to the last write per key, and then merged into the tree mergeStep
+* entries at a time, one step per later write. The cost of a merge is
+* therefore spread over the writes that follow it instead of landing on a
+* single call. flush() finishes all pending work at once.
+*/
+template <typename Key, typename Value>
+class BufferedAVLTree
+{
+public:
+    explicit BufferedAVLTree(size_t mergeThreshold = 256, size_t mergeStep = 32);
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+
+    void mergeStep();
+    void flush();
+    size_t pending() const;
+
+    // Ordered traversal; flushes first so the tree holds everything.
+    // f is called as f(key, value).
+    template<typename Func>
+    void for_each(Func f);
+
+private:
+    struct Entry
+    {
+        Key key;
+        Value value;
+        bool erased;
+    };
+
+    static bool entryLess(const Entry& a, const Entry& b);
+
+    void write(const Entry& entry);
+    void seal();
+    void merge(size_t count);
+    const Entry* lookup(const Key& key) const;
+
+    AVLTree<Key, Value> tree_;
+    std::vector<Entry> buffer_;    // unsorted, newest last
+    std::vector<Entry> sealed_;    // sorted, one entry per key
+    size_t mergePos_;              // sealed_[mergePos_..] is not yet in tree_
+    size_t mergeThreshold_;
+    size_t mergeStep_;
+};
+
+/*
+  ----------------------------------------------------
+  Begin implementations for the BufferedAVLTree class.
+  ----------------------------------------------------
+*/
+
+template<class Key, class Value>
+BufferedAVLTree<Key, Value>::BufferedAVLTree(size_t mergeThreshold, size_t mergeStep) :
+    mergePos_(0),
+    mergeThreshold_(mergeThreshold ? mergeThreshold : 1),
+    mergeStep_(mergeStep ? mergeStep : 1)
+{
+
+}
+
+template<class Key, class Value>
+void BufferedAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    Entry entry = { keyValuePair.first, keyValuePair.second, false };
+    write(entry);
+}
+
+template<class Key, class Value>
+void BufferedAVLTree<Key, Value>::remove(const Key& key)
+{
+    Entry entry = { key, Value(), true };
+    write(entry);
+}
+
+/**
+* Copies the newest value stored under key into value. Returns false (and
+* leaves value untouched) if the key is absent or was removed.
+*/
+template<class Key, class Value>
+bool BufferedAVLTree<Key, Value>::find(const Key& key, Value& value) const
+{
+    const Entry* entry = lookup(key);
+    if (entry) {
+        if (entry->erased) {
+            return false;
+        }
+        value = entry->value;
+        return true;
+    }
+
+    typename AVLTree<Key, Value>::iterator it = tree_.find(key);
+    if (it == tree_.end()) {
+        return false;
+    }
+    value = it->second;
+    return true;
+}
+
+template<class Key, class Value>
+bool BufferedAVLTree<Key, Value>::contains(const Key& key) const
+{
+    const Entry* entry = lookup(key);
+    if (entry) {
+        return !entry->erased;
+    }
+    return tree_.find(key) != tree_.end();
+}
+
+/**
+* Merges the next mergeStep entries of the sealed run into the tree.
+*/
+template<class Key, class Value>
+void BufferedAVLTree<Key, Value>::mergeStep()
+{
+    merge(mergeStep_);
+}
+
+/**
+* Merges everything still buffered into the tree. The whole buffer goes in
+* as a single batch, so a large flush rebuilds the tree in one linear pass
+* rather than inserting entry by entry.
+*/
+template<class Key, class Value>
+void BufferedAVLTree<Key, Value>::flush()
+{
+    merge(sealed_.size());
+    if (!buffer_.empty()) {
+        seal();
+        merge(sealed_.size());
+    }
+}
+
+/**
+* Merges the next count entries of the sealed run into the tree. The
+* entries are applied in key order, and inserts go in as one sorted batch.
+*/
+template<class Key, class Value>
+void BufferedAVLTree<Key, Value>::merge(size_t count)
+{
+    size_t end = std::min(sealed_.size(), mergePos_ + count);
+    std::vector<std::pair<Key, Value> > batch;
+
+    for (; mergePos_ < end; mergePos_++) {
+        const Entry& entry = sealed_[mergePos_];
+        if (entry.erased) {
+            tree_.remove(entry.key);
+        }
+        else {
+            batch.push_back(std::make_pair(entry.key, entry.value));
+        }
+    }
+    tree_.insertBatch(batch.begin(), batch.end());
+
+    if (mergePos_ == sealed_.size()) {
+        sealed_.clear();
+        mergePos_ = 0;
+    }
+}
+
+/**
+* Returns the number of buffered writes not yet merged into the tree.
+*/
+template<class Key, class Value>
+size_t BufferedAVLTree<Key, Value>::pending() const
+{
+    return buffer_.size() + (sealed_.size() - mergePos_);
+}
+
+template<class Key, class Value>
+template<typename Func>
+void BufferedAVLTree<Key, Value>::for_each(Func f)
+{
+    flush();
+    for (typename AVLTree<Key, Value>::iterator it = tree_.begin(); it != tree_.end(); ++it) {
+        f(it->first, it->second);
+    }
+}
+
+template<class Key, class Value>
+bool BufferedAVLTree<Key, Value>::entryLess(const Entry& a, const Entry& b)
+{
+    return a.key < b.key;
+}
+
+/**
+* Appends a write, advancing any merge in progress by one step. A full
+* buffer is sealed once the previous sealed run has been fully merged.
+*/
+template<class Key, class Value>
+void BufferedAVLTree<Key, Value>::write(const Entry& entry)
+{
+    buffer_.push_back(entry);
+
+    if (mergePos_ < sealed_.size()) {
+        mergeStep();
+    }
+    else if (buffer_.size() >= mergeThreshold_) {
+        seal();
+        mergeStep();
+    }
+}
+
+/**
+* Turns the write buffer into the sealed run: sorted by key, keeping only
+* the newest write for each key. The stable sort keeps equal keys in write
+* order, so the last of each group is the newest.
+*/
+template<class Key, class Value>
+void BufferedAVLTree<Key, Value>::seal()
+{
+    std::stable_sort(buffer_.begin(), buffer_.end(), entryLess);
+
+    sealed_.clear();
+    for (size_t i = 0; i < buffer_.size(); i++) {
+        if (i + 1 < buffer_.size() && !entryLess(buffer_[i], buffer_[i + 1])) {
+            continue;
+        }
+        sealed_.push_back(buffer_[i]);
+    }
+    mergePos_ = 0;
+    buffer_.clear();
+}
+
+/**
+* Returns the newest buffered write for key, or NULL if the key is only
+* (possibly) in the tree. The write buffer is newer than the sealed run,
+* so it is searched first, newest entry first.
+*/
+template<class Key, class Value>
+const typename BufferedAVLTree<Key, Value>::Entry* BufferedAVLTree<Key, Value>::lookup(const Key& key) const
+{
+    for (size_t i = buffer_.size(); i > 0; i--) {
+        const Entry& entry = buffer_[i - 1];
+        if (!(entry.key < key) && !(key < entry.key)) {
+            return &entry;
+        }
+    }
+
+    Entry probe = { key, Value(), false };
+    typename std::vector<Entry>::const_iterator it =
+        std::lower_bound(sealed_.begin() + mergePos_, sealed_.end(), probe, entryLess);
+    if (it != sealed_.end() && !(key < it->key)) {
+        return &*it;
+    }
+
+    return nullptr;
+}
+
+/*
+  --------------------------------------------------
+  End implementations for the BufferedAVLTree class.
+  --------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,108 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <cstdlib>
+#include "bst.h"
+#include "avlbst.h"
+#include "concurrent_avl.h"
+
+using namespace std;
+
+// An AVLTree behind one big lock, the baseline we are replacing
+struct LockedAVLTree
+{
+    void insert(const pair<const int, int>& kv) { lock_guard<mutex> g(m); tree.insert(kv); }
+    void remove(int key) { lock_guard<mutex> g(m); tree.remove(key); }
+    bool find(int key, int& value)
+    {
+        lock_guard<mutex> g(m);
+        AVLTree<int,int>::iterator it = tree.find(key);
+        if (it == tree.end()) return false;
+        value = it->second;
+        return true;
+    }
+
+    mutex m;
+    AVLTree<int,int> tree;
+};
+
+const int KeyRange = 100000;
+
+/**
+* Runs opsPerThread mixed operations on each of threads threads and
+* returns the combined throughput in millions of ops per second. Each
+* thread checks every value it reads, so the run doubles as a stress test.
+*/
+template<typename Map>
+double run(Map& map, int threads, int opsPerThread, int readPercent, atomic<bool>& ok)
+{
+    vector<thread> workers;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    for (int t = 0; t < threads; t++) {
+        workers.push_back(thread([&map, &ok, t, opsPerThread, readPercent]() {
+            mt19937 rng(t + 1);
+            for (int i = 0; i < opsPerThread; i++) {
+                int key = rng() % KeyRange;
+                int op = rng() % 100;
+                if (op < readPercent) {
+                    int value;
+                    if (map.find(key, value) && value != key * 2) ok = false;
+                }
+                else if (op % 2 == 0) {
+                    map.insert(make_pair(key, key * 2));
+                }
+                else {
+                    map.remove(key);
+                }
+            }
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    return threads * (double)opsPerThread / elapsed.count() / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    int opsPerThread = argc > 1 ? atoi(argv[1]) : 200000;
+    int readPercent = argc > 2 ? atoi(argv[2]) : 90;
+    unsigned maxThreads = max(4u, thread::hardware_concurrency());
+
+    cout << "Mixed workload, " << readPercent << "% reads, " << opsPerThread << " ops per thread" << endl;
+    cout << setw(8) << "threads" << setw(14) << "locked Mops" << setw(18) << "concurrent Mops" << endl;
+
+    atomic<bool> ok(true);
+    for (unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+        LockedAVLTree locked;
+        ConcurrentAVLTree<int,int> concurrent;
+        for (int k = 0; k < KeyRange; k += 2) {
+            locked.insert(make_pair(k, k * 2));
+            concurrent.insert(make_pair(k, k * 2));
+        }
+
+        double lockedRate = run(locked, threads, opsPerThread, readPercent, ok);
+        double concurrentRate = run(concurrent, threads, opsPerThread, readPercent, ok);
+
+        // With the writers gone, the tree must be a strict AVL tree with
+        // every empty routing node unlinked and the keys in order
+        if (!concurrent.isValid()) {
+            cout << "CORRUPT TREE after " << threads << " threads" << endl;
+            ok = false;
+        }
+
+        cout << setw(8) << threads << setw(14) << fixed << setprecision(2) << lockedRate
+             << setw(18) << concurrentRate << endl;
+    }
+
+    cout << (ok ? "All reads consistent" : "INCONSISTENT READ") << endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,66 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "concurrent_map.h"
+
+using namespace std;
+
+
+int main()
+{
+    // Start with three shards; a low threshold lets hot shards split
+    vector<int> splits;
+    splits.push_back(1000);
+    splits.push_back(2000);
+    ConcurrentOrderedMap<int,int> cm(splits, 8, 16);
+
+    vector<thread> writers;
+    for (int t = 0; t < 4; t++) {
+        writers.push_back(thread([&cm, t]() {
+            for (int i = t; i < 3000; i += 4) {
+                cm.insert(std::make_pair(i, i * 2));
+            }
+        }));
+    }
+    for (size_t t = 0; t < writers.size(); t++) {
+        writers[t].join();
+    }
+
+    int count = 0, prev = -1;
+    bool ordered = true;
+    cm.for_each([&](const int& key, const int& value) {
+        if (key <= prev || value != key * 2) ordered = false;
+        prev = key;
+        count++;
+    });
+    cout << "Entries: " << count << (ordered ? " (ordered)" : " (NOT ordered)") << endl;
+
+    int inRange = 0;
+    cm.range_scan(990, 2010, [&](const int&, const int&) { inRange++; });
+    cout << "Entries in [990, 2010): " << inRange << endl;
+
+    int value = 0;
+    cout << (cm.find(1500, value) ? "Found 1500 -> " : "Did not find 1500 ") << value << endl;
+    cout << "Erasing 1500" << endl;
+    cm.remove(1500);
+    cout << (cm.contains(1500) ? "Found 1500" : "Did not find 1500") << endl;
+
+    // A zero threshold treats every write as contended, so the single
+    // starting shard must keep splitting as it fills
+    ConcurrentOrderedMap<int,int> hot(vector<int>(), 0, 16);
+    for (int i = 0; i < 1000; i++) {
+        hot.insert(std::make_pair(i, i));
+    }
+    int hotCount = 0;
+    prev = -1;
+    ordered = true;
+    hot.for_each([&](const int& key, const int& value) {
+        if (key <= prev || value != key) ordered = false;
+        prev = key;
+        hotCount++;
+    });
+    cout << "Hot shard " << (hot.shardCount() > 1 ? "split" : "did NOT split") << ", entries: " << hotCount
+         << (ordered ? " (ordered)" : " (NOT ordered)") << endl;
+
+    return 0;
+}
@@ -0,0 +1,1137 @@
+#ifndef CONCURRENT_AVL_H
+#define CONCURRENT_AVL_H
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <algorithm>
+
+/**
+* Epoch-based memory reclamation. Every operation on a ConcurrentAVLTree runs
+* inside a Guard, which publishes the global epoch the thread entered under.
+* Retired nodes and values are only freed once every guard active at the
+* time of retirement has exited, i.e. once the global epoch has advanced
+* twice past the retirement epoch.
+*/
+class EpochReclaimer
+{
+public:
+    static const int MaxGuards = 128;
+
+    EpochReclaimer();
+    ~EpochReclaimer();
+
+    class Guard
+    {
+    public:
+        explicit Guard(EpochReclaimer& reclaimer);
+        ~Guard();
+    private:
+        Guard(const Guard&);
+        Guard& operator=(const Guard&);
+        EpochReclaimer& reclaimer_;
+        int slot_;
+    };
+
+    template<typename T>
+    void retire(T* ptr);
+    void drain();
+
+private:
+    struct Retired
+    {
+        uint64_t epoch;
+        void* ptr;
+        void (*deleter)(void*);
+    };
+
+    template<typename T>
+    static void deleteAs(void* ptr) { delete static_cast<T*>(ptr); }
+
+    void tryAdvance();
+
+    // Each slot holds 0 when free, otherwise the epoch its guard entered under
+    struct alignas(64) Slot
+    {
+        std::atomic<uint64_t> epoch;
+    };
+
+    Slot slots_[MaxGuards];
+    std::atomic<uint64_t> global_;
+    std::mutex limboLock_;
+    std::vector<Retired> limbo_;
+};
+
+inline EpochReclaimer::EpochReclaimer() : global_(1)
+{
+    for (int i = 0; i < MaxGuards; i++) {
+        slots_[i].epoch.store(0);
+    }
+}
+
+inline EpochReclaimer::~EpochReclaimer()
+{
+    drain();
+}
+
+/**
+* Claims a free slot (starting from a per-thread hash to avoid collisions)
+* and publishes the current epoch in it. The epoch is re-read after
+* publishing so a concurrent advance cannot slip past an unpublished guard.
+*/
+inline EpochReclaimer::Guard::Guard(EpochReclaimer& reclaimer) : reclaimer_(reclaimer)
+{
+    int start = std::hash<std::thread::id>()(std::this_thread::get_id()) % MaxGuards;
+
+    for (int i = start; ; i = (i + 1) % MaxGuards) {
+        uint64_t expected = 0;
+        uint64_t epoch = reclaimer_.global_.load();
+        if (reclaimer_.slots_[i].epoch.compare_exchange_strong(expected, epoch)) {
+            while (reclaimer_.global_.load() != epoch) {
+                epoch = reclaimer_.global_.load();
+                reclaimer_.slots_[i].epoch.store(epoch);
+            }
+            slot_ = i;
+            return;
+        }
+        if (i == (start + MaxGuards - 1) % MaxGuards) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+inline EpochReclaimer::Guard::~Guard()
+{
+    reclaimer_.slots_[slot_].epoch.store(0);
+}
+
+/**
+* Schedules ptr for deletion once no guard can still observe it.
+*/
+template<typename T>
+void EpochReclaimer::retire(T* ptr)
+{
+    if (ptr == nullptr) return;
+
+    Retired r;
+    r.epoch = global_.load();
+    r.ptr = ptr;
+    r.deleter = &EpochReclaimer::deleteAs<T>;
+
+    std::lock_guard<std::mutex> guard(limboLock_);
+    limbo_.push_back(r);
+    if (limbo_.size() % 64 == 0) {
+        tryAdvance();
+    }
+}
+
+/**
+* Advances the global epoch if every active guard has caught up with it,
+* then frees whatever has become unreachable. Caller holds limboLock_.
+*/
+inline void EpochReclaimer::tryAdvance()
+{
+    uint64_t epoch = global_.load();
+    for (int i = 0; i < MaxGuards; i++) {
+        uint64_t seen = slots_[i].epoch.load();
+        if (seen != 0 && seen != epoch) {
+            return;
+        }
+    }
+    global_.compare_exchange_strong(epoch, epoch + 1);
+    epoch = global_.load();
+
+    size_t kept = 0;
+    for (size_t i = 0; i < limbo_.size(); i++) {
+        if (limbo_[i].epoch + 2 <= epoch) {
+            limbo_[i].deleter(limbo_[i].ptr);
+        }
+        else {
+            limbo_[kept++] = limbo_[i];
+        }
+    }
+    limbo_.resize(kept);
+}
+
+/**
+* Frees everything that was retired. Only safe once no guards are active.
+*/
+inline void EpochReclaimer::drain()
+{
+    std::lock_guard<std::mutex> guard(limboLock_);
+    for (size_t i = 0; i < limbo_.size(); i++) {
+        limbo_[i].deleter(limbo_[i].ptr);
+    }
+    limbo_.clear();
+}
+
+/**
+* A node of the concurrent AVL tree. All links are atomic so readers can
+* follow them without locking; version is the node's optimistic version
+* number. A node whose value is null is a routing node: it still guides
+* searches but its key is not in the map.
+*/
+template <typename Key, typename Value>
+struct ConcurrentAVLNode
+{
+    ConcurrentAVLNode(const Key& k, Value* v, ConcurrentAVLNode* p) :
+        key(k), height(1), value(v), version(0), parent(p), left(nullptr), right(nullptr)
+    {
+    }
+
+    ConcurrentAVLNode* child(int dir) const { return dir < 0 ? left.load() : right.load(); }
+    void setChild(int dir, ConcurrentAVLNode* node) { if (dir < 0) left.store(node); else right.store(node); }
+
+    const Key key;
+    std::atomic<int> height;
+    std::atomic<Value*> value;
+    std::atomic<uint64_t> version;
+    std::atomic<ConcurrentAVLNode*> parent;
+    std::atomic<ConcurrentAVLNode*> left;
+    std::atomic<ConcurrentAVLNode*> right;
+    std::mutex lock;
+};
+
+/**
+* A concurrent AVL tree using optimistic hand-over-hand validation, after
+* Bronson, Casper, Chafi and Olukotun, "A Practical Concurrent Binary Search
+* Tree" (PPoPP 2010).
+*
+* Readers take no locks: they validate each step of the descent against
+* the version number of the node they came from, and retry the step if a
+* rotation shrank that node's key range in the meantime. Writers lock only
+* the parent of the link they change, and rebalancing locks just the nodes
+* taking part in a rotation. Balance is relaxed: heights are repaired after
+* the fact by whichever thread damaged them.
+*
+* Key must be default constructible (for the root holder) and Value copy
+* constructible. Unlinked nodes and replaced values are reclaimed by epochs.
+*/
+template <typename Key, typename Value>
+class ConcurrentAVLTree
+{
+public:
+    ConcurrentAVLTree();
+    ~ConcurrentAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    bool empty() const;
+
+    // In-order traversal. Only valid while no writers are active.
+    template<typename Func>
+    void for_each(Func f) const;
+
+    // Checks key order, parent links, stored heights, AVL balance and that
+    // every routing node still has two children. Only valid while no
+    // writers are active.
+    bool isValid() const;
+
+private:
+    typedef ConcurrentAVLNode<Key, Value> CNode;
+
+    ConcurrentAVLTree(const ConcurrentAVLTree&);
+    ConcurrentAVLTree& operator=(const ConcurrentAVLTree&);
+
+    // Version number encoding: bit 0 marks an unlinked node, bit 1 is set
+    // while the node's key range is shrinking (during a rotation), and the
+    // remaining bits count completed rotations.
+    static const uint64_t Unlinked = 1;
+    static const uint64_t Shrinking = 2;
+
+    static bool isShrinkingOrUnlinked(uint64_t v) { return (v & (Shrinking | Unlinked)) != 0; }
+    static bool isUnlinked(uint64_t v) { return (v & Unlinked) != 0; }
+    static uint64_t beginShrink(uint64_t v) { return v | Shrinking; }
+    static uint64_t endShrink(uint64_t v) { return (v | Shrinking) + Shrinking; }
+
+    // Results of the attempt* helpers and nodeCondition
+    enum { Retry = -1, Absent = 0, Present = 1 };
+    enum { UnlinkRequired = -1, RebalanceRequired = -2, NothingRequired = -3 };
+
+    static int compare(const Key& k, const Key& nodeKey);
+    static int height(CNode* node) { return node ? node->height.load() : 0; }
+    static void waitUntilShrinkCompleted(CNode* node, uint64_t version);
+
+    int attemptGet(const Key& key, CNode* node, int dir, uint64_t nodeVersion, Value* out) const;
+    void update(const Key& key, const Value* newValue);
+    int attemptUpdate(const Key& key, const Value* newValue, CNode* parent, CNode* node, uint64_t nodeVersion);
+    int attemptNodeUpdate(const Value* newValue, CNode* parent, CNode* node);
+    bool attemptUnlink_nl(CNode* parent, CNode* node);
+
+    int nodeCondition(CNode* node) const;
+    void fixHeightAndRebalance(CNode* node);
+    CNode* fixHeight_nl(CNode* node);
+    CNode* rebalance_nl(CNode* nParent, CNode* n);
+    CNode* rebalanceToRight_nl(CNode* nParent, CNode* n, CNode* nL, int hR0);
+    CNode* rebalanceToLeft_nl(CNode* nParent, CNode* n, CNode* nR, int hL0);
+    CNode* rotateRight_nl(CNode* nParent, CNode* n, CNode* nL, int hR, int hLL, CNode* nLR, int hLR);
+    CNode* rotateLeft_nl(CNode* nParent, CNode* n, int hL, CNode* nR, CNode* nRL, int hRL, int hRR);
+    CNode* rotateRightOverLeft_nl(CNode* nParent, CNode* n, CNode* nL, int hR, int hLL, CNode* nLR, int hLRL);
+    CNode* rotateLeftOverRight_nl(CNode* nParent, CNode* n, int hL, CNode* nR, CNode* nRL, int hRR, int hRLR);
+
+    void clear_Helper(CNode* node);
+    template<typename Func>
+    void for_each_Helper(CNode* node, Func& f) const;
+    int isValid_Helper(CNode* node, CNode* parent, const Key* lo, const Key* hi) const;
+
+    // The real root is holder_->right; the holder never moves
+    CNode* holder_;
+    mutable EpochReclaimer epochs_;
+};
+
+/*
+  ------------------------------------------------------
+  Begin implementations for the ConcurrentAVLTree class.
+  ------------------------------------------------------
+*/
+
+template<class Key, class Value>
+ConcurrentAVLTree<Key, Value>::ConcurrentAVLTree() :
+    holder_(new CNode(Key(), nullptr, nullptr))
+{
+
+}
+
+template<class Key, class Value>
+ConcurrentAVLTree<Key, Value>::~ConcurrentAVLTree()
+{
+    clear_Helper(holder_->right.load());
+    delete holder_;
+    epochs_.drain();
+}
+
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::clear_Helper(CNode* node)
+{
+    if (node) {
+        clear_Helper(node->left.load());
+        clear_Helper(node->right.load());
+        delete node->value.load();
+        delete node;
+    }
+}
+
+template<class Key, class Value>
+int ConcurrentAVLTree<Key, Value>::compare(const Key& k, const Key& nodeKey)
+{
+    if (k < nodeKey) return -1;
+    if (nodeKey < k) return 1;
+    return 0;
+}
+
+/**
+* Spins (yielding) until a rotation that was in progress on node completes.
+* Readers never take node locks, so this is the only place they wait.
+*/
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::waitUntilShrinkCompleted(CNode* node, uint64_t version)
+{
+    if ((version & Shrinking) == 0) return;
+
+    for (int spins = 0; node->version.load() == version; spins++) {
+        if (spins > 100) std::this_thread::yield();
+    }
+}
+
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::empty() const
+{
+    return holder_->right.load() == nullptr;
+}
+
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::contains(const Key& key) const
+{
+    Value ignored;
+    return find(key, ignored);
+}
+
+/**
+* Copies the value stored under key into value, returning false if the key
+* is absent. Never blocks on a lock.
+*/
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::find(const Key& key, Value& value) const
+{
+    EpochReclaimer::Guard guard(epochs_);
+
+    while (true) {
+        CNode* right = holder_->right.load();
+        if (right == nullptr) {
+            return false;
+        }
+
+        int cmp = compare(key, right->key);
+        if (cmp == 0) {
+            Value* v = right->value.load();
+            if (v) value = *v;
+            return v != nullptr;
+        }
+
+        uint64_t version = right->version.load();
+        if (isShrinkingOrUnlinked(version)) {
+            waitUntilShrinkCompleted(right, version);
+        }
+        else if (right == holder_->right.load()) {
+            int result = attemptGet(key, right, cmp, version, &value);
+            if (result != Retry) {
+                return result == Present;
+            }
+        }
+    }
+}
+
+/**
+* One hand-over-hand step of a lookup. The link from node to its child is
+* only trusted if node's version is unchanged after the child's version has
+* been read.
+*/
+template<class Key, class Value>
+int ConcurrentAVLTree<Key, Value>::attemptGet(const Key& key, CNode* node, int dir,
+                                              uint64_t nodeVersion, Value* out) const
+{
+    while (true) {
+        CNode* child = node->child(dir);
+
+        if (child == nullptr) {
+            if (node->version.load() != nodeVersion) {
+                return Retry;
+            }
+            return Absent;
+        }
+
+        int childCmp = compare(key, child->key);
+        if (childCmp == 0) {
+            Value* v = child->value.load();
+            if (v) *out = *v;
+            return v ? Present : Absent;
+        }
+
+        uint64_t childVersion = child->version.load();
+        if (isShrinkingOrUnlinked(childVersion)) {
+            waitUntilShrinkCompleted(child, childVersion);
+            if (node->version.load() != nodeVersion) {
+                return Retry;
+            }
+        }
+        else if (child != node->child(dir)) {
+            if (node->version.load() != nodeVersion) {
+                return Retry;
+            }
+        }
+        else {
+            if (node->version.load() != nodeVersion) {
+                return Retry;
+            }
+
+            // The path to child is now validated, so node may shrink freely
+            int result = attemptGet(key, child, childCmp, childVersion, out);
+            if (result != Retry) {
+                return result;
+            }
+        }
+    }
+}
+
+/**
+* Inserts the pair, overwriting the value if the key is already present.
+*/
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    update(keyValuePair.first, &keyValuePair.second);
+}
+
+/**
+* Removes the key if present. Nodes with two children become routing
+* nodes rather than being restructured.
+*/
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::remove(const Key& key)
+{
+    update(key, nullptr);
+}
+
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::update(const Key& key, const Value* newValue)
+{
+    EpochReclaimer::Guard guard(epochs_);
+
+    while (true) {
+        CNode* right = holder_->right.load();
+
+        if (right == nullptr) {
+            if (newValue == nullptr) {
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(holder_->lock);
+            if (holder_->right.load() == nullptr) {
+                holder_->right.store(new CNode(key, new Value(*newValue), holder_));
+                holder_->height.store(2);
+                return;
+            }
+        }
+        else {
+            uint64_t version = right->version.load();
+            if (isShrinkingOrUnlinked(version)) {
+                waitUntilShrinkCompleted(right, version);
+            }
+            else if (right == holder_->right.load()) {
+                if (attemptUpdate(key, newValue, holder_, right, version) != Retry) {
+                    return;
+                }
+            }
+        }
+    }
+}
+
+template<class Key, class Value>
+int ConcurrentAVLTree<Key, Value>::attemptUpdate(const Key& key, const Value* newValue,
+                                                 CNode* parent, CNode* node, uint64_t nodeVersion)
+{
+    int cmp = compare(key, node->key);
+    if (cmp == 0) {
+        return attemptNodeUpdate(newValue, parent, node);
+    }
+
+    while (true) {
+        CNode* child = node->child(cmp);
+        if (node->version.load() != nodeVersion) {
+            return Retry;
+        }
+
+        if (child == nullptr) {
+            if (newValue == nullptr) {
+                return Absent;
+            }
+
+            CNode* damaged;
+            {
+                std::lock_guard<std::mutex> lock(node->lock);
+
+                // With node locked no new rotation can invalidate our path
+                if (node->version.load() != nodeVersion) {
+                    return Retry;
+                }
+                if (node->child(cmp) != nullptr) {
+                    // Lost a race with a concurrent insert; retry from node
+                    continue;
+                }
+
+                node->setChild(cmp, new CNode(key, new Value(*newValue), node));
+                damaged = fixHeight_nl(node);
+            }
+            fixHeightAndRebalance(damaged);
+            return Present;
+        }
+
+        uint64_t childVersion = child->version.load();
+        if (isShrinkingOrUnlinked(childVersion)) {
+            waitUntilShrinkCompleted(child, childVersion);
+        }
+        else if (child != node->child(cmp)) {
+            // re-read protected by childVersion failed, retry
+        }
+        else {
+            if (node->version.load() != nodeVersion) {
+                return Retry;
+            }
+
+            int result = attemptUpdate(key, newValue, node, child, childVersion);
+            if (result != Retry) {
+                return result;
+            }
+        }
+    }
+}
+
+/**
+* Applies an update to the node holding the key. A removal that leaves node
+* with at most one child unlinks it (locking parent, then node); any other
+* update only needs node's lock.
+*/
+template<class Key, class Value>
+int ConcurrentAVLTree<Key, Value>::attemptNodeUpdate(const Value* newValue, CNode* parent, CNode* node)
+{
+    if (newValue == nullptr && node->value.load() == nullptr) {
+        return Absent;
+    }
+
+    if (newValue == nullptr && (node->left.load() == nullptr || node->right.load() == nullptr)) {
+        Value* prev;
+        CNode* damaged;
+        {
+            std::lock_guard<std::mutex> parentLock(parent->lock);
+            if (isUnlinked(parent->version.load()) || node->parent.load() != parent) {
+                return Retry;
+            }
+
+            {
+                std::lock_guard<std::mutex> nodeLock(node->lock);
+                prev = node->value.load();
+                if (prev == nullptr) {
+                    return Absent;
+                }
+                if (!attemptUnlink_nl(parent, node)) {
+                    return Retry;
+                }
+            }
+            damaged = fixHeight_nl(parent);
+        }
+        epochs_.retire(prev);
+        epochs_.retire(node);
+        fixHeightAndRebalance(damaged);
+        return Present;
+    }
+
+    std::lock_guard<std::mutex> lock(node->lock);
+    if (isUnlinked(node->version.load())) {
+        return Retry;
+    }
+
+    // The node may have lost a child since we looked; unlink it instead
+    if (newValue == nullptr && (node->left.load() == nullptr || node->right.load() == nullptr)) {
+        return Retry;
+    }
+
+    Value* prev = node->value.exchange(newValue ? new Value(*newValue) : nullptr);
+    epochs_.retire(prev);
+
+    return Present;
+}
+
+/**
+* Splices node (which has at most one child) out from under parent. Both
+* must be locked. Does not adjust any heights.
+*/
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::attemptUnlink_nl(CNode* parent, CNode* node)
+{
+    CNode* parentL = parent->left.load();
+    CNode* parentR = parent->right.load();
+    if (parentL != node && parentR != node) {
+        return false;
+    }
+
+    CNode* left = node->left.load();
+    CNode* right = node->right.load();
+    if (left != nullptr && right != nullptr) {
+        return false;
+    }
+
+    CNode* splice = left ? left : right;
+    if (parentL == node) {
+        parent->left.store(splice);
+    }
+    else {
+        parent->right.store(splice);
+    }
+    if (splice) {
+        splice->parent.store(parent);
+    }
+
+    node->version.store(Unlinked);
+    node->value.store(nullptr);
+
+    return true;
+}
+
+/**
+* Reports what node needs: an unlink, a rotation, a new height (returned
+* as the height itself), or nothing.
+*/
+template<class Key, class Value>
+int ConcurrentAVLTree<Key, Value>::nodeCondition(CNode* node) const
+{
+    CNode* nL = node->left.load();
+    CNode* nR = node->right.load();
+
+    if ((nL == nullptr || nR == nullptr) && node->value.load() == nullptr) {
+        return UnlinkRequired;
+    }
+
+    int hN = node->height.load();
+    int hL0 = height(nL);
+    int hR0 = height(nR);
+
+    int hNRepl = 1 + std::max(hL0, hR0);
+    int bal = hL0 - hR0;
+
+    if (bal < -1 || bal > 1) {
+        return RebalanceRequired;
+    }
+
+    return hN != hNRepl ? hNRepl : NothingRequired;
+}
+
+/**
+* Repairs heights and balance from node up towards the root, stopping once
+* a node needs nothing. Any thread that damages a node takes responsibility
+* for repairing it, so a NothingRequired answer is always safe.
+*
+* A rotation can leave more than one of its nodes damaged but hands back
+* only the deepest, and the walk up from there can stop early. Every node
+* the rotation touched, and the parent above them, is kept pending and
+* looked at again once the walk ends.
+*/
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::fixHeightAndRebalance(CNode* node)
+{
+    std::vector<CNode*> pending;
+    while (true) {
+        if (node == nullptr || node->parent.load() == nullptr ||
+            nodeCondition(node) == NothingRequired || isUnlinked(node->version.load())) {
+            if (pending.empty()) {
+                return;
+            }
+            node = pending.back();
+            pending.pop_back();
+            continue;
+        }
+
+        int condition = nodeCondition(node);
+        if (condition != UnlinkRequired && condition != RebalanceRequired) {
+            std::lock_guard<std::mutex> lock(node->lock);
+            node = fixHeight_nl(node);
+        }
+        else {
+            CNode* nParent = node->parent.load();
+            std::lock_guard<std::mutex> parentLock(nParent->lock);
+            if (!isUnlinked(nParent->version.load()) && node->parent.load() == nParent) {
+                std::lock_guard<std::mutex> nodeLock(node->lock);
+                CNode* damaged = rebalance_nl(nParent, node);
+                CNode* top = node->parent.load();
+                if (top != nParent) {
+                    pending.push_back(nParent);
+                    pending.push_back(top);
+                    pending.push_back(top->left.load());
+                    pending.push_back(top->right.load());
+                }
+                node = damaged;
+            }
+        }
+    }
+}
+
+/**
+* Fixes the height of a locked node, returning the next damaged node this
+* thread is responsible for, or null if none.
+*/
+template<class Key, class Value>
+ConcurrentAVLNode<Key, Value>* ConcurrentAVLTree<Key, Value>::fixHeight_nl(CNode* node)
+{
+    int c = nodeCondition(node);
+    switch (c) {
+        case RebalanceRequired:
+        case UnlinkRequired:
+            return node;
+        case NothingRequired:
+            return nullptr;
+        default:
+            node->height.store(c);
+            // The children are not locked; if one changed height after we
+            // read it, its own repair may have run before our store, so
+            // look again before moving on
+            if (nodeCondition(node) != NothingRequired) {
+                return node;
+            }
+            return node->parent.load();
+    }
+}
+
+/**
+* nParent and n are locked on entry. Unlinks n if it is a redundant routing
+* node, otherwise rotates or fixes its height. Returns a damaged node.
+*/
+template<class Key, class Value>
+ConcurrentAVLNode<Key, Value>* ConcurrentAVLTree<Key, Value>::rebalance_nl(CNode* nParent, CNode* n)
+{
+    CNode* nL = n->left.load();
+    CNode* nR = n->right.load();
+
+    if ((nL == nullptr || nR == nullptr) && n->value.load() == nullptr) {
+        if (attemptUnlink_nl(nParent, n)) {
+            epochs_.retire(n);
+            return fixHeight_nl(nParent);
+        }
+        return n;
+    }
+
+    int hN = n->height.load();
+    int hL0 = height(nL);
+    int hR0 = height(nR);
+    int hNRepl = 1 + std::max(hL0, hR0);
+    int bal = hL0 - hR0;
+
+    if (bal > 1) {
+        return rebalanceToRight_nl(nParent, n, nL, hR0);
+    }
+    else if (bal < -1) {
+        return rebalanceToLeft_nl(nParent, n, nR, hL0);
+    }
+    else if (hNRepl != hN) {
+        n->height.store(hNRepl);
+        if (nodeCondition(n) != NothingRequired) {
+            return n;
+        }
+        return fixHeight_nl(nParent);
+    }
+    return nullptr;
+}
+
+/**
+* n's left side is too tall: rotate right, or right-over-left if nL leans
+* right. Locks nL (and nLR for the double rotation).
+*/
+template<class Key, class Value>
+ConcurrentAVLNode<Key, Value>* ConcurrentAVLTree<Key, Value>::rebalanceToRight_nl(CNode* nParent, CNode* n,
+                                                                                  CNode* nL, int hR0)
+{
+    std::lock_guard<std::mutex> leftLock(nL->lock);
+
+    int hL = nL->height.load();
+    if (hL - hR0 <= 1) {
+        return n;
+    }
+
+    CNode* nLR = nL->right.load();
+    int hLL0 = height(nL->left.load());
+    int hLR0 = height(nLR);
+    if (hLL0 >= hLR0) {
+        return rotateRight_nl(nParent, n, nL, hR0, hLL0, nLR, hLR0);
+    }
+
+    {
+        std::lock_guard<std::mutex> leftRightLock(nLR->lock);
+
+        int hLR = nLR->height.load();
+        if (hLL0 >= hLR) {
+            return rotateRight_nl(nParent, n, nL, hR0, hLL0, nLR, hLR);
+        }
+
+        // nL may come out unbalanced or as a routing node with one child;
+        // the rotation reports it and the caller repairs it afterwards
+        int hLRL = height(nLR->left.load());
+        return rotateRightOverLeft_nl(nParent, n, nL, hR0, hLL0, nLR, hLRL);
+    }
+}
+
+template<class Key, class Value>
+ConcurrentAVLNode<Key, Value>* ConcurrentAVLTree<Key, Value>::rebalanceToLeft_nl(CNode* nParent, CNode* n,
+                                                                                 CNode* nR, int hL0)
+{
+    std::lock_guard<std::mutex> rightLock(nR->lock);
+
+    int hR = nR->height.load();
+    if (hL0 - hR >= -1) {
+        return n;
+    }
+
+    CNode* nRL = nR->left.load();
+    int hRL0 = height(nRL);
+    int hRR0 = height(nR->right.load());
+    if (hRR0 >= hRL0) {
+        return rotateLeft_nl(nParent, n, hL0, nR, nRL, hRL0, hRR0);
+    }
+
+    {
+        std::lock_guard<std::mutex> rightLeftLock(nRL->lock);
+
+        int hRL = nRL->height.load();
+        if (hRR0 >= hRL) {
+            return rotateLeft_nl(nParent, n, hL0, nR, nRL, hRL, hRR0);
+        }
+
+        int hRLR = height(nRL->right.load());
+        return rotateLeftOverRight_nl(nParent, n, hL0, nR, nRL, hRR0, hRLR);
+    }
+}
+
+/**
+* Same shape as AVLTree::rotateRight, but n is marked as shrinking for the
+* duration so optimistic readers passing through it retry. Heights come from
+* the caller's locked snapshot.
+*/
+template<class Key, class Value>
+ConcurrentAVLNode<Key, Value>* ConcurrentAVLTree<Key, Value>::rotateRight_nl(CNode* nParent, CNode* n, CNode* nL,
+                                                                            int hR, int hLL, CNode* nLR, int hLR)
+{
+    uint64_t nodeVersion = n->version.load();
+    CNode* nPL = nParent->left.load();
+    n->version.store(beginShrink(nodeVersion));
+
+    n->left.store(nLR);
+    if (nLR) {
+        nLR->parent.store(n);
+    }
+
+    nL->right.store(n);
+    n->parent.store(nL);
+
+    if (nPL == n) {
+        nParent->left.store(nL);
+    }
+    else {
+        nParent->right.store(nL);
+    }
+    nL->parent.store(nParent);
+
+    int hNRepl = 1 + std::max(hLR, hR);
+    n->height.store(hNRepl);
+    nL->height.store(1 + std::max(hLL, hNRepl));
+
+    n->version.store(endShrink(nodeVersion));
+
+    // n is the deepest damaged node; fix what we can with the locks we hold.
+    // nLR and nLL are not locked, so their heights are re-read rather than
+    // trusted from the snapshot: a thread that just grew nLR may already
+    // have walked up from nL and found nothing to do.
+    if (nodeCondition(n) != NothingRequired) {
+        return n;
+    }
+    if (nodeCondition(nL) != NothingRequired) {
+        return nL;
+    }
+
+    return fixHeight_nl(nParent);
+}
+
+template<class Key, class Value>
+ConcurrentAVLNode<Key, Value>* ConcurrentAVLTree<Key, Value>::rotateLeft_nl(CNode* nParent, CNode* n, int hL,
+                                                                           CNode* nR, CNode* nRL, int hRL, int hRR)
+{
+    uint64_t nodeVersion = n->version.load();
+    CNode* nPL = nParent->left.load();
+    n->version.store(beginShrink(nodeVersion));
+
+    n->right.store(nRL);
+    if (nRL) {
+        nRL->parent.store(n);
+    }
+
+    nR->left.store(n);
+    n->parent.store(nR);
+
+    if (nPL == n) {
+        nParent->left.store(nR);
+    }
+    else {
+        nParent->right.store(nR);
+    }
+    nR->parent.store(nParent);
+
+    int hNRepl = 1 + std::max(hL, hRL);
+    n->height.store(hNRepl);
+    nR->height.store(1 + std::max(hNRepl, hRR));
+
+    n->version.store(endShrink(nodeVersion));
+
+    if (nodeCondition(n) != NothingRequired) {
+        return n;
+    }
+    if (nodeCondition(nR) != NothingRequired) {
+        return nR;
+    }
+
+    return fixHeight_nl(nParent);
+}
+
+/**
+* Double rotation: nLR becomes the subtree root with nL and n as children.
+* Both n and nL have their key ranges shrink.
+*/
+template<class Key, class Value>
+ConcurrentAVLNode<Key, Value>* ConcurrentAVLTree<Key, Value>::rotateRightOverLeft_nl(CNode* nParent, CNode* n, CNode* nL,
+                                                                                    int hR, int hLL, CNode* nLR, int hLRL)
+{
+    uint64_t nodeVersion = n->version.load();
+    uint64_t leftVersion = nL->version.load();
+
+    CNode* nPL = nParent->left.load();
+    CNode* nLRL = nLR->left.load();
+    CNode* nLRR = nLR->right.load();
+    int hLRR = height(nLRR);
+
+    n->version.store(beginShrink(nodeVersion));
+    nL->version.store(beginShrink(leftVersion));
+
+    n->left.store(nLRR);
+    if (nLRR) {
+        nLRR->parent.store(n);
+    }
+
+    nL->right.store(nLRL);
+    if (nLRL) {
+        nLRL->parent.store(nL);
+    }
+
+    nLR->left.store(nL);
+    nL->parent.store(nLR);
+    nLR->right.store(n);
+    n->parent.store(nLR);
+
+    if (nPL == n) {
+        nParent->left.store(nLR);
+    }
+    else {
+        nParent->right.store(nLR);
+    }
+    nLR->parent.store(nParent);
+
+    int hNRepl = 1 + std::max(hLRR, hR);
+    n->height.store(hNRepl);
+    int hLRepl = 1 + std::max(hLL, hLRL);
+    nL->height.store(hLRepl);
+    nLR->height.store(1 + std::max(hLRepl, hNRepl));
+
+    n->version.store(endShrink(nodeVersion));
+    nL->version.store(endShrink(leftVersion));
+
+    if (nodeCondition(n) != NothingRequired) {
+        return n;
+    }
+    if (nodeCondition(nL) != NothingRequired) {
+        return nL;
+    }
+    if (nodeCondition(nLR) != NothingRequired) {
+        return nLR;
+    }
+
+    return fixHeight_nl(nParent);
+}
+
+template<class Key, class Value>
+ConcurrentAVLNode<Key, Value>* ConcurrentAVLTree<Key, Value>::rotateLeftOverRight_nl(CNode* nParent, CNode* n, int hL,
+                                                                                    CNode* nR, CNode* nRL, int hRR, int hRLR)
+{
+    uint64_t nodeVersion = n->version.load();
+    uint64_t rightVersion = nR->version.load();
+
+    CNode* nPL = nParent->left.load();
+    CNode* nRLL = nRL->left.load();
+    CNode* nRLR = nRL->right.load();
+    int hRLL = height(nRLL);
+
+    n->version.store(beginShrink(nodeVersion));
+    nR->version.store(beginShrink(rightVersion));
+
+    n->right.store(nRLL);
+    if (nRLL) {
+        nRLL->parent.store(n);
+    }
+
+    nR->left.store(nRLR);
+    if (nRLR) {
+        nRLR->parent.store(nR);
+    }
+
+    nRL->right.store(nR);
+    nR->parent.store(nRL);
+    nRL->left.store(n);
+    n->parent.store(nRL);
+
+    if (nPL == n) {
+        nParent->left.store(nRL);
+    }
+    else {
+        nParent->right.store(nRL);
+    }
+    nRL->parent.store(nParent);
+
+    int hNRepl = 1 + std::max(hL, hRLL);
+    n->height.store(hNRepl);
+    int hRRepl = 1 + std::max(hRLR, hRR);
+    nR->height.store(hRRepl);
+    nRL->height.store(1 + std::max(hNRepl, hRRepl));
+
+    n->version.store(endShrink(nodeVersion));
+    nR->version.store(endShrink(rightVersion));
+
+    if (nodeCondition(n) != NothingRequired) {
+        return n;
+    }
+    if (nodeCondition(nR) != NothingRequired) {
+        return nR;
+    }
+    if (nodeCondition(nRL) != NothingRequired) {
+        return nRL;
+    }
+
+    return fixHeight_nl(nParent);
+}
+
+/**
+* Visits every present key in order as f(key, value).
+*/
+template<class Key, class Value>
+template<typename Func>
+void ConcurrentAVLTree<Key, Value>::for_each(Func f) const
+{
+    for_each_Helper(holder_->right.load(), f);
+}
+
+template<class Key, class Value>
+template<typename Func>
+void ConcurrentAVLTree<Key, Value>::for_each_Helper(CNode* node, Func& f) const
+{
+    if (node) {
+        for_each_Helper(node->left.load(), f);
+        Value* v = node->value.load();
+        if (v) f(node->key, *v);
+        for_each_Helper(node->right.load(), f);
+    }
+}
+
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::isValid() const
+{
+    return isValid_Helper(holder_->right.load(), holder_, nullptr, nullptr) >= 0;
+}
+
+/**
+* Returns the height of node's subtree, or -1 if anything in it is out of
+* order or out of shape. Keys must lie strictly between lo and hi (NULL
+* bounds are open).
+*/
+template<class Key, class Value>
+int ConcurrentAVLTree<Key, Value>::isValid_Helper(CNode* node, CNode* parent,
+                                                  const Key* lo, const Key* hi) const
+{
+    if (node == nullptr) {
+        return 0;
+    }
+    if (node->parent.load() != parent || node->version.load() & (Shrinking | Unlinked)) {
+        return -1;
+    }
+    if ((lo && !(*lo < node->key)) || (hi && !(node->key < *hi))) {
+        return -1;
+    }
+
+    CNode* nL = node->left.load();
+    CNode* nR = node->right.load();
+    if (node->value.load() == nullptr && (nL == nullptr || nR == nullptr)) {
+        return -1;
+    }
+
+    int hL = isValid_Helper(nL, node, lo, &node->key);
+    int hR = isValid_Helper(nR, node, &node->key, hi);
+    if (hL < 0 || hR < 0 || hL - hR < -1 || hL - hR > 1) {
+        return -1;
+    }
+    int h = 1 + std::max(hL, hR);
+    return node->height.load() == h ? h : -1;
+}
+
+/*
+  ----------------------------------------------------
+  End implementations for the ConcurrentAVLTree class.
+  ----------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,306 @@
+#ifndef CONCURRENT_MAP_H
+#define CONCURRENT_MAP_H
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <algorithm>
+#include "avlbst.h"
+
+/**
+* An ordered map that partitions the key space into contiguous range shards.
+* Each shard is an AVLTree guarded by its own reader-writer lock, so
+* operations on keys in different shards never wait on each other.
+*
+* Every failed attempt to take a shard lock bumps that shard's contention
+* counter. Once a shard crosses the split threshold it is split at its
+* median key, spreading the hot range over two locks.
+*/
+template <typename Key, typename Value>
+class ConcurrentOrderedMap
+{
+public:
+    explicit ConcurrentOrderedMap(const std::vector<Key>& splitPoints = std::vector<Key>(),
+                                  uint64_t splitThreshold = 1024,
+                                  size_t minSplitSize = 64);
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    size_t shardCount() const;
+
+    // Ordered traversals across shard boundaries. f is called as
+    // f(key, value) while the owning shard is read-locked.
+    template<typename Func>
+    void for_each(Func f) const;
+    template<typename Func>
+    void range_scan(const Key& lo, const Key& hi, Func f) const;
+
+private:
+    struct Shard
+    {
+        Shard() : contention(0) { }
+
+        AVLTree<Key, Value> tree;
+        mutable std::shared_mutex lock;
+        mutable std::atomic<uint64_t> contention;
+    };
+
+    size_t shardIndex(const Key& key) const;
+    void lockShared(Shard* shard) const;
+    void lockExclusive(Shard* shard) const;
+    void maybeSplit(Shard* shard);
+    void splitShard(size_t index);
+
+    // Shard i owns the keys in [bounds_[i-1], bounds_[i]); the first and
+    // last shards are unbounded below and above respectively.
+    std::vector<std::unique_ptr<Shard> > shards_;
+    std::vector<Key> bounds_;
+    mutable std::shared_mutex directory_;
+    uint64_t splitThreshold_;
+    size_t minSplitSize_;
+};
+
+/*
+  --------------------------------------------------------
+  Begin implementations for the ConcurrentOrderedMap class.
+  --------------------------------------------------------
+*/
+
+/**
+* Creates one shard per range delimited by the (sorted, distinct) split points.
+*/
+template<class Key, class Value>
+ConcurrentOrderedMap<Key, Value>::ConcurrentOrderedMap(const std::vector<Key>& splitPoints,
+                                                       uint64_t splitThreshold,
+                                                       size_t minSplitSize) :
+    bounds_(splitPoints),
+    splitThreshold_(splitThreshold),
+    minSplitSize_(minSplitSize)
+{
+    std::sort(bounds_.begin(), bounds_.end());
+    bounds_.erase(std::unique(bounds_.begin(), bounds_.end()), bounds_.end());
+
+    for (size_t i = 0; i <= bounds_.size(); i++) {
+        shards_.push_back(std::unique_ptr<Shard>(new Shard()));
+    }
+}
+
+template<class Key, class Value>
+void ConcurrentOrderedMap<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    Shard* shard;
+    {
+        std::shared_lock<std::shared_mutex> dir(directory_);
+        shard = shards_[shardIndex(keyValuePair.first)].get();
+
+        lockExclusive(shard);
+        shard->tree.insert(keyValuePair);
+        shard->lock.unlock();
+    }
+    maybeSplit(shard);
+}
+
+template<class Key, class Value>
+void ConcurrentOrderedMap<Key, Value>::remove(const Key& key)
+{
+    Shard* shard;
+    {
+        std::shared_lock<std::shared_mutex> dir(directory_);
+        shard = shards_[shardIndex(key)].get();
+
+        lockExclusive(shard);
+        shard->tree.remove(key);
+        shard->lock.unlock();
+    }
+    maybeSplit(shard);
+}
+
+/**
+* Copies the value stored under key into value. Returns false (and leaves
+* value untouched) if the key is absent. A copy is returned rather than a
+* reference since the shard lock is released before returning.
+*/
+template<class Key, class Value>
+bool ConcurrentOrderedMap<Key, Value>::find(const Key& key, Value& value) const
+{
+    std::shared_lock<std::shared_mutex> dir(directory_);
+    Shard* shard = shards_[shardIndex(key)].get();
+
+    lockShared(shard);
+    typename AVLTree<Key, Value>::iterator it = shard->tree.find(key);
+    bool found = it != shard->tree.end();
+    if (found) {
+        value = it->second;
+    }
+    shard->lock.unlock_shared();
+
+    return found;
+}
+
+template<class Key, class Value>
+bool ConcurrentOrderedMap<Key, Value>::contains(const Key& key) const
+{
+    std::shared_lock<std::shared_mutex> dir(directory_);
+    Shard* shard = shards_[shardIndex(key)].get();
+
+    lockShared(shard);
+    bool found = shard->tree.find(key) != shard->tree.end();
+    shard->lock.unlock_shared();
+
+    return found;
+}
+
+template<class Key, class Value>
+size_t ConcurrentOrderedMap<Key, Value>::shardCount() const
+{
+    std::shared_lock<std::shared_mutex> dir(directory_);
+    return shards_.size();
+}
+
+/**
+* Visits every entry in key order. The shard directory is held shared for
+* the whole walk, so no shard is split underneath the traversal.
+*/
+template<class Key, class Value>
+template<typename Func>
+void ConcurrentOrderedMap<Key, Value>::for_each(Func f) const
+{
+    std::shared_lock<std::shared_mutex> dir(directory_);
+
+    for (size_t i = 0; i < shards_.size(); i++) {
+        Shard* shard = shards_[i].get();
+        std::shared_lock<std::shared_mutex> guard(shard->lock);
+
+        for (typename AVLTree<Key, Value>::iterator it = shard->tree.begin(); it != shard->tree.end(); ++it) {
+            f(it->first, it->second);
+        }
+    }
+}
+
+/**
+* Visits every entry with lo <= key < hi in key order, starting at the shard
+* owning lo and stopping at the first shard that begins at or after hi.
+*/
+template<class Key, class Value>
+template<typename Func>
+void ConcurrentOrderedMap<Key, Value>::range_scan(const Key& lo, const Key& hi, Func f) const
+{
+    std::shared_lock<std::shared_mutex> dir(directory_);
+
+    for (size_t i = shardIndex(lo); i < shards_.size(); i++) {
+        if (i > 0 && !(bounds_[i - 1] < hi)) {
+            break;
+        }
+
+        Shard* shard = shards_[i].get();
+        std::shared_lock<std::shared_mutex> guard(shard->lock);
+
+        typename AVLTree<Key, Value>::iterator it = shard->tree.lower_bound(lo);
+        for (; it != shard->tree.end() && it->first < hi; ++it) {
+            f(it->first, it->second);
+        }
+    }
+}
+
+/**
+* Returns the index of the shard owning key. The caller must hold directory_.
+*/
+template<class Key, class Value>
+size_t ConcurrentOrderedMap<Key, Value>::shardIndex(const Key& key) const
+{
+    return std::upper_bound(bounds_.begin(), bounds_.end(), key) - bounds_.begin();
+}
+
+/**
+* Takes the shard's lock in shared mode, counting a contention event if
+* the lock was not immediately available.
+*/
+template<class Key, class Value>
+void ConcurrentOrderedMap<Key, Value>::lockShared(Shard* shard) const
+{
+    if (!shard->lock.try_lock_shared()) {
+        shard->contention.fetch_add(1, std::memory_order_relaxed);
+        shard->lock.lock_shared();
+    }
+}
+
+template<class Key, class Value>
+void ConcurrentOrderedMap<Key, Value>::lockExclusive(Shard* shard) const
+{
+    if (!shard->lock.try_lock()) {
+        shard->contention.fetch_add(1, std::memory_order_relaxed);
+        shard->lock.lock();
+    }
+}
+
+/**
+* Splits the given shard if it has crossed the contention threshold. Must be
+* called without holding directory_, since splitting takes it exclusively.
+*/
+template<class Key, class Value>
+void ConcurrentOrderedMap<Key, Value>::maybeSplit(Shard* shard)
+{
+    if (shard->contention.load(std::memory_order_relaxed) < splitThreshold_) {
+        return;
+    }
+
+    std::unique_lock<std::shared_mutex> dir(directory_);
+
+    // Another writer may have split (or be done splitting) this shard already
+    for (size_t i = 0; i < shards_.size(); i++) {
+        if (shards_[i].get() == shard) {
+            if (shard->contention.load(std::memory_order_relaxed) >= splitThreshold_) {
+                splitShard(i);
+            }
+            return;
+        }
+    }
+}
+
+/**
+* Moves the upper half of shard index into a new shard inserted right after
+* it. The caller holds directory_ exclusively, so no other thread can be
+* inside any shard; the move is kept O(n) so that pause stays short: the
+* upper half is built with one sorted insertBatch and cut from the old
+* tree with a single range erase.
+*/
+template<class Key, class Value>
+void ConcurrentOrderedMap<Key, Value>::splitShard(size_t index)
+{
+    Shard* shard = shards_[index].get();
+    shard->contention.store(0, std::memory_order_relaxed);
+
+    size_t count = 0;
+    for (typename AVLTree<Key, Value>::iterator it = shard->tree.begin(); it != shard->tree.end(); ++it) {
+        count++;
+    }
+    if (count < minSplitSize_ || count < 2) {
+        return;
+    }
+
+    typename AVLTree<Key, Value>::iterator median = shard->tree.begin();
+    for (size_t i = 0; i < count / 2; i++) {
+        ++median;
+    }
+
+    std::unique_ptr<Shard> upper(new Shard());
+    std::vector<std::pair<Key, Value> > moved(median, shard->tree.end());
+    upper->tree.insertBatch(moved.begin(), moved.end());
+    shard->tree.erase(median, shard->tree.end());
+
+    bounds_.insert(bounds_.begin() + index, moved.front().first);
+    shards_.insert(shards_.begin() + index + 1, std::move(upper));
+}
+
+/*
+  ------------------------------------------------------
+  End implementations for the ConcurrentOrderedMap class.
+  ------------------------------------------------------
+*/
+
+#endif
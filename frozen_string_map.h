@@ -0,0 +1,234 @@
+#ifndef FROZEN_STRING_MAP_H
+#define FROZEN_STRING_MAP_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+/**
+* A read-only map from strings to values, stored front-coded. Keys are
+* laid out in sorted order in one byte buffer, grouped into blocks of
+* blockSize keys. The first key of each block is stored whole; every
+* other key stores only the length it shares with the key before it and
+* the remaining suffix. Sorted keys share long prefixes, so this is far
+* more compact than a tree of string nodes.
+*
+* A lookup binary-searches the block heads and then decodes at most one
+* block. The map is built once from a sorted run, for instance by
+* iterating a BinarySearchTree, and cannot be modified afterwards.
+*/
+template <typename Value>
+class FrozenStringMap
+{
+public:
+    // Builds from pairs sorted by key with no repeats; the key type only
+    // has to convert explicitly to std::string
+    template<typename InputIt>
+    FrozenStringMap(InputIt first, InputIt last, size_t blockSize = 16);
+
+    size_t size() const;
+    bool empty() const;
+    bool find(const std::string& key, Value& value) const;
+    bool contains(const std::string& key) const;
+    size_t memory() const;
+
+    // Ordered traversal; f is called as f(key, value)
+    template<typename Func>
+    void for_each(Func f) const;
+
+private:
+    static void putLength(std::vector<char>& out, size_t length);
+    static size_t getLength(const char*& in);
+    size_t locate(const std::string& key) const;
+    static const char* decode(const char* in, bool head, std::string& key);
+
+    std::vector<char> keys_;        // front-coded keys, in order
+    std::vector<size_t> blocks_;    // offset of each block head in keys_
+    std::vector<Value> values_;
+    size_t blockSize_;
+};
+
+/*
+  ----------------------------------------------------
+  Begin implementations for the FrozenStringMap class.
+  ----------------------------------------------------
+*/
+
+template<class Value>
+template<typename InputIt>
+FrozenStringMap<Value>::FrozenStringMap(InputIt first, InputIt last, size_t blockSize) :
+    blockSize_(blockSize ? blockSize : 1)
+{
+    std::string prev;
+    for (; first != last; ++first) {
+        std::string key(first->first);
+        size_t shared = 0;
+
+        if (values_.size() % blockSize_ == 0) {
+            blocks_.push_back(keys_.size());
+        }
+        else {
+            while (shared < prev.size() && shared < key.size() && prev[shared] == key[shared]) {
+                shared++;
+            }
+            putLength(keys_, shared);
+        }
+        putLength(keys_, key.size() - shared);
+        keys_.insert(keys_.end(), key.begin() + shared, key.end());
+
+        values_.push_back(first->second);
+        prev.swap(key);
+    }
+    keys_.shrink_to_fit();
+    blocks_.shrink_to_fit();
+    values_.shrink_to_fit();
+}
+
+template<class Value>
+size_t FrozenStringMap<Value>::size() const
+{
+    return values_.size();
+}
+
+template<class Value>
+bool FrozenStringMap<Value>::empty() const
+{
+    return values_.empty();
+}
+
+/**
+* Copies the value stored under key into value. Returns false (and
+* leaves value untouched) if the key is absent.
+*/
+template<class Value>
+bool FrozenStringMap<Value>::find(const std::string& key, Value& value) const
+{
+    size_t index = locate(key);
+    if (index == values_.size()) {
+        return false;
+    }
+    value = values_[index];
+    return true;
+}
+
+template<class Value>
+bool FrozenStringMap<Value>::contains(const std::string& key) const
+{
+    return locate(key) != values_.size();
+}
+
+/**
+* Returns the bytes taken by the encoded keys, the block index and the
+* values.
+*/
+template<class Value>
+size_t FrozenStringMap<Value>::memory() const
+{
+    return keys_.size() + blocks_.size() * sizeof(size_t) + values_.size() * sizeof(Value);
+}
+
+template<class Value>
+template<typename Func>
+void FrozenStringMap<Value>::for_each(Func f) const
+{
+    std::string key;
+    const char* in = keys_.data();
+    for (size_t i = 0; i < values_.size(); i++) {
+        in = decode(in, i % blockSize_ == 0, key);
+        f(static_cast<const std::string&>(key), values_[i]);
+    }
+}
+
+/**
+* Lengths are stored as base-128 varints, low bits first.
+*/
+template<class Value>
+void FrozenStringMap<Value>::putLength(std::vector<char>& out, size_t length)
+{
+    while (length >= 0x80) {
+        out.push_back(char((length & 0x7f) | 0x80));
+        length >>= 7;
+    }
+    out.push_back(char(length));
+}
+
+template<class Value>
+size_t FrozenStringMap<Value>::getLength(const char*& in)
+{
+    size_t length = 0;
+    for (unsigned shift = 0; ; shift += 7) {
+        unsigned char byte = (unsigned char)*in++;
+        length |= size_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return length;
+        }
+    }
+}
+
+/**
+* Decodes the entry at in on top of key, which must hold the previous key
+* unless the entry is a block head. Returns the next entry.
+*/
+template<class Value>
+const char* FrozenStringMap<Value>::decode(const char* in, bool head, std::string& key)
+{
+    size_t shared = head ? 0 : getLength(in);
+    size_t length = getLength(in);
+    key.resize(shared);
+    key.append(in, length);
+    return in + length;
+}
+
+/**
+* Returns the index of key, or size() if it is absent. The binary search
+* compares block heads in place without copying them out.
+*/
+template<class Value>
+size_t FrozenStringMap<Value>::locate(const std::string& key) const
+{
+    size_t lo = 0;
+    size_t hi = blocks_.size();
+    while (lo < hi) { //Find the last block whose head is <= key
+        size_t mid = lo + (hi - lo) / 2;
+        const char* in = keys_.data() + blocks_[mid];
+        size_t length = getLength(in);
+        int cmp = key.compare(0, std::string::npos, in, length);
+        if (cmp == 0) {
+            return mid * blockSize_;
+        }
+        if (cmp < 0) {
+            hi = mid;
+        }
+        else {
+            lo = mid + 1;
+        }
+    }
+    if (lo == 0) {
+        return values_.size();
+    }
+
+    size_t block = lo - 1;
+    size_t index = block * blockSize_;
+    size_t end = std::min(index + blockSize_, values_.size());
+    std::string curr;
+    const char* in = decode(keys_.data() + blocks_[block], true, curr);
+    for (index++; index < end; index++) {
+        in = decode(in, false, curr);
+        int cmp = curr.compare(key);
+        if (cmp == 0) {
+            return index;
+        }
+        if (cmp > 0) {
+            break;
+        }
+    }
+    return values_.size();
+}
+
+/*
+  --------------------------------------------------
+  End implementations for the FrozenStringMap class.
+  --------------------------------------------------
+*/
+
+#endif
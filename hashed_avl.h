@@ -0,0 +1,316 @@
+#ifndef HASHED_AVL_H
+#define HASHED_AVL_H
+
+#include <vector>
+#include <functional>
+#include "avlbst.h"
+
+/**
+* An AVLTree with an intrusive hash index over its nodes. The tree owns
+* every node; the index is an open-addressing table of node pointers, so
+* each entry is stored once and the index costs one pointer per slot.
+*
+* find, count, operator[] and remove go through the index in expected
+* O(1). Ordered operations (lower_bound, upper_bound, iteration, range
+* erase) use the tree as before. The table uses linear probing with
+* backward-shift deletion and doubles past a load of 3/4, so it holds
+* between 4/3 and 8/3 slots per entry.
+*/
+template <typename Key, typename Value, typename Hash = std::hash<Key> >
+class HashedAVLTree : public AVLTree<Key, Value>
+{
+public:
+    typedef typename BinarySearchTree<Key, Value>::iterator iterator;
+
+    HashedAVLTree();
+    HashedAVLTree(const HashedAVLTree<Key, Value, Hash>& other);
+    HashedAVLTree(HashedAVLTree<Key, Value, Hash>&& other);
+    HashedAVLTree<Key, Value, Hash>& operator=(const HashedAVLTree<Key, Value, Hash>& other);
+    HashedAVLTree<Key, Value, Hash>& operator=(HashedAVLTree<Key, Value, Hash>&& other);
+
+    using BinarySearchTree<Key, Value>::insert;
+    virtual void remove(const Key& key) override;
+
+    size_t size() const;
+    iterator find(const Key& key) const;
+    size_t count(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+protected:
+    virtual void attachNode(Node<Key, Value>* node, Node<Key, Value>* parent) override;
+    virtual void unlinkNode(Node<Key, Value>* node) override;
+    virtual void eraseNodes(Node<Key, Value>* first, Node<Key, Value>* last) override;
+    virtual void nodesReplaced() override;
+
+    size_t home(const Key& key) const;
+    Node<Key, Value>* indexFind(const Key& key) const;
+    void indexInsert(Node<Key, Value>* node);
+    void indexErase(Node<Key, Value>* node);
+    void reindex(size_t count);
+
+    std::vector<Node<Key, Value>*> slots_;    // NULL marks an empty slot
+    size_t shift_;                            // home slot is the top bits of the hash
+    size_t indexed_;
+    Hash hasher_;
+};
+
+/*
+  --------------------------------------------------
+  Begin implementations for the HashedAVLTree class.
+  --------------------------------------------------
+*/
+
+template<class Key, class Value, class Hash>
+HashedAVLTree<Key, Value, Hash>::HashedAVLTree() :
+    AVLTree<Key, Value>(),
+    slots_(8, nullptr),
+    shift_(64 - 3),
+    indexed_(0)
+{
+
+}
+
+template<class Key, class Value, class Hash>
+HashedAVLTree<Key, Value, Hash>::HashedAVLTree(const HashedAVLTree<Key, Value, Hash>& other) :
+    AVLTree<Key, Value>(other),
+    shift_(0),
+    indexed_(0),
+    hasher_(other.hasher_)
+{
+    reindex(other.indexed_);
+}
+
+template<class Key, class Value, class Hash>
+HashedAVLTree<Key, Value, Hash>::HashedAVLTree(HashedAVLTree<Key, Value, Hash>&& other) :
+    AVLTree<Key, Value>(std::move(other)),
+    slots_(std::move(other.slots_)),
+    shift_(other.shift_),
+    indexed_(other.indexed_),
+    hasher_(other.hasher_)
+{
+    other.slots_.assign(8, nullptr);
+    other.shift_ = 64 - 3;
+    other.indexed_ = 0;
+}
+
+template<class Key, class Value, class Hash>
+HashedAVLTree<Key, Value, Hash>&
+HashedAVLTree<Key, Value, Hash>::operator=(const HashedAVLTree<Key, Value, Hash>& other)
+{
+    if (this != &other) {
+        hasher_ = other.hasher_;
+        AVLTree<Key, Value>::operator=(other);
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Hash>
+HashedAVLTree<Key, Value, Hash>&
+HashedAVLTree<Key, Value, Hash>::operator=(HashedAVLTree<Key, Value, Hash>&& other)
+{
+    if (this != &other) {
+        std::swap(hasher_, other.hasher_);
+        AVLTree<Key, Value>::operator=(std::move(other));
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Hash>
+void HashedAVLTree<Key, Value, Hash>::remove(const Key& key)
+{
+    if (this->stage(key, nullptr)) {
+        return;
+    }
+
+    Node<Key, Value>* node = indexFind(key);
+    if (node) {
+        if (this->listener_) {
+            this->listener_->onRemove(key);
+        }
+        this->detachNode(node);
+        delete node;
+    }
+}
+
+/**
+* Assignment, clear, load and merged batches relink or free nodes without
+* the attach and unlink hooks, so the index is rebuilt from the tree.
+*/
+template<class Key, class Value, class Hash>
+void HashedAVLTree<Key, Value, Hash>::nodesReplaced()
+{
+    reindex(this->nodeCount_);
+}
+
+template<class Key, class Value, class Hash>
+size_t HashedAVLTree<Key, Value, Hash>::size() const
+{
+    return indexed_;
+}
+
+template<class Key, class Value, class Hash>
+typename HashedAVLTree<Key, Value, Hash>::iterator HashedAVLTree<Key, Value, Hash>::find(const Key& key) const
+{
+    return this->makeIterator(indexFind(key));
+}
+
+template<class Key, class Value, class Hash>
+size_t HashedAVLTree<Key, Value, Hash>::count(const Key& key) const
+{
+    return indexFind(key) ? 1 : 0;
+}
+
+template<class Key, class Value, class Hash>
+Value& HashedAVLTree<Key, Value, Hash>::operator[](const Key& key)
+{
+    Node<Key, Value>* node = indexFind(key);
+    if (node == nullptr) {
+        throw std::out_of_range("Invalid key");
+    }
+    return node->getValue();
+}
+
+template<class Key, class Value, class Hash>
+Value const & HashedAVLTree<Key, Value, Hash>::operator[](const Key& key) const
+{
+    Node<Key, Value>* node = indexFind(key);
+    if (node == nullptr) {
+        throw std::out_of_range("Invalid key");
+    }
+    return node->getValue();
+}
+
+template<class Key, class Value, class Hash>
+void HashedAVLTree<Key, Value, Hash>::attachNode(Node<Key, Value>* node, Node<Key, Value>* parent)
+{
+    AVLTree<Key, Value>::attachNode(node, parent);
+    indexInsert(node);
+}
+
+template<class Key, class Value, class Hash>
+void HashedAVLTree<Key, Value, Hash>::unlinkNode(Node<Key, Value>* node)
+{
+    indexErase(node);
+    AVLTree<Key, Value>::unlinkNode(node);
+}
+
+/**
+* The AVL range erase frees whole subtrees without the unlink hook, so
+* the run is dropped from the index up front. Nodes the base then
+* unlinks one by one are simply not found again.
+*/
+template<class Key, class Value, class Hash>
+void HashedAVLTree<Key, Value, Hash>::eraseNodes(Node<Key, Value>* first, Node<Key, Value>* last)
+{
+    for (Node<Key, Value>* node = first; node != last; node = BinarySearchTree<Key, Value>::successor(node)) {
+        indexErase(node);
+    }
+    AVLTree<Key, Value>::eraseNodes(first, last);
+}
+
+/**
+* Fibonacci hashing: the top bits of the hash times 2^64 / phi. This
+* spreads the identity hashes std::hash gives integers across the table.
+*/
+template<class Key, class Value, class Hash>
+size_t HashedAVLTree<Key, Value, Hash>::home(const Key& key) const
+{
+    unsigned long long h = hasher_(key);
+    return size_t((h * 0x9e3779b97f4a7c15ULL) >> shift_);
+}
+
+template<class Key, class Value, class Hash>
+Node<Key, Value>* HashedAVLTree<Key, Value, Hash>::indexFind(const Key& key) const
+{
+    size_t mask = slots_.size() - 1;
+    for (size_t i = home(key); slots_[i]; i = (i + 1) & mask) {
+        const Key& other = slots_[i]->getKey();
+        if (!(other < key) && !(key < other)) {
+            return slots_[i];
+        }
+    }
+    return nullptr;
+}
+
+template<class Key, class Value, class Hash>
+void HashedAVLTree<Key, Value, Hash>::indexInsert(Node<Key, Value>* node)
+{
+    if (4 * (indexed_ + 1) > 3 * slots_.size()) {
+        reindex(indexed_ + 1);
+    }
+
+    size_t mask = slots_.size() - 1;
+    size_t i = home(node->getKey());
+    while (slots_[i]) {
+        if (slots_[i] == node) { //Already there after the reindex
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+    slots_[i] = node;
+    indexed_++;
+}
+
+/**
+* Removes node from the table if present. Rather than leaving a
+* tombstone, later entries of the same probe run are shifted back into
+* the gap whenever their home slot allows it, so lookups never probe
+* past dead slots.
+*/
+template<class Key, class Value, class Hash>
+void HashedAVLTree<Key, Value, Hash>::indexErase(Node<Key, Value>* node)
+{
+    size_t mask = slots_.size() - 1;
+    size_t i = home(node->getKey());
+    while (slots_[i] != node) {
+        if (slots_[i] == nullptr) {
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+
+    for (size_t j = (i + 1) & mask; slots_[j]; j = (j + 1) & mask) {
+        size_t k = home(slots_[j]->getKey());
+        // Move j into the gap at i unless its home lies cyclically in (i, j]
+        if ((j > i) ? (k <= i || k > j) : (k <= i && k > j)) {
+            slots_[i] = slots_[j];
+            i = j;
+        }
+    }
+    slots_[i] = nullptr;
+    indexed_--;
+}
+
+/**
+* Rebuilds the table from the tree, sized for count entries.
+*/
+template<class Key, class Value, class Hash>
+void HashedAVLTree<Key, Value, Hash>::reindex(size_t count)
+{
+    size_t size = 8;
+    shift_ = 64 - 3;
+    while (4 * count > 3 * size) {
+        size *= 2;
+        shift_--;
+    }
+    slots_.assign(size, nullptr);
+    indexed_ = 0;
+
+    for (Node<Key, Value>* node = this->leftmost_; node; node = BinarySearchTree<Key, Value>::successor(node)) {
+        size_t i = home(node->getKey());
+        while (slots_[i]) {
+            i = (i + 1) & (size - 1);
+        }
+        slots_[i] = node;
+        indexed_++;
+    }
+}
+
+/*
+  ------------------------------------------------
+  End implementations for the HashedAVLTree class.
+  ------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef INTERVAL_TREE_H
+#define INTERVAL_TREE_H
+
+#include <utility>
+#include <iostream>
+#include "augmented_avl.h"
+
+/**
+* A closed interval [lo, hi], ordered by lo and then hi. This is the key
+* type of an IntervalTree.
+*/
+template <typename Key>
+struct Interval
+{
+    Interval() : lo(), hi() { }
+    Interval(const Key& l, const Key& h) : lo(l), hi(h) { }
+
+    bool operator<(const Interval& rhs) const { return lo < rhs.lo || (!(rhs.lo < lo) && hi < rhs.hi); }
+    bool operator>(const Interval& rhs) const { return rhs < *this; }
+    bool operator==(const Interval& rhs) const { return !(*this < rhs) && !(rhs < *this); }
+
+    Key lo;
+    Key hi;
+};
+
+template <typename Key>
+std::ostream& operator<<(std::ostream& os, const Interval<Key>& interval)
+{
+    return os << '[' << interval.lo << ", " << interval.hi << ']';
+}
+
+/**
+* Aggregates the largest right endpoint in a subtree of intervals. The
+* bool marks whether any interval was seen, so Key needs no sentinel value.
+*/
+template <typename Key>
+struct MaxEndpointMonoid
+{
+    typedef std::pair<bool, Key> value_type;
+    static value_type identity() { return value_type(false, Key()); }
+    static value_type combine(const value_type& a, const value_type& b)
+    {
+        if (!a.first) return b;
+        if (!b.first) return a;
+        return a.second < b.second ? b : a;
+    }
+    template<typename Value>
+    static value_type lift(const Interval<Key>& interval, const Value&)
+    {
+        return value_type(true, interval.hi);
+    }
+};
+
+/**
+* A map from closed intervals [lo, hi] to values, ordered by (lo, hi).
+* It is an AugmentedAVLTree whose per-node aggregate is the largest right
+* endpoint in the subtree, so subtrees that end before a query starts are
+* skipped. Stabbing and overlap queries run in O(log n + k) for typical
+* data (O(min(n, k log n)) in the worst case). Results go to a callback,
+* so no container is allocated per query.
+*/
+template <typename Key, typename Value>
+class IntervalTree : public AugmentedAVLTree<Interval<Key>, Value, MaxEndpointMonoid<Key> >
+{
+public:
+    using AugmentedAVLTree<Interval<Key>, Value, MaxEndpointMonoid<Key> >::insert;
+    using BinarySearchTree<Interval<Key>, Value>::remove;
+
+    void insert(const Key& lo, const Key& hi, const Value& value);
+    void remove(const Key& lo, const Key& hi);
+
+    // Both call f(lo, hi, value) for every matching interval, in order
+    template<typename Func>
+    void stab(const Key& point, Func f) const;
+    template<typename Func>
+    void overlap(const Key& lo, const Key& hi, Func f) const;
+
+protected:
+    template<typename Func>
+    void overlap_Helper(Node<Interval<Key>, Value>* node, const Key& lo, const Key& hi, Func& f) const;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the IntervalTree class.
+  -------------------------------------------------
+*/
+
+/**
+* Inserts [lo, hi]. Inserting the same interval again overwrites its value.
+*/
+template<class Key, class Value>
+void IntervalTree<Key, Value>::insert(const Key& lo, const Key& hi, const Value& value)
+{
+    this->insert(std::make_pair(Interval<Key>(lo, hi), value));
+}
+
+template<class Key, class Value>
+void IntervalTree<Key, Value>::remove(const Key& lo, const Key& hi)
+{
+    this->remove(Interval<Key>(lo, hi));
+}
+
+/**
+* Reports every interval containing point.
+*/
+template<class Key, class Value>
+template<typename Func>
+void IntervalTree<Key, Value>::stab(const Key& point, Func f) const
+{
+    overlap_Helper(this->root_, point, point, f);
+}
+
+/**
+* Reports every interval sharing at least one point with [lo, hi].
+*/
+template<class Key, class Value>
+template<typename Func>
+void IntervalTree<Key, Value>::overlap(const Key& lo, const Key& hi, Func f) const
+{
+    overlap_Helper(this->root_, lo, hi, f);
+}
+
+/**
+* In-order walk that skips any subtree whose largest endpoint is below lo,
+* and stops going right once intervals start after hi.
+*/
+template<class Key, class Value>
+template<typename Func>
+void IntervalTree<Key, Value>::overlap_Helper(Node<Interval<Key>, Value>* node, const Key& lo, const Key& hi, Func& f) const
+{
+    if (node == nullptr || this->aggregateOf(node).second < lo) {
+        return;
+    }
+
+    overlap_Helper(node->getLeft(), lo, hi, f);
+
+    const Interval<Key>& interval = node->getKey();
+    if (hi < interval.lo) {
+        return;
+    }
+    if (!(interval.hi < lo)) {
+        f(interval.lo, interval.hi, node->getValue());
+    }
+
+    overlap_Helper(node->getRight(), lo, hi, f);
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the IntervalTree class.
+  -----------------------------------------------
+*/
+
+#endif
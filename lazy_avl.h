@@ -0,0 +1,732 @@
+#ifndef LAZY_AVL_H
+#define LAZY_AVL_H
+
+#include <vector>
+#include <memory>
+#include "avlbst.h"
+
+/**
+* An AVLNode that can be marked as deleted (a tombstone) while staying
+* linked into the tree.
+*/
+template <typename Key, typename Value>
+class LazyAVLNode : public AVLNode<Key, Value>
+{
+public:
+    LazyAVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
+
+    bool isDeleted() const;
+    void setDeleted(bool deleted);
+
+protected:
+    bool deleted_;
+};
+
+template<class Key, class Value>
+LazyAVLNode<Key, Value>::LazyAVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent) :
+    AVLNode<Key, Value>(key, value, parent), deleted_(false)
+{
+
+}
+
+template<class Key, class Value>
+bool LazyAVLNode<Key, Value>::isDeleted() const
+{
+    return deleted_;
+}
+
+template<class Key, class Value>
+void LazyAVLNode<Key, Value>::setDeleted(bool deleted)
+{
+    deleted_ = deleted;
+}
+
+/**
+* An AVL tree with lazy deletion. remove() only marks the node as a
+* tombstone, which costs one O(log n) descent and no restructuring;
+* lookups and iteration skip tombstones, and inserting a removed key
+* revives its node in place.
+*
+* Once tombstones make up more than maxTombstoneRatio of the nodes, a
+* compaction sweep starts. Each later insert or remove advances it by one
+* compactStep(), which cuts the next stepSize nodes out of the tree with
+* split, rebuilds them without their tombstones into a balanced subtree,
+* and joins it back in O(stepSize + log n). compact() rebuilds the whole
+* tree in one O(n) pass.
+*/
+template <typename Key, typename Value>
+class LazyAVLTree : public AVLTree<Key, Value>
+{
+public:
+    typedef typename BinarySearchTree<Key, Value>::node_type node_type;
+    typedef typename BinarySearchTree<Key, Value>::insert_return_type insert_return_type;
+
+    /**
+    * An iterator that steps over tombstones.
+    */
+    class iterator : public BinarySearchTree<Key, Value>::iterator
+    {
+    public:
+        iterator();
+        iterator(const typename BinarySearchTree<Key, Value>::iterator& it);
+
+        iterator& operator++();
+        iterator& operator--();
+
+    protected:
+        friend class LazyAVLTree<Key, Value>;
+        iterator(Node<Key, Value>* ptr, const LazyAVLTree<Key, Value>* tree);
+        void skipDeleted();
+    };
+
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+
+    explicit LazyAVLTree(double maxTombstoneRatio = 0.25, size_t stepSize = 64);
+    LazyAVLTree(const LazyAVLTree<Key, Value>& other);
+    LazyAVLTree(LazyAVLTree<Key, Value>&& other);
+    LazyAVLTree<Key, Value>& operator=(const LazyAVLTree<Key, Value>& other);
+    LazyAVLTree<Key, Value>& operator=(LazyAVLTree<Key, Value>&& other);
+
+    virtual void insert(const std::pair<const Key, Value>& keyValuePair) override;
+    insert_return_type insert(node_type&& nh);
+    virtual void remove(const Key& key) override;
+    template<typename KeySerializer = Serializer<Key>, typename ValueSerializer = Serializer<Value> >
+    void save(std::ostream& out) const;
+
+    bool empty() const;
+    size_t size() const;
+    size_t tombstones() const;
+    iterator begin() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    size_t count(const Key& key) const;
+    node_type extract(const Key& key);
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+    template<typename Func>
+    void for_each(Func f) const;
+    template<typename Func>
+    void for_each_range(const Key& lo, const Key& hi, Func f) const;
+    template<typename Func>
+    void parallel_for_each(Func f, unsigned threads = 0) const;
+
+    bool compactStep();
+    void compact();
+
+protected:
+    typedef LazyAVLNode<Key, Value> LazyNode;
+
+    static bool isDeleted(const Node<Key, Value>* node);
+    void collectLive(AVLNode<Key, Value>* node, std::vector<AVLNode<Key, Value>*>& nodes);
+    virtual Node<Key, Value>* findLive(const Key& key) const override;
+    virtual bool mergeCheaper(size_t count) const override;
+    void maybeCompact();
+    void copyState(const LazyAVLTree<Key, Value>& other);
+
+    virtual Node<Key, Value>* createNode(const Key& key, const Value& value, Node<Key, Value>* parent) const override;
+    virtual Node<Key, Value>* cloneNode(const Node<Key, Value>* node, Node<Key, Value>* parent) const override;
+    virtual void attachNode(Node<Key, Value>* node, Node<Key, Value>* parent) override;
+    virtual void unlinkNode(Node<Key, Value>* node) override;
+    virtual void eraseNodes(Node<Key, Value>* first, Node<Key, Value>* last) override;
+    virtual void nodesReplaced() override;
+
+    size_t live_;
+    size_t tombstones_;
+    double maxTombstoneRatio_;
+    size_t stepSize_;
+    bool sweeping_;
+    std::unique_ptr<Key> cursor_;    // where the sweep resumes; NULL for the start
+};
+
+/*
+  ------------------------------------------------
+  Begin implementations for the LazyAVLTree class.
+  ------------------------------------------------
+*/
+
+template<class Key, class Value>
+LazyAVLTree<Key, Value>::iterator::iterator() : BinarySearchTree<Key, Value>::iterator()
+{
+
+}
+
+/**
+* Converts a plain tree iterator, moving it forward past any tombstones.
+*/
+template<class Key, class Value>
+LazyAVLTree<Key, Value>::iterator::iterator(const typename BinarySearchTree<Key, Value>::iterator& it) :
+    BinarySearchTree<Key, Value>::iterator(it)
+{
+    skipDeleted();
+}
+
+template<class Key, class Value>
+LazyAVLTree<Key, Value>::iterator::iterator(Node<Key, Value>* ptr, const LazyAVLTree<Key, Value>* tree) :
+    BinarySearchTree<Key, Value>::iterator()
+{
+    this->current_ = ptr;
+    this->tree_ = tree;
+}
+
+template<class Key, class Value>
+typename LazyAVLTree<Key, Value>::iterator& LazyAVLTree<Key, Value>::iterator::operator++()
+{
+    BinarySearchTree<Key, Value>::iterator::operator++();
+    skipDeleted();
+    return *this;
+}
+
+template<class Key, class Value>
+typename LazyAVLTree<Key, Value>::iterator& LazyAVLTree<Key, Value>::iterator::operator--()
+{
+    do {
+        BinarySearchTree<Key, Value>::iterator::operator--();
+    } while (this->current_ && LazyAVLTree<Key, Value>::isDeleted(this->current_));
+    return *this;
+}
+
+template<class Key, class Value>
+void LazyAVLTree<Key, Value>::iterator::skipDeleted()
+{
+    while (this->current_ && LazyAVLTree<Key, Value>::isDeleted(this->current_)) {
+        BinarySearchTree<Key, Value>::iterator::operator++();
+    }
+}
+
+template<class Key, class Value>
+LazyAVLTree<Key, Value>::LazyAVLTree(double maxTombstoneRatio, size_t stepSize) :
+    AVLTree<Key, Value>(),
+    live_(0),
+    tombstones_(0),
+    maxTombstoneRatio_(maxTombstoneRatio),
+    stepSize_(stepSize ? stepSize : 1),
+    sweeping_(false)
+{
+
+}
+
+template<class Key, class Value>
+LazyAVLTree<Key, Value>::LazyAVLTree(const LazyAVLTree<Key, Value>& other) :
+    AVLTree<Key, Value>(),
+    sweeping_(false)
+{
+    this->root_ = this->copy_Helper(other.root_, nullptr);
+    this->nodeCount_ = other.nodeCount_;
+    this->updateExtremes();
+    copyState(other);
+}
+
+template<class Key, class Value>
+LazyAVLTree<Key, Value>::LazyAVLTree(LazyAVLTree<Key, Value>&& other) :
+    AVLTree<Key, Value>(std::move(other)),
+    sweeping_(false)
+{
+    copyState(other);
+    other.live_ = 0;
+    other.tombstones_ = 0;
+}
+
+template<class Key, class Value>
+LazyAVLTree<Key, Value>& LazyAVLTree<Key, Value>::operator=(const LazyAVLTree<Key, Value>& other)
+{
+    if (this != &other) {
+        AVLTree<Key, Value>::operator=(other);
+        copyState(other);
+    }
+    return *this;
+}
+
+template<class Key, class Value>
+LazyAVLTree<Key, Value>& LazyAVLTree<Key, Value>::operator=(LazyAVLTree<Key, Value>&& other)
+{
+    if (this != &other) {
+        copyState(other);
+        AVLTree<Key, Value>::operator=(std::move(other));
+    }
+    return *this;
+}
+
+/**
+* Inserting a key that is only present as a tombstone revives its node in
+* place; otherwise this behaves like AVLTree::insert.
+*/
+template<class Key, class Value>
+void LazyAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    if (this->stage(keyValuePair.first, &keyValuePair.second)) {
+        return;
+    }
+
+    Node<Key, Value>* node = this->internalFind(keyValuePair.first);
+
+    if (node) {
+        if (this->listener_) {
+            this->listener_->onInsert(keyValuePair.first, keyValuePair.second);
+        }
+        node->setValue(keyValuePair.second);
+        if (isDeleted(node)) {
+            static_cast<LazyNode*>(node)->setDeleted(false);
+            tombstones_--;
+            live_++;
+        }
+    }
+    else {
+        BinarySearchTree<Key, Value>::insert(keyValuePair);
+    }
+
+    maybeCompact();
+}
+
+/**
+* A tombstone for the handle's key is dropped first, so the handle is
+* only refused if the key is live.
+*/
+template<class Key, class Value>
+typename LazyAVLTree<Key, Value>::insert_return_type LazyAVLTree<Key, Value>::insert(node_type&& nh)
+{
+    this->checkDirectChange();
+    if (!nh.empty()) {
+        Node<Key, Value>* node = this->internalFind(nh.key());
+        if (node && isDeleted(node)) {
+            this->detachNode(node);
+            delete node;
+        }
+    }
+    return BinarySearchTree<Key, Value>::insert(std::move(nh));
+}
+
+/**
+* Marks the node holding key as a tombstone without restructuring the tree.
+*/
+template<class Key, class Value>
+void LazyAVLTree<Key, Value>::remove(const Key& key)
+{
+    if (this->stage(key, nullptr)) {
+        return;
+    }
+
+    Node<Key, Value>* node = this->findLive(key);
+
+    if (node) {
+        if (this->listener_) {
+            this->listener_->onRemove(key);
+        }
+        static_cast<LazyNode*>(node)->setDeleted(true);
+        live_--;
+        tombstones_++;
+    }
+
+    maybeCompact();
+}
+
+/**
+* Snapshots hold live entries only; tombstones are left behind.
+*/
+template<class Key, class Value>
+template<typename KeySerializer, typename ValueSerializer>
+void LazyAVLTree<Key, Value>::save(std::ostream& out) const
+{
+    this->template save_Helper<KeySerializer, ValueSerializer>(out, isDeleted);
+}
+
+template<class Key, class Value>
+bool LazyAVLTree<Key, Value>::empty() const
+{
+    return live_ == 0;
+}
+
+/**
+* Returns the number of live (non-tombstone) entries.
+*/
+template<class Key, class Value>
+size_t LazyAVLTree<Key, Value>::size() const
+{
+    return live_;
+}
+
+template<class Key, class Value>
+size_t LazyAVLTree<Key, Value>::tombstones() const
+{
+    return tombstones_;
+}
+
+template<class Key, class Value>
+typename LazyAVLTree<Key, Value>::iterator LazyAVLTree<Key, Value>::begin() const
+{
+    return iterator(BinarySearchTree<Key, Value>::begin());
+}
+
+template<class Key, class Value>
+typename LazyAVLTree<Key, Value>::reverse_iterator LazyAVLTree<Key, Value>::rbegin() const
+{
+    return reverse_iterator(iterator(this->end()));
+}
+
+template<class Key, class Value>
+typename LazyAVLTree<Key, Value>::reverse_iterator LazyAVLTree<Key, Value>::rend() const
+{
+    return reverse_iterator(this->begin());
+}
+
+template<class Key, class Value>
+typename LazyAVLTree<Key, Value>::iterator LazyAVLTree<Key, Value>::find(const Key& key) const
+{
+    return iterator(this->findLive(key), this);
+}
+
+template<class Key, class Value>
+typename LazyAVLTree<Key, Value>::iterator LazyAVLTree<Key, Value>::lower_bound(const Key& key) const
+{
+    return iterator(BinarySearchTree<Key, Value>::lower_bound(key));
+}
+
+template<class Key, class Value>
+typename LazyAVLTree<Key, Value>::iterator LazyAVLTree<Key, Value>::upper_bound(const Key& key) const
+{
+    return iterator(BinarySearchTree<Key, Value>::upper_bound(key));
+}
+
+template<class Key, class Value>
+size_t LazyAVLTree<Key, Value>::count(const Key& key) const
+{
+    return this->findLive(key) ? 1 : 0;
+}
+
+template<class Key, class Value>
+typename LazyAVLTree<Key, Value>::node_type LazyAVLTree<Key, Value>::extract(const Key& key)
+{
+    if (this->findLive(key) == nullptr) {
+        return node_type();
+    }
+    return BinarySearchTree<Key, Value>::extract(key);
+}
+
+template<class Key, class Value>
+Value& LazyAVLTree<Key, Value>::operator[](const Key& key)
+{
+    Node<Key, Value>* curr = this->findLive(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+
+template<class Key, class Value>
+Value const & LazyAVLTree<Key, Value>::operator[](const Key& key) const
+{
+    Node<Key, Value>* curr = this->findLive(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+
+/**
+* The traversals wrap f so that tombstones are skipped.
+*/
+template<class Key, class Value>
+template<typename Func>
+void LazyAVLTree<Key, Value>::for_each(Func f) const
+{
+    auto visit = [&f](Node<Key, Value>* node) {
+        if (!isDeleted(node)) {
+            f(node->getKey(), node->getValue());
+        }
+    };
+    BinarySearchTree<Key, Value>::for_each_Helper(this->root_, visit);
+}
+
+template<class Key, class Value>
+template<typename Func>
+void LazyAVLTree<Key, Value>::for_each_range(const Key& lo, const Key& hi, Func f) const
+{
+    auto visit = [&f](Node<Key, Value>* node) {
+        if (!isDeleted(node)) {
+            f(node->getKey(), node->getValue());
+        }
+    };
+    this->for_each_range_Helper(lo, hi, visit);
+}
+
+template<class Key, class Value>
+template<typename Func>
+void LazyAVLTree<Key, Value>::parallel_for_each(Func f, unsigned threads) const
+{
+    auto visit = [&f](Node<Key, Value>* node) {
+        if (!isDeleted(node)) {
+            f(node->getKey(), node->getValue());
+        }
+    };
+    this->parallel_for_each_Helper(visit, threads);
+}
+
+/**
+* Advances the compaction sweep by one step, starting a new sweep if
+* there are tombstones and none is running. The next stepSize nodes from
+* the sweep cursor are split out of the tree, rebuilt without tombstones
+* and joined back. Returns true while the sweep has nodes left to visit.
+*/
+template<class Key, class Value>
+bool LazyAVLTree<Key, Value>::compactStep()
+{
+    if (!sweeping_) {
+        if (tombstones_ == 0) {
+            return false;
+        }
+        sweeping_ = true;
+        cursor_.reset();
+    }
+
+    Node<Key, Value>* first = this->leftmost_;
+    if (cursor_) { //First node not below the cursor
+        first = nullptr;
+        for (Node<Key, Value>* node = this->root_; node; ) {
+            if (node->getKey() < *cursor_) {
+                node = node->getRight();
+            }
+            else {
+                first = node;
+                node = node->getLeft();
+            }
+        }
+    }
+    if (first == nullptr) {
+        sweeping_ = false;
+        cursor_.reset();
+        return false;
+    }
+    Node<Key, Value>* last = first;
+    size_t dead = 0;
+    for (size_t i = 0; last && i < stepSize_; i++) {
+        dead += isDeleted(last);
+        last = BinarySearchTree<Key, Value>::successor(last);
+    }
+
+    if (dead > 0) {
+        AVLNode<Key, Value>* root = static_cast<AVLNode<Key, Value>*>(this->root_);
+        AVLNode<Key, Value>* left;
+        AVLNode<Key, Value>* middle;
+        AVLNode<Key, Value>* right = nullptr;
+        int hl, hm, hr = 0;
+
+        this->split(root, this->subtreeHeight(root), first->getKey(), left, hl, middle, hm);
+        if (last) {
+            AVLNode<Key, Value>* rest = middle;
+            this->split(rest, hm, last->getKey(), middle, hm, right, hr);
+        }
+
+        std::vector<AVLNode<Key, Value>*> nodes;
+        this->invalidateLookupCache();
+        collectLive(middle, nodes);
+        tombstones_ -= dead;
+
+        middle = this->build(nodes.data(), nodes.size(), hm);
+        if (middle) {
+            middle->setParent(nullptr);
+        }
+        int h;
+        left = this->join2(left, hl, middle, hm, h);
+        if (left) {
+            left->setParent(nullptr);
+        }
+        this->root_ = this->join2(left, h, right, hr, h);
+        if (this->root_) {
+            this->root_->setParent(nullptr);
+        }
+        this->updateExtremes();
+    }
+
+    if (last == nullptr) {
+        sweeping_ = false;
+        cursor_.reset();
+        return false;
+    }
+    cursor_.reset(new Key(last->getKey()));
+    return true;
+}
+
+/**
+* Drops every tombstone and rebuilds the remaining nodes into a perfectly
+* balanced tree in O(n).
+*/
+template<class Key, class Value>
+void LazyAVLTree<Key, Value>::compact()
+{
+    std::vector<AVLNode<Key, Value>*> nodes;
+    nodes.reserve(live_);
+    this->invalidateLookupCache();
+    collectLive(static_cast<AVLNode<Key, Value>*>(this->root_), nodes);
+
+    int h;
+    this->root_ = this->build(nodes.data(), nodes.size(), h);
+    if (this->root_) {
+        this->root_->setParent(nullptr);
+    }
+    this->updateExtremes();
+    tombstones_ = 0;
+    sweeping_ = false;
+    cursor_.reset();
+}
+
+/**
+* Appends the live nodes of the subtree rooted at node to nodes in key
+* order and frees its tombstones.
+*/
+template<class Key, class Value>
+void LazyAVLTree<Key, Value>::collectLive(AVLNode<Key, Value>* node, std::vector<AVLNode<Key, Value>*>& nodes)
+{
+    if (node == nullptr) {
+        return;
+    }
+
+    AVLNode<Key, Value>* right = node->getRight();
+    collectLive(node->getLeft(), nodes);
+    if (isDeleted(node)) {
+        if (this->filter_) {
+            this->filter_->erase(node->getKey());
+        }
+        delete node;
+        this->nodeCount_--;
+    }
+    else {
+        nodes.push_back(node);
+    }
+    collectLive(right, nodes);
+}
+
+template<class Key, class Value>
+bool LazyAVLTree<Key, Value>::isDeleted(const Node<Key, Value>* node)
+{
+    return static_cast<const LazyNode*>(node)->isDeleted();
+}
+
+/**
+* Returns the node holding key unless it is missing or a tombstone.
+*/
+template<class Key, class Value>
+Node<Key, Value>* LazyAVLTree<Key, Value>::findLive(const Key& key) const
+{
+    Node<Key, Value>* node = this->internalFind(key);
+    return (node && !isDeleted(node)) ? node : nullptr;
+}
+
+/**
+* A merge would treat tombstones as live keys, so batches and insertBatch
+* are always applied change by change, which revives tombstones in place.
+*/
+template<class Key, class Value>
+bool LazyAVLTree<Key, Value>::mergeCheaper(size_t) const
+{
+    return false;
+}
+
+/**
+* Starts a sweep once the tombstone ratio is crossed and advances a
+* running one by a single step.
+*/
+template<class Key, class Value>
+void LazyAVLTree<Key, Value>::maybeCompact()
+{
+    if (!sweeping_ && tombstones_ <= maxTombstoneRatio_ * (live_ + tombstones_)) {
+        return;
+    }
+    this->compactStep();
+}
+
+/**
+* Copies the counters and settings of other; a sweep in progress is not
+* carried over.
+*/
+template<class Key, class Value>
+void LazyAVLTree<Key, Value>::copyState(const LazyAVLTree<Key, Value>& other)
+{
+    live_ = other.live_;
+    tombstones_ = other.tombstones_;
+    maxTombstoneRatio_ = other.maxTombstoneRatio_;
+    stepSize_ = other.stepSize_;
+    sweeping_ = false;
+    cursor_.reset();
+}
+
+template<class Key, class Value>
+Node<Key, Value>* LazyAVLTree<Key, Value>::createNode(const Key& key, const Value& value,
+                                                     Node<Key, Value>* parent) const
+{
+    return new LazyNode(key, value, static_cast<AVLNode<Key, Value>*>(parent));
+}
+
+template<class Key, class Value>
+Node<Key, Value>* LazyAVLTree<Key, Value>::cloneNode(const Node<Key, Value>* node,
+                                                    Node<Key, Value>* parent) const
+{
+    const LazyNode* lazyNode = static_cast<const LazyNode*>(node);
+    LazyNode* copy = new LazyNode(node->getKey(), node->getValue(), static_cast<AVLNode<Key, Value>*>(parent));
+    copy->setBalance(lazyNode->getBalance());
+    copy->setDeleted(lazyNode->isDeleted());
+    return copy;
+}
+
+template<class Key, class Value>
+void LazyAVLTree<Key, Value>::attachNode(Node<Key, Value>* node, Node<Key, Value>* parent)
+{
+    static_cast<LazyNode*>(node)->setDeleted(false);
+    AVLTree<Key, Value>::attachNode(node, parent);
+    live_++;
+}
+
+/**
+* Physical removals (erase, extract) keep the counters in step.
+*/
+template<class Key, class Value>
+void LazyAVLTree<Key, Value>::unlinkNode(Node<Key, Value>* node)
+{
+    if (isDeleted(node)) {
+        tombstones_--;
+    }
+    else {
+        live_--;
+    }
+    AVLTree<Key, Value>::unlinkNode(node);
+}
+
+template<class Key, class Value>
+void LazyAVLTree<Key, Value>::eraseNodes(Node<Key, Value>* first, Node<Key, Value>* last)
+{
+    for (Node<Key, Value>* node = first; node != last; node = BinarySearchTree<Key, Value>::successor(node)) {
+        if (isDeleted(node)) {
+            tombstones_--;
+        }
+        else {
+            live_--;
+        }
+    }
+    AVLTree<Key, Value>::eraseNodes(first, last);
+}
+
+/**
+* Clear, load and assignment replace the nodes wholesale, so the counters
+* are recounted from the tree and any sweep in progress is dropped.
+*/
+template<class Key, class Value>
+void LazyAVLTree<Key, Value>::nodesReplaced()
+{
+    live_ = 0;
+    tombstones_ = 0;
+    for (Node<Key, Value>* node = this->leftmost_; node; node = BinarySearchTree<Key, Value>::successor(node)) {
+        if (isDeleted(node)) {
+            tombstones_++;
+        }
+        else {
+            live_++;
+        }
+    }
+    sweeping_ = false;
+    cursor_.reset();
+}
+
+/*
+  ----------------------------------------------
+  End implementations for the LazyAVLTree class.
+  ----------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,629 @@
+#ifndef MAPPED_AVL_H
+#define MAPPED_AVL_H
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <typeinfo>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+* A node of a MappedAVLTree as laid out in the file. Children are byte
+* offsets from the start of the mapping (0 for none), so the file can be
+* mapped at any address. epoch is the checkpoint the node was written in.
+*/
+template <typename Key, typename Value>
+struct MappedAVLNode
+{
+    Key key;
+    Value value;
+    uint64_t left;
+    uint64_t right;
+    uint32_t epoch;
+    int32_t height;
+};
+
+/**
+* An AVL tree whose nodes live in a memory-mapped file. Opening a file
+* maps it and reads the header, nothing more: pages fault in as lookups
+* touch them, so a warm restart costs O(1) instead of an O(n) load.
+*
+* checkpoint() makes the current contents durable. Nodes reachable from
+* the last checkpoint are never modified in place: a change copies the
+* nodes on its path (the copies are then updated in place until the next
+* checkpoint), and nodes it replaces are only recycled once a newer
+* checkpoint no longer needs them. A checkpoint flushes the nodes with
+* msync before switching the header to the new root, and recycles the
+* nodes it replaced only after that, so after a crash the file reopens to
+* exactly the last completed checkpoint. Nodes on the free list when a
+* crash hits are leaked rather than risked.
+*
+* Key and Value must be trivially copyable, since they are stored as raw
+* bytes. The tree allows a single user at a time, and close() (or the
+* destructor) checkpoints before unmapping.
+*/
+template <typename Key, typename Value>
+class MappedAVLTree
+{
+    static_assert(std::is_trivially_copyable<Key>::value, "MappedAVLTree keys must be trivially copyable");
+    static_assert(std::is_trivially_copyable<Value>::value, "MappedAVLTree values must be trivially copyable");
+
+public:
+    typedef MappedAVLNode<Key, Value> MNode;
+
+    MappedAVLTree();
+    explicit MappedAVLTree(const std::string& path);
+    MappedAVLTree(const MappedAVLTree&) = delete;
+    MappedAVLTree& operator=(const MappedAVLTree&) = delete;
+    ~MappedAVLTree();
+
+    void open(const std::string& path);
+    void close();
+    void checkpoint();
+    bool isOpen() const { return base_ != nullptr; }
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    const Value* find(const Key& key) const;
+    bool empty() const { return root_ == 0; }
+    size_t size() const { return size_; }
+
+    // In-order traversal; f is called as f(key, value)
+    template<typename Func>
+    void for_each(Func f) const;
+
+private:
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t nodeSize;
+        uint64_t typeHash;
+        uint64_t root;
+        uint64_t freeHead;    // free nodes, linked through their left offset
+        uint64_t used;        // end of the allocated part of the file
+        uint64_t size;
+        uint32_t epoch;
+        uint32_t dirty;       // set once the file changes after a checkpoint
+    };
+
+    static uint64_t typeHash();
+    static uint64_t dataStart();
+
+    MNode* at(uint64_t off) const { return reinterpret_cast<MNode*>(base_ + off); }
+    int height(uint64_t off) const { return off ? at(off)->height : 0; }
+    Header* header() const { return reinterpret_cast<Header*>(base_); }
+
+    void map(size_t length);
+    void grow();
+    void markDirty();
+    uint64_t allocate();
+    uint64_t create(const Key& key, const Value& value);
+    uint64_t writable(uint64_t off);
+    void retire(uint64_t off);
+
+    void update(uint64_t off);
+    uint64_t rotateLeft(uint64_t off);
+    uint64_t rotateRight(uint64_t off);
+    uint64_t balance(uint64_t off);
+    uint64_t insert_Helper(uint64_t off, const Key& key, const Value& value);
+    uint64_t remove_Helper(uint64_t off, const Key& key);
+    uint64_t removeMin(uint64_t off, Key& key, Value& value);
+    template<typename Func>
+    void for_each_Helper(uint64_t off, Func& f) const;
+
+    int fd_;
+    char* base_;
+    size_t length_;
+
+    // The working state; the header holds the last checkpoint's
+    uint64_t root_;
+    uint64_t freeHead_;
+    uint64_t used_;
+    size_t size_;
+    uint32_t epoch_;
+    bool dirty_;
+    std::vector<uint64_t> retired_;    // replaced nodes the last checkpoint still uses
+};
+
+/*
+  --------------------------------------------------
+  Begin implementations for the MappedAVLTree class.
+  --------------------------------------------------
+*/
+
+template<class Key, class Value>
+MappedAVLTree<Key, Value>::MappedAVLTree() :
+    fd_(-1), base_(nullptr), length_(0),
+    root_(0), freeHead_(0), used_(0), size_(0), epoch_(0), dirty_(false)
+{
+
+}
+
+template<class Key, class Value>
+MappedAVLTree<Key, Value>::MappedAVLTree(const std::string& path) : MappedAVLTree()
+{
+    open(path);
+}
+
+template<class Key, class Value>
+MappedAVLTree<Key, Value>::~MappedAVLTree()
+{
+    try {
+        close();
+    }
+    catch (...) {
+    }
+}
+
+/**
+* Maps path, creating it if it does not exist. An existing file must have
+* been written for the same Key and Value types.
+*/
+template<class Key, class Value>
+void MappedAVLTree<Key, Value>::open(const std::string& path)
+{
+    close();
+
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+    struct stat st;
+    if (fstat(fd_, &st) != 0) {
+        ::close(fd_);
+        fd_ = -1;
+        throw std::runtime_error("Cannot stat " + path);
+    }
+
+    bool fresh = st.st_size == 0;
+    size_t length = fresh ? dataStart() + 64 * sizeof(MNode) : size_t(st.st_size);
+    if (fresh && ftruncate(fd_, length) != 0) {
+        ::close(fd_);
+        fd_ = -1;
+        throw std::runtime_error("Cannot size " + path);
+    }
+    map(length);
+
+    Header* head = header();
+    if (fresh) {
+        std::memcpy(head->magic, "BSTMAP01", 8);
+        head->version = 1;
+        head->nodeSize = sizeof(MNode);
+        head->typeHash = typeHash();
+        head->root = 0;
+        head->freeHead = 0;
+        head->used = dataStart();
+        head->size = 0;
+        head->epoch = 1;
+        head->dirty = 0;
+        msync(base_, dataStart(), MS_SYNC);
+    }
+    else if (length < sizeof(Header) || std::memcmp(head->magic, "BSTMAP01", 8) != 0
+             || head->version != 1 || head->nodeSize != sizeof(MNode) || head->typeHash != typeHash()) {
+        munmap(base_, length_);
+        ::close(fd_);
+        base_ = nullptr;
+        fd_ = -1;
+        throw std::runtime_error(path + " is not a tree file for these key and value types");
+    }
+
+    root_ = head->root;
+    freeHead_ = head->dirty ? 0 : head->freeHead; //A crash may have torn the free list
+    used_ = head->used;
+    size_ = head->size;
+    epoch_ = head->epoch;
+    dirty_ = false;
+    retired_.clear();
+}
+
+/**
+* Checkpoints and unmaps the file. Does nothing if no file is open.
+*/
+template<class Key, class Value>
+void MappedAVLTree<Key, Value>::close()
+{
+    if (base_ == nullptr) {
+        return;
+    }
+    checkpoint();
+    munmap(base_, length_);
+    ::close(fd_);
+    base_ = nullptr;
+    fd_ = -1;
+    root_ = 0;
+    size_ = 0;
+}
+
+/**
+* Makes every change so far durable. Every node is flushed first, then the
+* header is switched to the new root and flushed in turn. The nodes
+* replaced since the last checkpoint belong to that checkpoint until the
+* switch is on disk, so only then are they threaded onto the free list,
+* which the header picks up in a second flush. A crash in between leaks
+* them rather than tearing the last checkpoint.
+*/
+template<class Key, class Value>
+void MappedAVLTree<Key, Value>::checkpoint()
+{
+    if (base_ == nullptr || !dirty_) {
+        return;
+    }
+
+    if (msync(base_, length_, MS_SYNC) != 0) {
+        throw std::runtime_error("Checkpoint failed to flush nodes");
+    }
+
+    Header* head = header();
+    head->root = root_;
+    head->freeHead = freeHead_;
+    head->used = used_;
+    head->size = size_;
+    head->epoch = ++epoch_;
+    head->dirty = 0;
+    if (msync(base_, dataStart(), MS_SYNC) != 0) {
+        throw std::runtime_error("Checkpoint failed to flush the header");
+    }
+
+    if (!retired_.empty()) {
+        for (size_t i = 0; i < retired_.size(); i++) {
+            at(retired_[i])->left = freeHead_;
+            freeHead_ = retired_[i];
+        }
+        retired_.clear();
+        if (msync(base_, length_, MS_SYNC) != 0) {
+            throw std::runtime_error("Checkpoint failed to flush the free list");
+        }
+        head->freeHead = freeHead_;
+        if (msync(base_, dataStart(), MS_SYNC) != 0) {
+            throw std::runtime_error("Checkpoint failed to flush the header");
+        }
+    }
+    dirty_ = false;
+}
+
+template<class Key, class Value>
+void MappedAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    markDirty();
+    root_ = insert_Helper(root_, keyValuePair.first, keyValuePair.second);
+}
+
+template<class Key, class Value>
+void MappedAVLTree<Key, Value>::remove(const Key& key)
+{
+    if (find(key) == nullptr) {
+        return;
+    }
+    markDirty();
+    root_ = remove_Helper(root_, key);
+    size_--;
+}
+
+/**
+* Returns a pointer to the value stored under key, or NULL. The pointer
+* is invalidated by the next insert or remove.
+*/
+template<class Key, class Value>
+const Value* MappedAVLTree<Key, Value>::find(const Key& key) const
+{
+    uint64_t off = root_;
+    while (off) {
+        const MNode* node = at(off);
+        if (key < node->key) {
+            off = node->left;
+        }
+        else if (node->key < key) {
+            off = node->right;
+        }
+        else {
+            return &node->value;
+        }
+    }
+    return nullptr;
+}
+
+template<class Key, class Value>
+template<typename Func>
+void MappedAVLTree<Key, Value>::for_each(Func f) const
+{
+    for_each_Helper(root_, f);
+}
+
+/**
+* Identifies the key and value types by size and type name.
+*/
+template<class Key, class Value>
+uint64_t MappedAVLTree<Key, Value>::typeHash()
+{
+    std::string name = std::to_string(sizeof(Key)) + typeid(Key).name() + "/"
+                     + std::to_string(sizeof(Value)) + typeid(Value).name();
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < name.size(); i++) {
+        h = (h ^ (unsigned char)name[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/**
+* Nodes start on the first multiple of the node size past the header, so
+* they stay aligned.
+*/
+template<class Key, class Value>
+uint64_t MappedAVLTree<Key, Value>::dataStart()
+{
+    return (sizeof(Header) + sizeof(MNode) - 1) / sizeof(MNode) * sizeof(MNode);
+}
+
+template<class Key, class Value>
+void MappedAVLTree<Key, Value>::map(size_t length)
+{
+    void* base = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (base == MAP_FAILED) {
+        ::close(fd_);
+        fd_ = -1;
+        throw std::runtime_error("Cannot map tree file");
+    }
+    base_ = static_cast<char*>(base);
+    length_ = length;
+}
+
+/**
+* Doubles the file and maps it again, possibly at a new address; offsets
+* keep every reference valid.
+*/
+template<class Key, class Value>
+void MappedAVLTree<Key, Value>::grow()
+{
+    size_t length = length_ * 2;
+    if (ftruncate(fd_, length) != 0) {
+        throw std::runtime_error("Cannot grow tree file");
+    }
+    munmap(base_, length_);
+    map(length);
+}
+
+/**
+* Flags the header before the first change after a checkpoint, so a crash
+* before the next checkpoint is recognized on open.
+*/
+template<class Key, class Value>
+void MappedAVLTree<Key, Value>::markDirty()
+{
+    if (base_ == nullptr) {
+        throw std::runtime_error("MappedAVLTree is not open");
+    }
+    if (!dirty_) {
+        header()->dirty = 1;
+        msync(base_, dataStart(), MS_SYNC);
+        dirty_ = true;
+    }
+}
+
+template<class Key, class Value>
+uint64_t MappedAVLTree<Key, Value>::allocate()
+{
+    if (freeHead_) {
+        uint64_t off = freeHead_;
+        freeHead_ = at(off)->left;
+        return off;
+    }
+    if (used_ + sizeof(MNode) > length_) {
+        grow();
+    }
+    uint64_t off = used_;
+    used_ += sizeof(MNode);
+    return off;
+}
+
+template<class Key, class Value>
+uint64_t MappedAVLTree<Key, Value>::create(const Key& key, const Value& value)
+{
+    uint64_t off = allocate();
+    MNode* node = at(off);
+    node->key = key;
+    node->value = value;
+    node->left = 0;
+    node->right = 0;
+    node->epoch = epoch_;
+    node->height = 1;
+    size_++;
+    return off;
+}
+
+/**
+* Returns a node equal to off that may be modified: off itself if it was
+* written since the last checkpoint, otherwise a fresh copy. The copy may
+* remap the file, so callers re-read pointers afterwards.
+*/
+template<class Key, class Value>
+uint64_t MappedAVLTree<Key, Value>::writable(uint64_t off)
+{
+    if (at(off)->epoch == epoch_) {
+        return off;
+    }
+    uint64_t copy = allocate();
+    std::memcpy(static_cast<void*>(at(copy)), at(off), sizeof(MNode));
+    at(copy)->epoch = epoch_;
+    retire(off);
+    return copy;
+}
+
+/**
+* Frees a node that is no longer in the working tree. A node the last
+* checkpoint may still reference waits for the next checkpoint.
+*/
+template<class Key, class Value>
+void MappedAVLTree<Key, Value>::retire(uint64_t off)
+{
+    if (at(off)->epoch == epoch_) {
+        at(off)->left = freeHead_;
+        freeHead_ = off;
+    }
+    else {
+        retired_.push_back(off);
+    }
+}
+
+template<class Key, class Value>
+void MappedAVLTree<Key, Value>::update(uint64_t off)
+{
+    MNode* node = at(off);
+    node->height = 1 + std::max(height(node->left), height(node->right));
+}
+
+/**
+* Rotations take a writable node and return the new writable subtree root.
+*/
+template<class Key, class Value>
+uint64_t MappedAVLTree<Key, Value>::rotateLeft(uint64_t off)
+{
+    uint64_t r = writable(at(off)->right);
+    at(off)->right = at(r)->left;
+    update(off);
+    at(r)->left = off;
+    update(r);
+    return r;
+}
+
+template<class Key, class Value>
+uint64_t MappedAVLTree<Key, Value>::rotateRight(uint64_t off)
+{
+    uint64_t l = writable(at(off)->left);
+    at(off)->left = at(l)->right;
+    update(off);
+    at(l)->right = off;
+    update(l);
+    return l;
+}
+
+template<class Key, class Value>
+uint64_t MappedAVLTree<Key, Value>::balance(uint64_t off)
+{
+    update(off);
+    int diff = height(at(off)->left) - height(at(off)->right);
+
+    if (diff > 1) {
+        uint64_t l = at(off)->left;
+        if (height(at(l)->left) < height(at(l)->right)) {
+            l = rotateLeft(writable(l));
+            at(off)->left = l;
+        }
+        return rotateRight(off);
+    }
+    if (diff < -1) {
+        uint64_t r = at(off)->right;
+        if (height(at(r)->right) < height(at(r)->left)) {
+            r = rotateRight(writable(r));
+            at(off)->right = r;
+        }
+        return rotateLeft(off);
+    }
+    return off;
+}
+
+template<class Key, class Value>
+uint64_t MappedAVLTree<Key, Value>::insert_Helper(uint64_t off, const Key& key, const Value& value)
+{
+    if (off == 0) {
+        return create(key, value);
+    }
+
+    if (key < at(off)->key) {
+        uint64_t child = insert_Helper(at(off)->left, key, value);
+        off = writable(off);
+        at(off)->left = child;
+    }
+    else if (at(off)->key < key) {
+        uint64_t child = insert_Helper(at(off)->right, key, value);
+        off = writable(off);
+        at(off)->right = child;
+    }
+    else {
+        off = writable(off);
+        at(off)->value = value;
+        return off;
+    }
+    return balance(off);
+}
+
+/**
+* Expects key to be present.
+*/
+template<class Key, class Value>
+uint64_t MappedAVLTree<Key, Value>::remove_Helper(uint64_t off, const Key& key)
+{
+    if (key < at(off)->key) {
+        uint64_t child = remove_Helper(at(off)->left, key);
+        off = writable(off);
+        at(off)->left = child;
+    }
+    else if (at(off)->key < key) {
+        uint64_t child = remove_Helper(at(off)->right, key);
+        off = writable(off);
+        at(off)->right = child;
+    }
+    else {
+        uint64_t left = at(off)->left;
+        uint64_t right = at(off)->right;
+        if (left == 0 || right == 0) {
+            retire(off);
+            return left ? left : right;
+        }
+        //Replace the entry with its successor's, removed from the right
+        Key nextKey;
+        Value nextValue;
+        uint64_t child = removeMin(right, nextKey, nextValue);
+        off = writable(off);
+        at(off)->key = nextKey;
+        at(off)->value = nextValue;
+        at(off)->right = child;
+    }
+    return balance(off);
+}
+
+/**
+* Removes the smallest node of the subtree, handing back its entry.
+*/
+template<class Key, class Value>
+uint64_t MappedAVLTree<Key, Value>::removeMin(uint64_t off, Key& key, Value& value)
+{
+    if (at(off)->left == 0) {
+        key = at(off)->key;
+        value = at(off)->value;
+        uint64_t right = at(off)->right;
+        retire(off);
+        return right;
+    }
+    uint64_t child = removeMin(at(off)->left, key, value);
+    off = writable(off);
+    at(off)->left = child;
+    return balance(off);
+}
+
+template<class Key, class Value>
+template<typename Func>
+void MappedAVLTree<Key, Value>::for_each_Helper(uint64_t off, Func& f) const
+{
+    while (off) {
+        const MNode* node = at(off);
+        for_each_Helper(node->left, f);
+        f(node->key, node->value);
+        off = node->right;
+    }
+}
+
+/*
+  ------------------------------------------------
+  End implementations for the MappedAVLTree class.
+  ------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,474 @@
+#ifndef PERSISTENT_AVL_H
+#define PERSISTENT_AVL_H
+
+#include <atomic>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+/**
+* An immutable node of a PersistentAVLTree. Nodes are shared between
+* versions of the tree, so they carry an intrusive reference count instead
+* of a parent pointer, and are never modified after construction.
+*/
+template <typename Key, typename Value>
+class PersistentAVLNode
+{
+public:
+    PersistentAVLNode(const std::pair<const Key, Value>& item,
+                      const PersistentAVLNode* left, const PersistentAVLNode* right);
+
+    const std::pair<const Key, Value>& getItem() const { return item_; }
+    const Key& getKey() const { return item_.first; }
+    const Value& getValue() const { return item_.second; }
+    const PersistentAVLNode* getLeft() const { return left_; }
+    const PersistentAVLNode* getRight() const { return right_; }
+    int getHeight() const { return height_; }
+
+    static const PersistentAVLNode* retain(const PersistentAVLNode* node);
+    static void release(const PersistentAVLNode* node);
+
+private:
+    const std::pair<const Key, Value> item_;
+    const PersistentAVLNode* left_;
+    const PersistentAVLNode* right_;
+    const int8_t height_;
+    mutable std::atomic<int> refs_;
+};
+
+/*
+  ----------------------------------------------------
+  Begin implementations for the PersistentAVLNode class.
+  ----------------------------------------------------
+*/
+
+/**
+* Builds a node that adopts one reference to each of left and right.
+*/
+template<class Key, class Value>
+PersistentAVLNode<Key, Value>::PersistentAVLNode(const std::pair<const Key, Value>& item,
+                                                 const PersistentAVLNode* left,
+                                                 const PersistentAVLNode* right) :
+    item_(item),
+    left_(left),
+    right_(right),
+    height_(1 + std::max(left ? left->height_ : 0, right ? right->height_ : 0)),
+    refs_(1)
+{
+
+}
+
+template<class Key, class Value>
+const PersistentAVLNode<Key, Value>* PersistentAVLNode<Key, Value>::retain(const PersistentAVLNode* node)
+{
+    if (node) {
+        node->refs_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return node;
+}
+
+/**
+* Drops one reference, freeing the node (and releasing its children) when
+* the last version that shared it goes away.
+*/
+template<class Key, class Value>
+void PersistentAVLNode<Key, Value>::release(const PersistentAVLNode* node)
+{
+    while (node && node->refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        const PersistentAVLNode* left = node->left_;
+        const PersistentAVLNode* right = node->right_;
+        delete node;
+        release(left);
+        node = right;
+    }
+}
+
+/*
+  --------------------------------------------------
+  End implementations for the PersistentAVLNode class.
+  --------------------------------------------------
+*/
+
+/**
+* A persistent AVL tree. insert and remove copy only the O(log n) nodes on
+* the path they touch and share every other node with the previous version
+* through reference counts, so snapshot() is O(1).
+*
+* A Snapshot is an immutable version of the map. It may be read from any
+* number of threads, without locks, while the owning tree keeps taking
+* writes. The tree itself allows a single writer at a time.
+*/
+template <typename Key, typename Value>
+class PersistentAVLTree
+{
+public:
+    typedef PersistentAVLNode<Key, Value> PNode;
+
+    /**
+    * A read-only version of the tree. Copying a snapshot is O(1).
+    */
+    class Snapshot
+    {
+    public:
+        Snapshot();
+        Snapshot(const Snapshot& other);
+        Snapshot& operator=(const Snapshot& other);
+        ~Snapshot();
+
+        const Value* find(const Key& key) const;
+        bool empty() const { return root_ == nullptr; }
+        size_t size() const { return size_; }
+
+        template<typename Func>
+        void for_each(Func f) const;
+
+    protected:
+        friend class PersistentAVLTree<Key, Value>;
+        Snapshot(const PNode* root, size_t size);
+
+        const PNode* root_;
+        size_t size_;
+    };
+
+    PersistentAVLTree();
+    PersistentAVLTree(const PersistentAVLTree& other);
+    PersistentAVLTree& operator=(const PersistentAVLTree& other);
+    ~PersistentAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    const Value* find(const Key& key) const;
+    bool empty() const { return root_ == nullptr; }
+    size_t size() const { return size_; }
+    Snapshot snapshot() const;
+
+    template<typename Func>
+    void for_each(Func f) const;
+
+protected:
+    static const PNode* find_Helper(const PNode* node, const Key& key);
+    static const PNode* balance(const std::pair<const Key, Value>& item, const PNode* left, const PNode* right);
+    static const PNode* insert_Helper(const PNode* node, const std::pair<const Key, Value>& keyValuePair);
+    static const PNode* remove_Helper(const PNode* node, const Key& key);
+    static const PNode* removeMin(const PNode* node);
+    template<typename Func>
+    static void for_each_Helper(const PNode* node, Func& f);
+
+    static int height(const PNode* node) { return node ? node->getHeight() : 0; }
+
+    const PNode* root_;
+    size_t size_;
+};
+
+/*
+  ------------------------------------------------------------
+  Begin implementations for the PersistentAVLTree::Snapshot class.
+  ------------------------------------------------------------
+*/
+
+template<class Key, class Value>
+PersistentAVLTree<Key, Value>::Snapshot::Snapshot() : root_(nullptr), size_(0)
+{
+
+}
+
+/**
+* Adopts one reference to root.
+*/
+template<class Key, class Value>
+PersistentAVLTree<Key, Value>::Snapshot::Snapshot(const PNode* root, size_t size) :
+    root_(root), size_(size)
+{
+
+}
+
+template<class Key, class Value>
+PersistentAVLTree<Key, Value>::Snapshot::Snapshot(const Snapshot& other) :
+    root_(PNode::retain(other.root_)), size_(other.size_)
+{
+
+}
+
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::Snapshot&
+PersistentAVLTree<Key, Value>::Snapshot::operator=(const Snapshot& other)
+{
+    const PNode* old = root_;
+    root_ = PNode::retain(other.root_);
+    size_ = other.size_;
+    PNode::release(old);
+    return *this;
+}
+
+template<class Key, class Value>
+PersistentAVLTree<Key, Value>::Snapshot::~Snapshot()
+{
+    PNode::release(root_);
+}
+
+/**
+* Returns a pointer to the value stored under key in this version, or NULL.
+* The pointer stays valid for as long as the snapshot does.
+*/
+template<class Key, class Value>
+const Value* PersistentAVLTree<Key, Value>::Snapshot::find(const Key& key) const
+{
+    const PNode* node = PersistentAVLTree<Key, Value>::find_Helper(root_, key);
+    return node ? &node->getValue() : nullptr;
+}
+
+template<class Key, class Value>
+template<typename Func>
+void PersistentAVLTree<Key, Value>::Snapshot::for_each(Func f) const
+{
+    PersistentAVLTree<Key, Value>::for_each_Helper(root_, f);
+}
+
+/*
+  ----------------------------------------------------------
+  End implementations for the PersistentAVLTree::Snapshot class.
+  ----------------------------------------------------------
+*/
+
+/*
+  ------------------------------------------------------
+  Begin implementations for the PersistentAVLTree class.
+  ------------------------------------------------------
+*/
+
+template<class Key, class Value>
+PersistentAVLTree<Key, Value>::PersistentAVLTree() : root_(nullptr), size_(0)
+{
+
+}
+
+/**
+* Copies share every node with other, so copying is O(1).
+*/
+template<class Key, class Value>
+PersistentAVLTree<Key, Value>::PersistentAVLTree(const PersistentAVLTree& other) :
+    root_(PNode::retain(other.root_)), size_(other.size_)
+{
+
+}
+
+template<class Key, class Value>
+PersistentAVLTree<Key, Value>& PersistentAVLTree<Key, Value>::operator=(const PersistentAVLTree& other)
+{
+    const PNode* old = root_;
+    root_ = PNode::retain(other.root_);
+    size_ = other.size_;
+    PNode::release(old);
+    return *this;
+}
+
+template<class Key, class Value>
+PersistentAVLTree<Key, Value>::~PersistentAVLTree()
+{
+    PNode::release(root_);
+}
+
+template<class Key, class Value>
+void PersistentAVLTree<Key, Value>::clear()
+{
+    PNode::release(root_);
+    root_ = nullptr;
+    size_ = 0;
+}
+
+/**
+* Returns an O(1) read-only view of the current version.
+*/
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::Snapshot PersistentAVLTree<Key, Value>::snapshot() const
+{
+    return Snapshot(PNode::retain(root_), size_);
+}
+
+template<class Key, class Value>
+const Value* PersistentAVLTree<Key, Value>::find(const Key& key) const
+{
+    const PNode* node = find_Helper(root_, key);
+    return node ? &node->getValue() : nullptr;
+}
+
+/**
+* Inserts by copying the search path. If the key is already present its
+* value is overwritten (in the copy).
+*/
+template<class Key, class Value>
+void PersistentAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    if (find_Helper(root_, keyValuePair.first) == nullptr) {
+        size_++;
+    }
+
+    const PNode* old = root_;
+    root_ = insert_Helper(root_, keyValuePair);
+    PNode::release(old);
+}
+
+/**
+* Removes by copying the search path. Does nothing (and copies nothing) if
+* the key is absent.
+*/
+template<class Key, class Value>
+void PersistentAVLTree<Key, Value>::remove(const Key& key)
+{
+    if (find_Helper(root_, key) == nullptr) {
+        return;
+    }
+
+    const PNode* old = root_;
+    root_ = remove_Helper(root_, key);
+    PNode::release(old);
+    size_--;
+}
+
+template<class Key, class Value>
+template<typename Func>
+void PersistentAVLTree<Key, Value>::for_each(Func f) const
+{
+    for_each_Helper(root_, f);
+}
+
+template<class Key, class Value>
+const PersistentAVLNode<Key, Value>* PersistentAVLTree<Key, Value>::find_Helper(const PNode* node, const Key& key)
+{
+    while (node) {
+        if (key < node->getKey()) {
+            node = node->getLeft();
+        }
+        else if (node->getKey() < key) {
+            node = node->getRight();
+        }
+        else {
+            return node;
+        }
+    }
+    return nullptr;
+}
+
+/**
+* Builds a new node for item over left and right (adopting both references),
+* applying the single or double rotation needed if their heights differ by
+* two. Rotations allocate fresh nodes rather than relinking shared ones.
+*/
+template<class Key, class Value>
+const PersistentAVLNode<Key, Value>* PersistentAVLTree<Key, Value>::balance(
+    const std::pair<const Key, Value>& item, const PNode* left, const PNode* right)
+{
+    int hl = height(left);
+    int hr = height(right);
+
+    if (hl > hr + 1) {
+        const PNode* result;
+        if (height(left->getLeft()) >= height(left->getRight())) { //Single right rotation
+            result = new PNode(left->getItem(), PNode::retain(left->getLeft()),
+                               new PNode(item, PNode::retain(left->getRight()), right));
+        }
+        else { //Left-right double rotation
+            const PNode* lr = left->getRight();
+            result = new PNode(lr->getItem(),
+                               new PNode(left->getItem(), PNode::retain(left->getLeft()), PNode::retain(lr->getLeft())),
+                               new PNode(item, PNode::retain(lr->getRight()), right));
+        }
+        PNode::release(left);
+        return result;
+    }
+    else if (hr > hl + 1) {
+        const PNode* result;
+        if (height(right->getRight()) >= height(right->getLeft())) { //Single left rotation
+            result = new PNode(right->getItem(),
+                               new PNode(item, left, PNode::retain(right->getLeft())),
+                               PNode::retain(right->getRight()));
+        }
+        else { //Right-left double rotation
+            const PNode* rl = right->getLeft();
+            result = new PNode(rl->getItem(),
+                               new PNode(item, left, PNode::retain(rl->getLeft())),
+                               new PNode(right->getItem(), PNode::retain(rl->getRight()), PNode::retain(right->getRight())));
+        }
+        PNode::release(right);
+        return result;
+    }
+
+    return new PNode(item, left, right);
+}
+
+template<class Key, class Value>
+const PersistentAVLNode<Key, Value>* PersistentAVLTree<Key, Value>::insert_Helper(
+    const PNode* node, const std::pair<const Key, Value>& keyValuePair)
+{
+    if (node == nullptr) {
+        return new PNode(keyValuePair, nullptr, nullptr);
+    }
+
+    if (keyValuePair.first < node->getKey()) {
+        return balance(node->getItem(), insert_Helper(node->getLeft(), keyValuePair), PNode::retain(node->getRight()));
+    }
+    else if (node->getKey() < keyValuePair.first) {
+        return balance(node->getItem(), PNode::retain(node->getLeft()), insert_Helper(node->getRight(), keyValuePair));
+    }
+
+    return new PNode(keyValuePair, PNode::retain(node->getLeft()), PNode::retain(node->getRight()));
+}
+
+/**
+* @precondition key is present in the subtree rooted at node
+* Replaces a node with two children by its successor, like the textbook
+* functional AVL delete.
+*/
+template<class Key, class Value>
+const PersistentAVLNode<Key, Value>* PersistentAVLTree<Key, Value>::remove_Helper(const PNode* node, const Key& key)
+{
+    if (key < node->getKey()) {
+        return balance(node->getItem(), remove_Helper(node->getLeft(), key), PNode::retain(node->getRight()));
+    }
+    else if (node->getKey() < key) {
+        return balance(node->getItem(), PNode::retain(node->getLeft()), remove_Helper(node->getRight(), key));
+    }
+
+    if (node->getLeft() == nullptr) {
+        return PNode::retain(node->getRight());
+    }
+    if (node->getRight() == nullptr) {
+        return PNode::retain(node->getLeft());
+    }
+
+    const PNode* succ = node->getRight();
+    while (succ->getLeft()) {
+        succ = succ->getLeft();
+    }
+    return balance(succ->getItem(), PNode::retain(node->getLeft()), removeMin(node->getRight()));
+}
+
+template<class Key, class Value>
+const PersistentAVLNode<Key, Value>* PersistentAVLTree<Key, Value>::removeMin(const PNode* node)
+{
+    if (node->getLeft() == nullptr) {
+        return PNode::retain(node->getRight());
+    }
+    return balance(node->getItem(), removeMin(node->getLeft()), PNode::retain(node->getRight()));
+}
+
+template<class Key, class Value>
+template<typename Func>
+void PersistentAVLTree<Key, Value>::for_each_Helper(const PNode* node, Func& f)
+{
+    if (node) {
+        for_each_Helper(node->getLeft(), f);
+        f(node->getKey(), node->getValue());
+        for_each_Helper(node->getRight(), f);
+    }
+}
+
+/*
+  ----------------------------------------------------
+  End implementations for the PersistentAVLTree class.
+  ----------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,249 @@
+#ifndef PREFIX_STRING_H
+#define PREFIX_STRING_H
+
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <cstdint>
+#include <ostream>
+#include <functional>
+
+/**
+* A string key for the search trees that keeps its first 8 bytes inline as
+* a big-endian integer. Comparing two keys starts with one integer compare
+* of their prefixes, so most comparisons made while descending a tree never
+* touch a heap buffer. Strings of up to 24 bytes are stored entirely inside
+* the object; longer ones keep everything past the prefix on the heap.
+*
+* Ordering is the same byte-wise lexicographic order as std::string, so a
+* tree keyed on PrefixString iterates in the same order as one keyed on the
+* corresponding std::string.
+*/
+class PrefixString
+{
+public:
+    PrefixString();
+    PrefixString(const char* str);
+    PrefixString(const std::string& str);
+    PrefixString(const char* data, size_t size);
+    PrefixString(const PrefixString& other);
+    PrefixString(PrefixString&& other);
+    ~PrefixString();
+    PrefixString& operator=(const PrefixString& other);
+    PrefixString& operator=(PrefixString&& other);
+
+    size_t size() const;
+    bool empty() const;
+    std::string str() const;
+    explicit operator std::string() const;
+
+    // <0, 0 or >0 as for std::string::compare
+    int compare(const PrefixString& other) const;
+    size_t hash() const;
+
+    friend bool operator==(const PrefixString& a, const PrefixString& b);
+    friend bool operator<(const PrefixString& a, const PrefixString& b) { return a.compare(b) < 0; }
+    friend bool operator!=(const PrefixString& a, const PrefixString& b) { return !(a == b); }
+    friend bool operator>(const PrefixString& a, const PrefixString& b) { return b < a; }
+    friend bool operator<=(const PrefixString& a, const PrefixString& b) { return !(b < a); }
+    friend bool operator>=(const PrefixString& a, const PrefixString& b) { return !(a < b); }
+
+private:
+    static const size_t PREFIX = 8;
+    static const size_t INLINE = PREFIX + 16;
+
+    void assign(const char* data, size_t size);
+    void release();
+    const char* tail() const;
+
+    uint64_t prefix_;    // bytes [0, 8) big-endian, zero padded
+    size_t size_;
+    union
+    {
+        char inline_[INLINE - PREFIX];    // bytes [8, size) when size <= INLINE
+        char* heap_;                      // bytes [8, size) otherwise
+    };
+};
+
+inline PrefixString::PrefixString() : prefix_(0), size_(0)
+{
+
+}
+
+inline PrefixString::PrefixString(const char* str) : prefix_(0), size_(0)
+{
+    assign(str, std::strlen(str));
+}
+
+inline PrefixString::PrefixString(const std::string& str) : prefix_(0), size_(0)
+{
+    assign(str.data(), str.size());
+}
+
+inline PrefixString::PrefixString(const char* data, size_t size) : prefix_(0), size_(0)
+{
+    assign(data, size);
+}
+
+inline PrefixString::PrefixString(const PrefixString& other) : prefix_(0), size_(0)
+{
+    *this = other;
+}
+
+/**
+* Steals the heap tail, if any; the moved-from string is left empty.
+*/
+inline PrefixString::PrefixString(PrefixString&& other) : prefix_(other.prefix_), size_(other.size_)
+{
+    std::memcpy(inline_, other.inline_, sizeof(inline_));
+    other.prefix_ = 0;
+    other.size_ = 0;
+}
+
+inline PrefixString::~PrefixString()
+{
+    release();
+}
+
+inline PrefixString& PrefixString::operator=(const PrefixString& other)
+{
+    if (this != &other) {
+        release();
+        prefix_ = other.prefix_;
+        size_ = other.size_;
+        if (size_ > INLINE) {
+            heap_ = new char[size_ - PREFIX];
+            std::memcpy(heap_, other.heap_, size_ - PREFIX);
+        }
+        else {
+            std::memcpy(inline_, other.inline_, sizeof(inline_));
+        }
+    }
+    return *this;
+}
+
+inline PrefixString& PrefixString::operator=(PrefixString&& other)
+{
+    if (this != &other) {
+        release();
+        prefix_ = other.prefix_;
+        size_ = other.size_;
+        std::memcpy(inline_, other.inline_, sizeof(inline_));
+        other.prefix_ = 0;
+        other.size_ = 0;
+    }
+    return *this;
+}
+
+inline size_t PrefixString::size() const
+{
+    return size_;
+}
+
+inline bool PrefixString::empty() const
+{
+    return size_ == 0;
+}
+
+inline std::string PrefixString::str() const
+{
+    std::string result(size_, '\0');
+    for (size_t i = 0; i < size_ && i < PREFIX; i++) {
+        result[i] = char(prefix_ >> (8 * (PREFIX - 1 - i)));
+    }
+    if (size_ > PREFIX) {
+        std::memcpy(&result[PREFIX], tail(), size_ - PREFIX);
+    }
+    return result;
+}
+
+inline PrefixString::operator std::string() const
+{
+    return str();
+}
+
+/**
+* Prefixes are compared as integers first. Zero padding keeps that
+* consistent with byte order: when prefixes tie, the shorter string is a
+* prefix of the longer one up to the tails, which break the tie.
+*/
+inline int PrefixString::compare(const PrefixString& other) const
+{
+    if (prefix_ != other.prefix_) {
+        return prefix_ < other.prefix_ ? -1 : 1;
+    }
+
+    size_t common = size_ < other.size_ ? size_ : other.size_;
+    if (common > PREFIX) {
+        int result = std::memcmp(tail(), other.tail(), common - PREFIX);
+        if (result != 0) {
+            return result;
+        }
+    }
+    return size_ == other.size_ ? 0 : (size_ < other.size_ ? -1 : 1);
+}
+
+inline bool operator==(const PrefixString& a, const PrefixString& b)
+{
+    return a.prefix_ == b.prefix_ && a.size_ == b.size_
+        && (a.size_ <= PrefixString::PREFIX
+            || std::memcmp(a.tail(), b.tail(), a.size_ - PrefixString::PREFIX) == 0);
+}
+
+inline size_t PrefixString::hash() const
+{
+    size_t h = std::hash<uint64_t>()(prefix_) ^ (size_ * 0x9e3779b97f4a7c15ULL);
+    if (size_ > PREFIX) {
+        h ^= std::hash<std::string_view>()(std::string_view(tail(), size_ - PREFIX)) + (h << 6) + (h >> 2);
+    }
+    return h;
+}
+
+inline void PrefixString::assign(const char* data, size_t size)
+{
+    prefix_ = 0;
+    for (size_t i = 0; i < PREFIX; i++) {
+        prefix_ = (prefix_ << 8) | (i < size ? (unsigned char)data[i] : 0);
+    }
+    size_ = size;
+    if (size_ > INLINE) {
+        heap_ = new char[size_ - PREFIX];
+        std::memcpy(heap_, data + PREFIX, size_ - PREFIX);
+    }
+    else {
+        std::memset(inline_, 0, sizeof(inline_));
+        if (size_ > PREFIX) {
+            std::memcpy(inline_, data + PREFIX, size_ - PREFIX);
+        }
+    }
+}
+
+inline void PrefixString::release()
+{
+    if (size_ > INLINE) {
+        delete [] heap_;
+    }
+    size_ = 0;
+    prefix_ = 0;
+}
+
+inline const char* PrefixString::tail() const
+{
+    return size_ > INLINE ? heap_ : inline_;
+}
+
+inline std::ostream& operator<<(std::ostream& out, const PrefixString& str)
+{
+    return out << str.str();
+}
+
+namespace std
+{
+    template<>
+    struct hash<PrefixString>
+    {
+        size_t operator()(const PrefixString& str) const { return str.hash(); }
+    };
+}
+
+#endif
@@ -0,0 +1,237 @@
+#ifndef SCAPEGOAT_BST_H
+#define SCAPEGOAT_BST_H
+
+#include <vector>
+#include <cmath>
+#include "bst.h"
+
+/**
+* A BinarySearchTree that keeps itself balanced the scapegoat way. It uses
+* the plain Node, with no balance or size field; besides the base node
+* count, the tree only tracks the largest size since the last full rebuild.
+*
+* An insert that lands deeper than log_{1/alpha}(n) walks back up to the
+* lowest ancestor whose subtree is alpha-weight-unbalanced (the
+* scapegoat) and rebuilds that subtree perfectly balanced. Once removals
+* shrink the tree below alpha times its recorded maximum size, the whole
+* tree is rebuilt. Inserts and removes are O(log n) amortized and lookups
+* O(log n) worst case. alpha must lie in (0.5, 1): smaller values give
+* shallower trees at the price of more rebuilding.
+*/
+template <typename Key, typename Value>
+class ScapegoatTree : public BinarySearchTree<Key, Value>
+{
+public:
+    explicit ScapegoatTree(double alpha = 0.7);
+    ScapegoatTree(const ScapegoatTree<Key, Value>& other);
+    ScapegoatTree(ScapegoatTree<Key, Value>&& other);
+    ScapegoatTree<Key, Value>& operator=(const ScapegoatTree<Key, Value>& other);
+    ScapegoatTree<Key, Value>& operator=(ScapegoatTree<Key, Value>&& other);
+
+    size_t size() const;
+
+protected:
+    virtual void attachNode(Node<Key, Value>* node, Node<Key, Value>* parent) override;
+    virtual void unlinkNode(Node<Key, Value>* node) override;
+
+    static size_t subtreeSize(const Node<Key, Value>* node);
+    static void flatten(Node<Key, Value>* node, std::vector<Node<Key, Value>*>& nodes);
+    static Node<Key, Value>* build(Node<Key, Value>** nodes, size_t count, Node<Key, Value>* parent);
+    void rebuild(Node<Key, Value>* node);
+
+    double alpha_;
+    size_t maxSize_;
+};
+
+/*
+  --------------------------------------------------
+  Begin implementations for the ScapegoatTree class.
+  --------------------------------------------------
+*/
+
+template<class Key, class Value>
+ScapegoatTree<Key, Value>::ScapegoatTree(double alpha) :
+    BinarySearchTree<Key, Value>(),
+    alpha_(alpha),
+    maxSize_(0)
+{
+
+}
+
+template<class Key, class Value>
+ScapegoatTree<Key, Value>::ScapegoatTree(const ScapegoatTree<Key, Value>& other) :
+    BinarySearchTree<Key, Value>(other),
+    alpha_(other.alpha_),
+    maxSize_(other.maxSize_)
+{
+
+}
+
+template<class Key, class Value>
+ScapegoatTree<Key, Value>::ScapegoatTree(ScapegoatTree<Key, Value>&& other) :
+    BinarySearchTree<Key, Value>(std::move(other)),
+    alpha_(other.alpha_),
+    maxSize_(other.maxSize_)
+{
+    other.maxSize_ = 0;
+}
+
+template<class Key, class Value>
+ScapegoatTree<Key, Value>& ScapegoatTree<Key, Value>::operator=(const ScapegoatTree<Key, Value>& other)
+{
+    if (this != &other) {
+        BinarySearchTree<Key, Value>::operator=(other);
+        alpha_ = other.alpha_;
+        maxSize_ = other.maxSize_;
+    }
+    return *this;
+}
+
+template<class Key, class Value>
+ScapegoatTree<Key, Value>& ScapegoatTree<Key, Value>::operator=(ScapegoatTree<Key, Value>&& other)
+{
+    if (this != &other) {
+        BinarySearchTree<Key, Value>::operator=(std::move(other));
+        alpha_ = other.alpha_;
+        maxSize_ = other.maxSize_;
+        other.maxSize_ = 0;
+    }
+    return *this;
+}
+
+template<class Key, class Value>
+size_t ScapegoatTree<Key, Value>::size() const
+{
+    return this->nodeCount_;
+}
+
+/**
+* Links the new leaf as usual, then checks its depth against
+* log_{1/alpha}(n). If it is too deep, the walk back up compares each
+* ancestor's subtree size with the size of the child it came from; the
+* first ancestor where that child outweighs alpha of it is rebuilt.
+*
+* The base node count is only bumped after this hook, so the new size is
+* one more than it. An empty tree starts a fresh maximum, however it was
+* emptied.
+*/
+template<class Key, class Value>
+void ScapegoatTree<Key, Value>::attachNode(Node<Key, Value>* node, Node<Key, Value>* parent)
+{
+    BinarySearchTree<Key, Value>::attachNode(node, parent);
+    if (this->nodeCount_ == 0) {
+        maxSize_ = 0;
+    }
+    size_t size = this->nodeCount_ + 1;
+    if (size > maxSize_) {
+        maxSize_ = size;
+    }
+
+    size_t depth = 0;
+    for (Node<Key, Value>* curr = node; curr->getParent(); curr = curr->getParent()) {
+        depth++;
+    }
+    if (depth <= std::floor(std::log(double(size)) / std::log(1.0 / alpha_))) {
+        return;
+    }
+
+    Node<Key, Value>* child = node;
+    size_t childSize = 1;
+    for (Node<Key, Value>* curr = node->getParent(); curr; curr = curr->getParent()) {
+        Node<Key, Value>* sibling = (curr->getLeft() == child) ? curr->getRight() : curr->getLeft();
+        size_t currSize = childSize + subtreeSize(sibling) + 1;
+        if (childSize > alpha_ * currSize) {
+            rebuild(curr);
+            return;
+        }
+        child = curr;
+        childSize = currSize;
+    }
+}
+
+/**
+* As with attachNode, the base count drops only after this hook returns.
+*/
+template<class Key, class Value>
+void ScapegoatTree<Key, Value>::unlinkNode(Node<Key, Value>* node)
+{
+    BinarySearchTree<Key, Value>::unlinkNode(node);
+    size_t size = this->nodeCount_ - 1;
+
+    if (this->root_ && size < alpha_ * maxSize_) {
+        rebuild(this->root_);
+        maxSize_ = size;
+    }
+}
+
+template<class Key, class Value>
+size_t ScapegoatTree<Key, Value>::subtreeSize(const Node<Key, Value>* node)
+{
+    return node ? subtreeSize(node->getLeft()) + 1 + subtreeSize(node->getRight()) : 0;
+}
+
+/**
+* Appends the nodes of the subtree rooted at node to nodes in key order.
+*/
+template<class Key, class Value>
+void ScapegoatTree<Key, Value>::flatten(Node<Key, Value>* node, std::vector<Node<Key, Value>*>& nodes)
+{
+    while (node) {
+        flatten(node->getLeft(), nodes);
+        nodes.push_back(node);
+        node = node->getRight();
+    }
+}
+
+/**
+* Links count nodes, given in key order, into a perfectly balanced subtree
+* hanging from parent and returns its root.
+*/
+template<class Key, class Value>
+Node<Key, Value>* ScapegoatTree<Key, Value>::build(Node<Key, Value>** nodes, size_t count, Node<Key, Value>* parent)
+{
+    if (count == 0) {
+        return nullptr;
+    }
+
+    size_t mid = count / 2;
+    Node<Key, Value>* node = nodes[mid];
+    node->setParent(parent);
+    node->setLeft(build(nodes, mid, node));
+    node->setRight(build(nodes + mid + 1, count - mid - 1, node));
+    return node;
+}
+
+/**
+* Rebuilds the subtree rooted at node perfectly balanced in place of the
+* old one. The cached leftmost and rightmost nodes are unaffected since
+* the set of nodes does not change.
+*/
+template<class Key, class Value>
+void ScapegoatTree<Key, Value>::rebuild(Node<Key, Value>* node)
+{
+    Node<Key, Value>* parent = node->getParent();
+    bool isLeft = parent && parent->getLeft() == node;
+
+    std::vector<Node<Key, Value>*> nodes;
+    flatten(node, nodes);
+    Node<Key, Value>* subtree = build(nodes.data(), nodes.size(), parent);
+
+    if (parent == nullptr) {
+        this->root_ = subtree;
+    }
+    else if (isLeft) {
+        parent->setLeft(subtree);
+    }
+    else {
+        parent->setRight(subtree);
+    }
+}
+
+/*
+  ------------------------------------------------
+  End implementations for the ScapegoatTree class.
+  ------------------------------------------------
+*/
+
+#endif
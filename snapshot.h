@@ -0,0 +1,308 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <typeinfo>
+
+/**
+* Serializers turn keys and values into snapshot bytes. A serializer
+* provides signature(), which names the encoding and is checked on load,
+* write(), which appends a value to a byte buffer, and read(), which
+* decodes one value from [in, end) and advances in, returning false if
+* the bytes run out.
+*
+* Trivially copyable types are copied byte for byte with memcpy, and
+* std::string is stored length-prefixed. Other types need a Serializer
+* specialization (or a custom serializer passed to save/load).
+*/
+template <typename T, typename Enable = void>
+struct Serializer;
+
+template <typename T>
+struct Serializer<T, typename std::enable_if<std::is_trivially_copyable<T>::value>::type>
+{
+    static std::string signature()
+    {
+        return "raw" + std::to_string(sizeof(T)) + ":" + typeid(T).name();
+    }
+
+    static void write(std::vector<char>& out, const T& value)
+    {
+        size_t at = out.size();
+        out.resize(at + sizeof(T));
+        std::memcpy(&out[at], &value, sizeof(T));
+    }
+
+    static bool read(const char*& in, const char* end, T& value)
+    {
+        if (size_t(end - in) < sizeof(T)) {
+            return false;
+        }
+        std::memcpy(&value, in, sizeof(T));
+        in += sizeof(T);
+        return true;
+    }
+};
+
+template <>
+struct Serializer<std::string>
+{
+    static std::string signature()
+    {
+        return "string";
+    }
+
+    static void write(std::vector<char>& out, const std::string& value)
+    {
+        Serializer<uint64_t>::write(out, value.size());
+        out.insert(out.end(), value.begin(), value.end());
+    }
+
+    static bool read(const char*& in, const char* end, std::string& value)
+    {
+        uint64_t size;
+        if (!Serializer<uint64_t>::read(in, end, size) || uint64_t(end - in) < size) {
+            return false;
+        }
+        value.assign(in, size_t(size));
+        in += size;
+        return true;
+    }
+};
+
+/**
+* The snapshot container format, shared by every tree's save and load.
+*
+*   header:  magic "BSTSNAP1", format version, byte order mark,
+*            hash of the key/value signature, entry count
+*   chunks:  byte length followed by that many bytes of whole entries
+*   trailer: a zero length, then a checksum over all chunk bytes
+*
+* Entries never straddle chunks, so a reader holds one chunk at a time
+* and memory stays bounded no matter how large the snapshot is.
+*/
+class SnapshotFormat
+{
+public:
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint32_t ENDIAN_MARK = 0x01020304;
+    static constexpr size_t CHUNK = 64 * 1024;
+
+    static uint64_t hash(const char* data, size_t size, uint64_t seed = 0xcbf29ce484222325ULL);
+};
+
+/**
+* FNV-1a, taken a 64-bit word at a time for speed.
+*/
+inline uint64_t SnapshotFormat::hash(const char* data, size_t size, uint64_t seed)
+{
+    const uint64_t prime = 0x100000001b3ULL;
+    uint64_t h = seed;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        h = (h ^ word) * prime;
+    }
+    for (; i < size; i++) {
+        h = (h ^ (unsigned char)data[i]) * prime;
+    }
+    return h;
+}
+
+/**
+* Writes a snapshot. Entries are appended to buffer() one at a time, each
+* followed by endEntry(); finish() writes the trailer.
+*/
+class SnapshotWriter
+{
+public:
+    SnapshotWriter(std::ostream& out, const std::string& signature, uint64_t count);
+
+    std::vector<char>& buffer() { return chunk_; }
+    void endEntry();
+    void finish();
+
+private:
+    template<typename T>
+    void put(const T& value);
+    void flush();
+
+    std::ostream& out_;
+    std::vector<char> chunk_;
+    uint64_t checksum_;
+};
+
+inline SnapshotWriter::SnapshotWriter(std::ostream& out, const std::string& signature, uint64_t count) :
+    out_(out),
+    checksum_(SnapshotFormat::hash(nullptr, 0))
+{
+    out_.write("BSTSNAP1", 8);
+    put(SnapshotFormat::VERSION);
+    put(SnapshotFormat::ENDIAN_MARK);
+    put(SnapshotFormat::hash(signature.data(), signature.size()));
+    put(count);
+    chunk_.reserve(SnapshotFormat::CHUNK);
+}
+
+inline void SnapshotWriter::endEntry()
+{
+    if (chunk_.size() >= SnapshotFormat::CHUNK) {
+        flush();
+    }
+}
+
+inline void SnapshotWriter::finish()
+{
+    flush();
+    put(uint32_t(0));
+    put(checksum_);
+    out_.flush();
+    if (!out_) {
+        throw std::runtime_error("Snapshot write failed");
+    }
+}
+
+template<typename T>
+void SnapshotWriter::put(const T& value)
+{
+    out_.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+inline void SnapshotWriter::flush()
+{
+    if (chunk_.empty()) {
+        return;
+    }
+    put(uint32_t(chunk_.size()));
+    out_.write(chunk_.data(), chunk_.size());
+    checksum_ = SnapshotFormat::hash(chunk_.data(), chunk_.size(), checksum_);
+    chunk_.clear();
+}
+
+/**
+* Reads a snapshot written by SnapshotWriter, checking the header against
+* the expected signature up front and the checksum in finish(). Every
+* problem is reported as a std::runtime_error.
+*/
+class SnapshotReader
+{
+public:
+    SnapshotReader(std::istream& in, const std::string& signature);
+
+    uint64_t count() const { return count_; }
+
+    template<typename S, typename T>
+    void read(T& value);
+    void finish();
+
+private:
+    template<typename T>
+    void get(T& value);
+    void fail(const char* what);
+
+    std::istream& in_;
+    std::vector<char> chunk_;
+    const char* pos_;
+    const char* end_;
+    uint64_t count_;
+    uint64_t checksum_;
+};
+
+inline SnapshotReader::SnapshotReader(std::istream& in, const std::string& signature) :
+    in_(in),
+    pos_(nullptr),
+    end_(nullptr),
+    count_(0),
+    checksum_(SnapshotFormat::hash(nullptr, 0))
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t typeHash;
+
+    in_.read(magic, 8);
+    if (!in_ || std::memcmp(magic, "BSTSNAP1", 8) != 0) {
+        fail("not a snapshot");
+    }
+    get(version);
+    get(byteOrder);
+    get(typeHash);
+    get(count_);
+    if (version != SnapshotFormat::VERSION) {
+        fail("unsupported version");
+    }
+    if (byteOrder != SnapshotFormat::ENDIAN_MARK) {
+        fail("written with a different byte order");
+    }
+    if (typeHash != SnapshotFormat::hash(signature.data(), signature.size())) {
+        fail("key or value type does not match");
+    }
+}
+
+/**
+* Decodes the next value with serializer S, pulling in the next chunk
+* when the current one is used up.
+*/
+template<typename S, typename T>
+void SnapshotReader::read(T& value)
+{
+    if (pos_ == end_) {
+        uint32_t size;
+        get(size);
+        if (size == 0) {
+            fail("fewer entries than the header promises");
+        }
+        chunk_.resize(size);
+        in_.read(chunk_.data(), size);
+        if (!in_) {
+            fail("truncated");
+        }
+        checksum_ = SnapshotFormat::hash(chunk_.data(), size, checksum_);
+        pos_ = chunk_.data();
+        end_ = pos_ + size;
+    }
+    if (!S::read(pos_, end_, value)) {
+        fail("entry runs past its chunk");
+    }
+}
+
+inline void SnapshotReader::finish()
+{
+    uint32_t size;
+    uint64_t checksum;
+    if (pos_ != end_) {
+        fail("more entries than the header promises");
+    }
+    get(size);
+    if (size != 0) {
+        fail("more entries than the header promises");
+    }
+    get(checksum);
+    if (checksum != checksum_) {
+        fail("checksum mismatch");
+    }
+}
+
+template<typename T>
+void SnapshotReader::get(T& value)
+{
+    in_.read(reinterpret_cast<char*>(&value), sizeof(T));
+    if (!in_) {
+        fail("truncated");
+    }
+}
+
+inline void SnapshotReader::fail(const char* what)
+{
+    throw std::runtime_error(std::string("Corrupt snapshot: ") + what);
+}
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef TREE_DIFF_H
+#define TREE_DIFF_H
+
+#include <functional>
+#include "avlbst.h"
+#include "augmented_avl.h"
+
+/**
+* The changes that turn one map into another: a key only the target has,
+* a key whose value differs, and a key only the source has.
+*/
+enum class DeltaKind
+{
+    Insert,
+    Update,
+    Remove
+};
+
+/**
+* One change, as stored by a caller shipping a diff to a replica. For a
+* removal, value is the value being removed.
+*/
+template <typename Key, typename Value>
+struct TreeDelta
+{
+    DeltaKind kind;
+    Key key;
+    Value value;
+};
+
+/**
+* An AVL tree that keeps a digest of every subtree (see DigestMonoid), so
+* that diff() can tell an unchanged range apart from a changed one in
+* O(log n) without visiting its entries.
+*/
+template <typename Key, typename Value,
+          typename KeyHash = std::hash<Key>, typename ValueHash = std::hash<Value> >
+class DigestAVLTree : public AugmentedAVLTree<Key, Value, DigestMonoid<KeyHash, ValueHash> >
+{
+public:
+    typedef DigestMonoid<KeyHash, ValueHash> Monoid;
+    typedef typename Monoid::Digest Digest;
+
+    // Calls f(kind, key, value) for every change from this tree to other,
+    // in key order
+    template<typename Func>
+    void diff(const DigestAVLTree<Key, Value, KeyHash, ValueHash>& other, Func f) const;
+
+protected:
+    template<typename Func>
+    void diff_Helper(const DigestAVLTree<Key, Value, KeyHash, ValueHash>& other, Node<Key, Value>* node,
+                     const Node<Key, Value>* head, const Key* lo, const Key* hi, Func& f) const;
+};
+
+/*
+  --------------------------------------------------
+  Begin implementations for the DigestAVLTree class.
+  --------------------------------------------------
+*/
+
+/**
+* Recurses down this tree, comparing the digest of each key range with the
+* digest of the same range in other and skipping the range when they
+* match. Only the paths leading to changes are walked, so the cost is
+* O(d log^2 n) for d changes rather than O(n).
+*/
+template<class Key, class Value, class KeyHash, class ValueHash>
+template<typename Func>
+void DigestAVLTree<Key, Value, KeyHash, ValueHash>::diff(const DigestAVLTree<Key, Value, KeyHash, ValueHash>& other,
+                                                         Func f) const
+{
+    diff_Helper(other, this->root_, nullptr, nullptr, nullptr, f);
+}
+
+/**
+* Diffs the range [lo, hi) (NULL bounds are open), in which this tree
+* holds node's subtree and, if not NULL, head, whose key is lo.
+*/
+template<class Key, class Value, class KeyHash, class ValueHash>
+template<typename Func>
+void DigestAVLTree<Key, Value, KeyHash, ValueHash>::diff_Helper(
+    const DigestAVLTree<Key, Value, KeyHash, ValueHash>& other, Node<Key, Value>* node,
+    const Node<Key, Value>* head, const Key* lo, const Key* hi, Func& f) const
+{
+    Digest mine = this->aggregateOf(node);
+    if (head) {
+        mine = Monoid::combine(Monoid::lift(head->getKey(), head->getValue()), mine);
+    }
+    if (mine == other.rangeAggregate(lo, hi)) {
+        return;
+    }
+
+    if (node) {
+        diff_Helper(other, node->getLeft(), head, lo, &node->getKey(), f);
+        diff_Helper(other, node->getRight(), node, &node->getKey(), hi, f);
+        return;
+    }
+
+    // Only head is left on this side; compare it with other's range entry by entry
+    typename BinarySearchTree<Key, Value>::const_iterator it = lo ? other.lower_bound(*lo) : other.begin();
+    for (; it != other.end() && (!hi || it->first < *hi); ++it) {
+        if (head && !(it->first < head->getKey())) {
+            if (head->getKey() < it->first) {
+                f(DeltaKind::Remove, head->getKey(), head->getValue());
+                f(DeltaKind::Insert, it->first, it->second);
+            }
+            else if (!(head->getValue() == it->second)) {
+                f(DeltaKind::Update, it->first, it->second);
+            }
+            head = nullptr;
+        }
+        else {
+            f(DeltaKind::Insert, it->first, it->second);
+        }
+    }
+    if (head) {
+        f(DeltaKind::Remove, head->getKey(), head->getValue());
+    }
+}
+
+/*
+  ------------------------------------------------
+  End implementations for the DigestAVLTree class.
+  ------------------------------------------------
+*/
+
+/**
+* Calls f(kind, key, value) for every change that turns a into b, in key
+* order, by walking both trees in order in lockstep. O(n + m).
+*/
+template<typename Tree, typename Func>
+void diff(const Tree& a, const Tree& b, Func f)
+{
+    typename Tree::iterator ia = a.begin();
+    typename Tree::iterator ib = b.begin();
+    while (ia != a.end() || ib != b.end()) {
+        if (ib == b.end() || (ia != a.end() && ia->first < ib->first)) {
+            f(DeltaKind::Remove, ia->first, ia->second);
+            ++ia;
+        }
+        else if (ia == a.end() || ib->first < ia->first) {
+            f(DeltaKind::Insert, ib->first, ib->second);
+            ++ib;
+        }
+        else {
+            if (!(ia->second == ib->second)) {
+                f(DeltaKind::Update, ib->first, ib->second);
+            }
+            ++ia;
+            ++ib;
+        }
+    }
+}
+
+/**
+* Trees with subtree digests skip the ranges they agree on.
+*/
+template<typename Key, typename Value, typename KeyHash, typename ValueHash, typename Func>
+void diff(const DigestAVLTree<Key, Value, KeyHash, ValueHash>& a,
+          const DigestAVLTree<Key, Value, KeyHash, ValueHash>& b, Func f)
+{
+    a.diff(b, f);
+}
+
+/**
+* Applies the TreeDeltas in [first, last) to replica one at a time.
+*/
+template<typename Key, typename Value, typename InputIt>
+void applyDiff(BinarySearchTree<Key, Value>& replica, InputIt first, InputIt last)
+{
+    for (; first != last; ++first) {
+        if (first->kind == DeltaKind::Remove) {
+            replica.remove(first->key);
+        }
+        else {
+            replica.insert(std::make_pair(first->key, first->value));
+        }
+    }
+}
+
+/**
+* AVL replicas take the whole diff as one batch, so a large diff is merged
+* in a single pass and a failure leaves the replica untouched.
+*/
+template<typename Key, typename Value, typename InputIt>
+void applyDiff(AVLTree<Key, Value>& replica, InputIt first, InputIt last)
+{
+    replica.begin_batch();
+    try {
+        for (; first != last; ++first) {
+            if (first->kind == DeltaKind::Remove) {
+                replica.remove(first->key);
+            }
+            else {
+                replica.insert(std::make_pair(first->key, first->value));
+            }
+        }
+    }
+    catch (...) {
+        replica.rollback();
+        throw;
+    }
+    replica.commit();
+}
+
+#endif
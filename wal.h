@@ -0,0 +1,533 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <stdexcept>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "bst.h"
+#include "snapshot.h"
+
+/**
+* When a WriteAheadLog forces its records to disk: after every record,
+* once per group commit, or never (the OS writes them back in its own
+* time, so a machine crash may lose recent groups).
+*/
+enum class WalSync
+{
+    EveryRecord,
+    EveryGroup,
+    Never
+};
+
+/**
+* An append-only log of the changes made to a tree, for restarts that are
+* both fast and durable without taking full snapshots often. Attach it
+* with setMutationListener(); the tree then reports each insert, remove
+* and clear, which is encoded as a compact record with the snapshot
+* serializers and buffered. Once groupBytes have built up the group is
+* written as one checksummed frame and, depending on the WalSync policy,
+* fsynced, so the cost of a sync is shared by every record in the group.
+* commit() ends a group early.
+*
+*   header: magic "BSTWAL01", format version, byte order mark,
+*           hash of the key/value signature
+*   frames: payload length, checksum of the payload, then the records
+*
+* To restart, load the last snapshot, replay() the log into the tree and
+* attach the log again. After saving a new snapshot, truncate() the log.
+* A frame torn by a crash fails its checksum; replay stops there and cuts
+* the log back to the last whole frame.
+*
+* The log does not own the tree or the other way round, so detach the log
+* before destroying it while the tree lives on.
+*/
+template <typename Key, typename Value,
+          typename KeySerializer = Serializer<Key>, typename ValueSerializer = Serializer<Value> >
+class WriteAheadLog : public MutationListener<Key, Value>
+{
+public:
+    explicit WriteAheadLog(const std::string& path, WalSync policy = WalSync::EveryGroup,
+                           size_t groupBytes = 64 * 1024);
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+    virtual ~WriteAheadLog();
+
+    virtual void onInsert(const Key& key, const Value& value) override;
+    virtual void onRemove(const Key& key) override;
+    virtual void onClear() override;
+
+    void commit();
+    void truncate();
+    size_t pendingBytes() const;
+
+    // Applies every whole frame to tree, which needs insertBatch; returns
+    // the number of records applied. Multimap trees get every record in
+    // log order, since repeated inserts of a key all count there
+    template<typename Tree>
+    size_t replay(Tree& tree, size_t batchSize = 64 * 1024);
+
+private:
+    static const char INSERT = 'I';
+    static const char REMOVE = 'R';
+    static const char CLEAR = 'C';
+    static const size_t FRAME_HEADER = sizeof(uint32_t) + sizeof(uint64_t);
+
+    struct Record
+    {
+        char op;
+        Key key;
+        Value value;
+    };
+
+    // Stands in for a tree when a scan only needs to find the end
+    struct Discard
+    {
+        template<typename InputIt>
+        void insertBatch(InputIt, InputIt) { }
+        void insert(const std::pair<const Key, Value>&) { }
+        void remove(const Key&) { }
+        void clear() { }
+        bool isMultimap() const { return false; }
+    };
+
+    static uint64_t signatureHash();
+    static uint64_t headerSize();
+    static bool keyLess(const Record& a, const Record& b);
+
+    void beginRecord(char op);
+    void endRecord();
+    void scan();
+    template<typename Tree>
+    size_t scan(Tree& tree, size_t batchSize);
+    template<typename Tree>
+    void apply(Tree& tree, std::vector<Record>& batch);
+    bool readAt(uint64_t offset, char* data, size_t size);
+    void writeAt(uint64_t offset, const char* data, size_t size);
+    void sync();
+    void fail(const char* what);
+
+    std::string path_;
+    int fd_;
+    WalSync sync_;
+    size_t groupBytes_;
+    std::vector<char> group_;    // frame header space, then the buffered records
+    uint64_t end_;               // end of the last whole frame
+    bool scanned_;               // end_ is known
+};
+
+/*
+  --------------------------------------------------
+  Begin implementations for the WriteAheadLog class.
+  --------------------------------------------------
+*/
+
+/**
+* Opens or creates the log at path. An existing log must have been written
+* for the same key and value encodings.
+*/
+template<class Key, class Value, class KS, class VS>
+WriteAheadLog<Key, Value, KS, VS>::WriteAheadLog(const std::string& path, WalSync policy, size_t groupBytes) :
+    path_(path),
+    fd_(-1),
+    sync_(policy),
+    groupBytes_(groupBytes ? groupBytes : 1),
+    group_(FRAME_HEADER),
+    end_(0),
+    scanned_(false)
+{
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+
+    struct stat st;
+    if (fstat(fd_, &st) != 0) {
+        ::close(fd_);
+        throw std::runtime_error("Cannot stat " + path);
+    }
+
+    try {
+        if (st.st_size == 0) {
+            std::vector<char> header;
+            header.insert(header.end(), "BSTWAL01", "BSTWAL01" + 8);
+            Serializer<uint32_t>::write(header, SnapshotFormat::VERSION);
+            Serializer<uint32_t>::write(header, SnapshotFormat::ENDIAN_MARK);
+            Serializer<uint64_t>::write(header, signatureHash());
+            writeAt(0, header.data(), header.size());
+            sync();
+            end_ = headerSize();
+            scanned_ = true;
+        }
+        else {
+            char header[8 + 4 + 4 + 8];
+            uint32_t version;
+            uint32_t byteOrder;
+            uint64_t typeHash;
+            if (!readAt(0, header, sizeof(header)) || std::memcmp(header, "BSTWAL01", 8) != 0) {
+                fail("not a log");
+            }
+            std::memcpy(&version, header + 8, 4);
+            std::memcpy(&byteOrder, header + 12, 4);
+            std::memcpy(&typeHash, header + 16, 8);
+            if (version != SnapshotFormat::VERSION) {
+                fail("unsupported version");
+            }
+            if (byteOrder != SnapshotFormat::ENDIAN_MARK) {
+                fail("written with a different byte order");
+            }
+            if (typeHash != signatureHash()) {
+                fail("key or value type does not match");
+            }
+        }
+    }
+    catch (...) {
+        ::close(fd_);
+        throw;
+    }
+}
+
+/**
+* Commits the pending group. Errors cannot be reported from here, so call
+* commit() first to see them.
+*/
+template<class Key, class Value, class KS, class VS>
+WriteAheadLog<Key, Value, KS, VS>::~WriteAheadLog()
+{
+    try {
+        commit();
+    }
+    catch (...) {
+    }
+    ::close(fd_);
+}
+
+template<class Key, class Value, class KS, class VS>
+void WriteAheadLog<Key, Value, KS, VS>::onInsert(const Key& key, const Value& value)
+{
+    beginRecord(INSERT);
+    KS::write(group_, key);
+    VS::write(group_, value);
+    endRecord();
+}
+
+template<class Key, class Value, class KS, class VS>
+void WriteAheadLog<Key, Value, KS, VS>::onRemove(const Key& key)
+{
+    beginRecord(REMOVE);
+    KS::write(group_, key);
+    endRecord();
+}
+
+template<class Key, class Value, class KS, class VS>
+void WriteAheadLog<Key, Value, KS, VS>::onClear()
+{
+    beginRecord(CLEAR);
+    endRecord();
+}
+
+/**
+* Writes the buffered records as one frame and syncs it unless the policy
+* is WalSync::Never.
+*/
+template<class Key, class Value, class KS, class VS>
+void WriteAheadLog<Key, Value, KS, VS>::commit()
+{
+    if (group_.size() == FRAME_HEADER) {
+        return;
+    }
+    scan();
+
+    uint32_t size = uint32_t(group_.size() - FRAME_HEADER);
+    uint64_t checksum = SnapshotFormat::hash(group_.data() + FRAME_HEADER, size);
+    std::memcpy(group_.data(), &size, sizeof(size));
+    std::memcpy(group_.data() + sizeof(size), &checksum, sizeof(checksum));
+
+    writeAt(end_, group_.data(), group_.size());
+    if (sync_ != WalSync::Never) {
+        sync();
+    }
+    end_ += group_.size();
+    group_.resize(FRAME_HEADER);
+}
+
+/**
+* Drops every record, including pending ones; call it once a snapshot
+* holds everything the log did.
+*/
+template<class Key, class Value, class KS, class VS>
+void WriteAheadLog<Key, Value, KS, VS>::truncate()
+{
+    group_.resize(FRAME_HEADER);
+    if (ftruncate(fd_, headerSize()) != 0) {
+        throw std::runtime_error("Cannot truncate " + path_);
+    }
+    sync();
+    end_ = headerSize();
+    scanned_ = true;
+}
+
+/**
+* Returns the bytes of records waiting for the next commit.
+*/
+template<class Key, class Value, class KS, class VS>
+size_t WriteAheadLog<Key, Value, KS, VS>::pendingBytes() const
+{
+    return group_.size() - FRAME_HEADER;
+}
+
+/**
+* Records are applied batchSize at a time rather than one descent each:
+* a batch is sorted by key, reduced to the last record per key, and the
+* surviving inserts go in with one insertBatch. In a multimap every
+* insert adds an entry, so records are applied one by one in log order
+* instead. A clear record applies the batch before it first. The tree's mutation listener is detached while
+* replaying, so the log does not record its own records again.
+*/
+template<class Key, class Value, class KS, class VS>
+template<typename Tree>
+size_t WriteAheadLog<Key, Value, KS, VS>::replay(Tree& tree, size_t batchSize)
+{
+    commit();
+
+    MutationListener<Key, Value>* listener = tree.mutationListener();
+    tree.setMutationListener(nullptr);
+    size_t count;
+    try {
+        count = scan(tree, batchSize ? batchSize : 1);
+    }
+    catch (...) {
+        tree.setMutationListener(listener);
+        throw;
+    }
+    tree.setMutationListener(listener);
+    return count;
+}
+
+template<class Key, class Value, class KS, class VS>
+uint64_t WriteAheadLog<Key, Value, KS, VS>::signatureHash()
+{
+    std::string signature = KS::signature() + "/" + VS::signature();
+    return SnapshotFormat::hash(signature.data(), signature.size());
+}
+
+template<class Key, class Value, class KS, class VS>
+uint64_t WriteAheadLog<Key, Value, KS, VS>::headerSize()
+{
+    return 8 + sizeof(uint32_t) + sizeof(uint32_t) + sizeof(uint64_t);
+}
+
+template<class Key, class Value, class KS, class VS>
+bool WriteAheadLog<Key, Value, KS, VS>::keyLess(const Record& a, const Record& b)
+{
+    return a.key < b.key;
+}
+
+template<class Key, class Value, class KS, class VS>
+void WriteAheadLog<Key, Value, KS, VS>::beginRecord(char op)
+{
+    group_.push_back(op);
+}
+
+template<class Key, class Value, class KS, class VS>
+void WriteAheadLog<Key, Value, KS, VS>::endRecord()
+{
+    if (sync_ == WalSync::EveryRecord || group_.size() - FRAME_HEADER >= groupBytes_) {
+        commit();
+    }
+}
+
+/**
+* Finds the end of the last whole frame before the first append, so new
+* frames never land behind a torn one.
+*/
+template<class Key, class Value, class KS, class VS>
+void WriteAheadLog<Key, Value, KS, VS>::scan()
+{
+    if (!scanned_) {
+        Discard discard;
+        scan(discard, 1);
+    }
+}
+
+/**
+* Walks the frames, applying their records to tree, then cuts off
+* anything past the last whole frame. A frame whose length runs past the
+* end of the file is torn, so the length is checked before allocating.
+*/
+template<class Key, class Value, class KS, class VS>
+template<typename Tree>
+size_t WriteAheadLog<Key, Value, KS, VS>::scan(Tree& tree, size_t batchSize)
+{
+    std::vector<char> payload;
+    std::vector<Record> batch;
+    size_t count = 0;
+    uint64_t offset = headerSize();
+
+    struct stat st;
+    if (fstat(fd_, &st) != 0) {
+        throw std::runtime_error("Cannot stat " + path_);
+    }
+    uint64_t fileSize = uint64_t(st.st_size);
+
+    for (;;) {
+        char header[FRAME_HEADER];
+        uint32_t size;
+        uint64_t checksum;
+        if (!readAt(offset, header, FRAME_HEADER)) {
+            break;
+        }
+        std::memcpy(&size, header, sizeof(size));
+        std::memcpy(&checksum, header + sizeof(size), sizeof(checksum));
+        if (size == 0 || offset + FRAME_HEADER + size > fileSize) {
+            break;
+        }
+        payload.resize(size);
+        if (!readAt(offset + FRAME_HEADER, payload.data(), size)
+            || SnapshotFormat::hash(payload.data(), size) != checksum) {
+            break;
+        }
+        offset += FRAME_HEADER + size;
+
+        const char* in = payload.data();
+        const char* end = in + size;
+        while (in != end) {
+            Record record;
+            record.op = *in++;
+            if (record.op == CLEAR) {
+                apply(tree, batch);
+                tree.clear();
+            }
+            else if ((record.op != INSERT && record.op != REMOVE) || !KS::read(in, end, record.key)
+                     || (record.op == INSERT && !VS::read(in, end, record.value))) {
+                fail("bad record");
+            }
+            else {
+                batch.push_back(record);
+                if (batch.size() >= batchSize) {
+                    apply(tree, batch);
+                }
+            }
+            count++;
+        }
+    }
+    apply(tree, batch);
+
+    if (fileSize > offset) { //Torn tail
+        if (ftruncate(fd_, offset) != 0) {
+            throw std::runtime_error("Cannot truncate " + path_);
+        }
+        sync();
+    }
+    end_ = offset;
+    scanned_ = true;
+    return count;
+}
+
+/**
+* Applies the batch: in log order for a multimap, otherwise reduced to the
+* last record per key (see replay).
+*/
+template<class Key, class Value, class KS, class VS>
+template<typename Tree>
+void WriteAheadLog<Key, Value, KS, VS>::apply(Tree& tree, std::vector<Record>& batch)
+{
+    if (tree.isMultimap()) {
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (batch[i].op == INSERT) {
+                tree.insert(std::make_pair(batch[i].key, batch[i].value));
+            }
+            else {
+                tree.remove(batch[i].key);
+            }
+        }
+        batch.clear();
+        return;
+    }
+
+    std::stable_sort(batch.begin(), batch.end(), keyLess);
+
+    std::vector<std::pair<Key, Value> > inserts;
+    for (size_t i = 0; i < batch.size(); i++) {
+        if (i + 1 < batch.size() && !(batch[i].key < batch[i + 1].key)) {
+            continue; //A later record for the same key wins
+        }
+        if (batch[i].op == INSERT) {
+            inserts.push_back(std::make_pair(batch[i].key, batch[i].value));
+        }
+        else {
+            tree.remove(batch[i].key);
+        }
+    }
+    tree.insertBatch(inserts.begin(), inserts.end());
+    batch.clear();
+}
+
+/**
+* Reads size bytes at offset, returning false if the file ends first.
+*/
+template<class Key, class Value, class KS, class VS>
+bool WriteAheadLog<Key, Value, KS, VS>::readAt(uint64_t offset, char* data, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = pread(fd_, data, size, off_t(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            throw std::runtime_error("Cannot read " + path_);
+        }
+        if (n == 0) {
+            return false;
+        }
+        data += n;
+        offset += n;
+        size -= n;
+    }
+    return true;
+}
+
+template<class Key, class Value, class KS, class VS>
+void WriteAheadLog<Key, Value, KS, VS>::writeAt(uint64_t offset, const char* data, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = pwrite(fd_, data, size, off_t(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            throw std::runtime_error("Cannot write " + path_);
+        }
+        data += n;
+        offset += n;
+        size -= n;
+    }
+}
+
+template<class Key, class Value, class KS, class VS>
+void WriteAheadLog<Key, Value, KS, VS>::sync()
+{
+    if (fsync(fd_) != 0) {
+        throw std::runtime_error("Cannot sync " + path_);
+    }
+}
+
+template<class Key, class Value, class KS, class VS>
+void WriteAheadLog<Key, Value, KS, VS>::fail(const char* what)
+{
+    throw std::runtime_error(std::string("Corrupt log: ") + what);
+}
+
+/*
+  ------------------------------------------------
+  End implementations for the WriteAheadLog class.
+  ------------------------------------------------
+*/
+
+#endif